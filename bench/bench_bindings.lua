@@ -0,0 +1,182 @@
+#!/usr/bin/lua
+
+--
+-- usage: bench_bindings.lua [quick|full] [workdir]
+--
+-- times the binding methods against synthetic torrents of growing size
+-- and prints one JSON object per measurement, e.g.
+--
+--   {"bench":"info:files","scale":1000,"calls":50,"mean_ns":...}
+--
+-- the timings come from Torrent.Profile, so they cover the C++ wrapper
+-- and libtorrent but not the Lua loop around them. "full" adds the
+-- 1M file and piece scales, which need a few hundred MB of memory
+--
+
+require('luatorrent')
+
+local mode = arg[1] or 'quick'
+local workdir = arg[2] or os.getenv('TMPDIR') or '/tmp'
+
+local file_scales = { 10, 1000, 100000 }
+local torrent_scales = { 1, 10, 100, 1000 }
+
+if mode == 'full' then
+    table.insert(file_scales, 1000000)
+    table.insert(torrent_scales, 10000)
+end
+
+-- a minimal bencoder, enough to write synthetic .torrent files
+local function bencode(v, out)
+    local t = type(v)
+
+    if t == 'number' then
+        table.insert(out, string.format('i%de', v))
+    elseif t == 'string' then
+        table.insert(out, string.format('%d:', #v))
+        table.insert(out, v)
+    elseif v[1] ~= nil then
+        table.insert(out, 'l')
+        for _, e in ipairs(v) do
+            bencode(e, out)
+        end
+        table.insert(out, 'e')
+    else
+        local keys = {}
+        for k in pairs(v) do
+            table.insert(keys, k)
+        end
+        table.sort(keys)
+
+        table.insert(out, 'd')
+        for _, k in ipairs(keys) do
+            bencode(k, out)
+            bencode(v[k], out)
+        end
+        table.insert(out, 'e')
+    end
+
+    return out
+end
+
+-- writes a torrent with num_files files and num_pieces pieces, the piece
+-- hashes are fake since nothing is ever verified
+local function synthetic_torrent(name, num_files, num_pieces)
+    local piece_length = 16384
+    local total = num_pieces * piece_length
+    local files = {}
+
+    local size = math.floor(total / num_files)
+    for i = 1, num_files do
+        local len = size
+        if i == num_files then
+            len = total - size * (num_files - 1)
+        end
+
+        files[i] = { length = len, path = { string.format('d%d', i % 100), string.format('f%d', i) } }
+    end
+
+    local info = {
+        name = name,
+        ['piece length'] = piece_length,
+        pieces = string.rep('0123456789abcdefghij', num_pieces),
+        files = files,
+    }
+
+    local path = string.format('%s/%s.torrent', workdir, name)
+    local f = assert(io.open(path, 'wb'))
+    f:write(table.concat(bencode({ announce = 'http://127.0.0.1:1/announce', info = info }, {})))
+    f:close()
+
+    return path
+end
+
+local function json(t)
+    local keys = {}
+    for k in pairs(t) do
+        table.insert(keys, k)
+    end
+    table.sort(keys)
+
+    local parts = {}
+    for _, k in ipairs(keys) do
+        local v = t[k]
+        if type(v) == 'string' then
+            v = string.format('"%s"', v)
+        else
+            v = string.format('%.0f', v)
+        end
+        table.insert(parts, string.format('"%s":%s', k, v))
+    end
+
+    return '{' .. table.concat(parts, ',') .. '}'
+end
+
+-- runs fn until it has had at least min_calls calls or spent about a
+-- second, then reports the profile entry for method
+local function measure(bench, scale, method, fn)
+    Torrent.Profile.reset()
+    Torrent.Profile.enable()
+
+    local start = os.time()
+    local n = 0
+    repeat
+        fn()
+        n = n + 1
+    until (n >= 5 and os.time() - start >= 1) or n >= 1000
+
+    Torrent.Profile.disable()
+
+    local r = Torrent.Profile.report()[method]
+    if r then
+        r.bench = bench
+        r.scale = scale
+        print(json(r))
+        io.stdout:flush()
+    end
+
+    collectgarbage()
+end
+
+-- torrent_info methods as the number of files and pieces grows
+for _, n in ipairs(file_scales) do
+    local path = synthetic_torrent(string.format('bench-files-%d', n), n, n)
+    local info = Torrent.Info.New(path)
+
+    measure('info:files', n, 'Torrent.Info:files', function() info:files() end)
+    measure('info:filenames', n, 'Torrent.Info:filenames', function() info:filenames() end)
+    measure('info:file_at', n, 'Torrent.Info:file_at', function() info:file_at(n - 1) end)
+    measure('info:info_hash', n, 'Torrent.Info:info_hash', function() info:info_hash() end)
+
+    info = nil
+    os.remove(path)
+    collectgarbage()
+end
+
+-- session and handle methods as the number of torrents grows
+local session = Torrent.Session.New(6881, 6981)
+local save_path = workdir .. '/bench-data'
+local handles = {}
+local added = 0
+
+for _, n in ipairs(torrent_scales) do
+    while added < n do
+        added = added + 1
+
+        local path = synthetic_torrent(string.format('bench-torrent-%d', added), 4, 16)
+        table.insert(handles, session:add_torrent(Torrent.Info.New(path), save_path))
+        os.remove(path)
+    end
+
+    local h = handles[1]
+
+    measure('session:torrent_handles', n, 'Torrent.Session:torrent_handles', function() session:torrent_handles() end)
+    measure('session:status', n, 'Torrent.Session:status', function() session:status() end)
+    measure('handle:status', n, 'Torrent.Handle:status', function() h:status() end)
+    measure('handle:get_peer_info', n, 'Torrent.Handle:get_peer_info', function() h:get_peer_info() end)
+    measure('handle:get_download_queue', n, 'Torrent.Handle:get_download_queue', function() h:get_download_queue() end)
+end
+
+for _, h in ipairs(handles) do
+    session:remove_torrent(h)
+end
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * bench_storage [dir, [size_mb, [ops, [piece_kb]]]]
+ *
+ *   compares libtorrent's default storage with the io_uring storage
+ *   (buffered and O_DIRECT reads) on a single file of size_mb under dir.
+ *   For each backend it drops the file from the page cache and times
+ *   ops random 16KB block reads, then hashes every piece the way a
+ *   recheck does. Prints one JSON line per backend and test with IOPS,
+ *   throughput and p50/p99 latency. Built by make bench-storage, which
+ *   needs USE_URING=1.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/storage.hpp"
+#include "libtorrent/file_pool.hpp"
+#include "libtorrent/hasher.hpp"
+
+#include "uring_storage.h"
+
+using namespace libtorrent;
+
+#define BLOCK_SIZE (16 * 1024)
+
+static double now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double percentile(std::vector<double> &v, double p) {
+    if (v.empty())
+	return 0;
+
+    std::sort(v.begin(), v.end());
+
+    size_t i = (size_t)(p * (v.size() - 1));
+
+    return v[i];
+}
+
+static void make_file(const std::string &path, long long size) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+	perror(path.c_str());
+	exit(1);
+    }
+
+    std::vector<char> buf(1024 * 1024);
+    unsigned int seed = 1;
+
+    for (long long done = 0; done < size; done += buf.size()) {
+	for (size_t i = 0; i < buf.size(); i++)
+	    buf[i] = (char)(rand_r(&seed) & 0xff);
+
+	size_t len = (size_t)std::min((long long)buf.size(), size - done);
+
+	if (::write(fd, &buf[0], len) != (ssize_t)len) {
+	    perror("write");
+	    exit(1);
+	}
+    }
+
+    fsync(fd);
+    ::close(fd);
+}
+
+/* so every backend starts from a cold cache */
+static void evict(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd >= 0) {
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	::close(fd);
+    }
+}
+
+static void report(const char *backend, const char *test, std::vector<double> &lat, double elapsed_us, long long bytes) {
+    printf("{\"bench\":\"storage\",\"backend\":\"%s\",\"test\":\"%s\",\"ops\":%lu,"
+	"\"iops\":%.0f,\"mb_s\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f}\n", 
+	backend, test, (unsigned long)lat.size(), lat.size() / (elapsed_us / 1e6), 
+	bytes / (elapsed_us / 1e6) / (1024 * 1024), percentile(lat, 0.5), percentile(lat, 0.99));
+    fflush(stdout);
+}
+
+static void run(const char *backend, storage_constructor_type sc, boost::intrusive_ptr<torrent_info> ti, 
+    const fs::path &dir, const std::string &file, int ops) {
+    file_pool fp;
+    boost::scoped_ptr<storage_interface> st(sc(ti, dir, fp));
+
+    std::vector<char> buf(ti->piece_length());
+    std::vector<double> lat;
+    unsigned int seed = 42;
+
+    evict(file);
+
+    long long blocks = ti->total_size() / BLOCK_SIZE;
+    int blocks_per_piece = ti->piece_length() / BLOCK_SIZE;
+    double start = now_us();
+
+    for (int i = 0; i < ops; i++) {
+	long long b = rand_r(&seed) % blocks;
+	double t = now_us();
+
+	st->read(&buf[0], (int)(b / blocks_per_piece), (int)(b % blocks_per_piece) * BLOCK_SIZE, BLOCK_SIZE);
+	lat.push_back(now_us() - t);
+    }
+
+    report(backend, "random_read", lat, now_us() - start, (long long)ops * BLOCK_SIZE);
+
+    evict(file);
+    lat.clear();
+    start = now_us();
+
+    for (int piece = 0; piece < ti->num_pieces(); piece++) {
+	partial_hash ph;
+	double t = now_us();
+
+	st->hash_for_slot(piece, ph, ti->piece_size(piece));
+	lat.push_back(now_us() - t);
+    }
+
+    report(backend, "hash_pieces", lat, now_us() - start, ti->total_size());
+}
+
+int main(int argc, char **argv) {
+    fs::path dir(argc > 1 ? argv[1] : "bench_storage.tmp");
+    long long size = (argc > 2 ? atoll(argv[2]) : 256) * 1024 * 1024;
+    int ops = argc > 3 ? atoi(argv[3]) : 20000;
+    int piece = (argc > 4 ? atoi(argv[4]) : 4096) * 1024;
+
+    fs::create_directories(dir);
+
+    std::string file = (dir / "data").string();
+    make_file(file, size);
+
+    boost::intrusive_ptr<torrent_info> ti(new torrent_info);
+    ti->set_piece_size(piece);
+    ti->add_file("data", size);
+
+    run("disk", default_storage_constructor, ti, dir, file, ops);
+    run("uring", boost::bind(&uring_storage_constructor, _1, _2, _3, 32, false), ti, dir, file, ops);
+    run("uring_direct", boost::bind(&uring_storage_constructor, _1, _2, _3, 32, true), ti, dir, file, ops);
+
+    fs::remove(dir / "data");
+
+    return 0;
+}
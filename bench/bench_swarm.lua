@@ -0,0 +1,225 @@
+#!/usr/bin/lua
+
+--
+-- usage: bench_swarm.lua [seeders] [leechers] [size_mb] [rate_limit_kb] [workdir]
+--
+-- runs a swarm of Torrent.Session seeders and leechers on 127.0.0.1,
+-- connected to each other directly (no tracker, no network), and prints
+-- one JSON object with the throughput, time to complete, CPU time per
+-- GB transferred and resident memory per peer connection
+--
+-- setting any of NETEMU_LATENCY_MS, NETEMU_JITTER_MS, NETEMU_RATE_KB or
+-- NETEMU_LOSS routes every connection through a Torrent.NetEmu link
+-- with those settings, to reproduce WAN behaviour on loopback. With
+-- SWARM_STORAGE=memory the leechers keep their data in RAM
+--
+
+require('luatorrent')
+
+local num_seeders = tonumber(arg[1]) or 1
+local num_leechers = tonumber(arg[2]) or 4
+local size_mb = tonumber(arg[3]) or 64
+local rate_limit = (tonumber(arg[4]) or 0) * 1024
+local workdir = (arg[5] or os.getenv('TMPDIR') or '/tmp') .. '/luatorrent-swarm'
+
+local base_port = 42000
+local piece_size = 256 * 1024
+local timeout = 600
+
+local clock = Torrent.Profile.clock
+
+local function resident_bytes()
+    local f = io.open('/proc/self/statm')
+    if not f then
+        return nil
+    end
+
+    local _, rss = f:read('*n', '*n')
+    f:close()
+
+    return rss * 4096
+end
+
+os.execute(string.format('rm -rf "%s" && mkdir -p "%s/seed/swarm"', workdir, workdir))
+
+-- synthetic payload, every block differs so pieces hash differently
+local payload = string.format('%s/seed/swarm/data.bin', workdir)
+local f = assert(io.open(payload, 'wb'))
+local block = string.rep('luatorrent swarm benchmark ', 2428)
+for i = 1, size_mb * 16 do
+    f:write(string.format('%08d', i), block:sub(9, 65536))
+end
+f:close()
+
+local info = Torrent.Info.New()
+info:set_piece_size(piece_size)
+info:add_file('swarm/data.bin', size_mb * 1024 * 1024)
+info:generate_hashes(workdir .. '/seed')
+info:set_creator('luatorrent bench_swarm')
+
+local torrent = workdir .. '/swarm.torrent'
+info:save_to_file(torrent)
+
+local netemu_config = {
+    latency_ms = tonumber(os.getenv('NETEMU_LATENCY_MS')),
+    jitter_ms = tonumber(os.getenv('NETEMU_JITTER_MS')),
+    rate_kb = tonumber(os.getenv('NETEMU_RATE_KB')),
+    loss = tonumber(os.getenv('NETEMU_LOSS')),
+}
+
+local emu = nil
+if next(netemu_config) then
+    emu = Torrent.NetEmu.New(netemu_config)
+end
+
+local leecher_storage = os.getenv('SWARM_STORAGE') or 'disk'
+
+local settings = {
+    allow_multiple_connections_per_ip = true,
+    ignore_limits_on_local_network = false,
+}
+
+local rss_before = resident_bytes()
+
+local peers = {}
+
+local function start_peer(n, save_path, seed)
+    local port = base_port + n
+    local session = Torrent.Session.New(port, port)
+
+    session:set_settings(settings)
+
+    if rate_limit > 0 then
+        session:set_upload_rate_limit(rate_limit)
+    end
+
+    local handle = session:add_torrent(Torrent.Info.New(torrent), save_path, { 
+        storage = seed and 'disk' or leecher_storage,
+    })
+
+    table.insert(peers, { session = session, handle = handle, port = port, seed = seed })
+end
+
+for i = 1, num_seeders do
+    start_peer(i, workdir .. '/seed', true)
+end
+
+for i = 1, num_leechers do
+    start_peer(num_seeders + i, string.format('%s/leech%d', workdir, i), false)
+end
+
+-- wait for the seeders to check their data
+local start = clock()
+for _, p in ipairs(peers) do
+    while p.seed and not p.handle:is_seed() and clock() - start < timeout do
+        p.session:wait_for_alert(50)
+    end
+end
+
+-- full mesh, every leecher dials every other peer
+for _, p in ipairs(peers) do
+    if not p.seed then
+        for _, q in ipairs(peers) do
+            if q ~= p then
+                local port = q.port
+
+                if emu then
+                    port = emu:forward(port)
+                end
+
+                p.handle:connect_peer('127.0.0.1', port)
+            end
+        end
+    end
+end
+
+local cpu_start = os.clock()
+start = clock()
+
+local finished = {}
+local num_finished = 0
+local max_connections = 0
+
+while num_finished < num_leechers and clock() - start < timeout do
+    peers[1].session:wait_for_alert(100)
+
+    local connections = 0
+
+    for i, p in ipairs(peers) do
+        local st = p.handle:status()
+
+        connections = connections + st.num_peers
+
+        if not p.seed and not finished[i] and st.progress >= 1 then
+            finished[i] = clock() - start
+            num_finished = num_finished + 1
+        end
+    end
+
+    if connections > max_connections then
+        max_connections = connections
+    end
+end
+
+local elapsed = clock() - start
+local cpu = os.clock() - cpu_start
+local rss_after = resident_bytes()
+
+local bytes = 0
+local slowest = 0
+for i, p in ipairs(peers) do
+    if not p.seed then
+        bytes = bytes + p.handle:status().total_payload_download
+    end
+
+    if finished[i] and finished[i] > slowest then
+        slowest = finished[i]
+    end
+end
+
+local result = {
+    seeders = num_seeders,
+    leechers = num_leechers,
+    size_mb = size_mb,
+    rate_limit_kb = rate_limit / 1024,
+    completed = num_finished,
+    seconds = elapsed,
+    time_to_complete = slowest,
+    mb_per_sec = bytes / 1048576 / elapsed,
+    cpu_seconds_per_gb = bytes > 0 and cpu / (bytes / 1073741824) or 0,
+    connections = max_connections,
+}
+
+if emu then
+    result.netemu_losses = emu:stats().losses
+end
+
+if rss_before and rss_after and max_connections > 0 then
+    result.memory_per_peer = (rss_after - rss_before) / max_connections
+end
+
+local keys = {}
+for k in pairs(result) do
+    table.insert(keys, k)
+end
+table.sort(keys)
+
+local parts = {}
+for _, k in ipairs(keys) do
+    table.insert(parts, string.format('"%s":%.6g', k, result[k]))
+end
+print('{' .. table.concat(parts, ',') .. '}')
+
+for _, p in ipairs(peers) do
+    p.session:remove_torrent(p.handle)
+end
+
+if emu then
+    emu:close()
+end
+
+os.execute(string.format('rm -rf "%s"', workdir))
+
+if num_finished < num_leechers then
+    os.exit(1)
+end
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_BUFFER_REF_H
+#define LUATORRENT_BUFFER_REF_H
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+/*
+ * Torrent.Buffer
+ *
+ *   a view of length bytes at offset into a reference counted block of
+ *   memory. Slicing makes another view of the same block, the block is
+ *   freed when the last view is collected.
+ */
+
+typedef boost::shared_ptr<std::vector<char> > buffer_data;
+
+struct buffer_ref {
+    buffer_data data;
+    size_t offset;
+    size_t length;
+
+    buffer_ref(buffer_data d, size_t o, size_t l) : data(d), offset(o), length(l) {}
+
+    const char *begin() const { return length ? &(*data)[offset] : 0; }
+};
+
+buffer_ref *torrent_buffer_check(lua_State *L, int index);
+void torrent_buffer_push(lua_State *L, buffer_data data, size_t offset, size_t length);
+
+/* the fd of a write target: a number, io library file or luasocket socket */
+int check_write_target(lua_State *L, int index);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/session.hpp"
+
+#include "session_ref.h"
+#include "catalogue.h"
+#include "resume.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+static boost::posix_time::ptime now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+static boost::intrusive_ptr<torrent_info> load_torrent(const std::string &path) {
+    std::ifstream in(path.c_str(), std::ios_base::binary);
+
+    if (!in)
+	throw std::runtime_error("cannot open " + path);
+
+    in.unsetf(std::ios_base::skipws);
+
+    entry e = bdecode(std::istream_iterator<char>(in), std::istream_iterator<char>());
+
+    return boost::intrusive_ptr<torrent_info>(new torrent_info(e));
+}
+
+catalogue::catalogue(session_ptr s, storage_constructor_type storage, int max_active, int idle, int level) 
+    : m_ses(s), m_storage(storage), m_max_active(max_active), m_idle(boost::posix_time::seconds(idle)), 
+      m_level(level), m_active(0), m_activations(0), m_evictions(0) {
+}
+
+/* active torrents stay in the session */
+catalogue::~catalogue() {
+    metric_add(metric_catalogue_dormant, -(long long)(m_records.size() - m_active));
+}
+
+long long catalogue::dormant_size(const record &r) const {
+    return sizeof(record) + r.torrent_file.size() + r.save_path.size() + r.resume.size();
+}
+
+sha1_hash catalogue::add(boost::intrusive_ptr<torrent_info> info, const std::string &torrent_file, 
+    const std::string &save_path, const std::string &resume_data) {
+    /* read once for the info hash, then only kept as its path */
+    sha1_hash hash = info ? info->info_hash() : load_torrent(torrent_file)->info_hash();
+
+    if (m_records.find(hash) != m_records.end())
+	throw std::runtime_error("torrent is already in the catalogue");
+
+    record &r = m_records[hash];
+
+    r.info = info;
+    r.torrent_file = torrent_file;
+    r.save_path = save_path;
+    r.resume = resume_data;
+    r.active = false;
+
+    metric_add(metric_catalogue_dormant, 1);
+
+    return hash;
+}
+
+bool catalogue::remove(const sha1_hash &hash) {
+    record_map::iterator i = m_records.find(hash);
+
+    if (i == m_records.end())
+	return false;
+
+    if (i->second.active) {
+	if (i->second.handle.is_valid())
+	    m_ses->ses.remove_torrent(i->second.handle);
+
+	m_active--;
+    } else {
+	metric_add(metric_catalogue_dormant, -1);
+    }
+
+    m_records.erase(i);
+
+    return true;
+}
+
+/* evicts the longest idle active torrent other than keep while at max_active */
+void catalogue::make_room(const sha1_hash &keep) {
+    while (m_max_active > 0 && m_active >= m_max_active) {
+	record *oldest = 0;
+
+	for (record_map::iterator i = m_records.begin(); i != m_records.end(); ++i) {
+	    if (i->second.active && i->first != keep && (!oldest || i->second.last_active < oldest->last_active))
+		oldest = &i->second;
+	}
+
+	if (!oldest)
+	    return;
+
+	deactivate(*oldest);
+    }
+}
+
+bool catalogue::activate(const sha1_hash &hash, torrent_handle &h) {
+    record_map::iterator i = m_records.find(hash);
+
+    if (i == m_records.end())
+	return false;
+
+    record &r = i->second;
+
+    if (r.active && r.handle.is_valid()) {
+	r.last_active = now();
+	h = r.handle;
+	return true;
+    }
+
+    /* removed from the session behind our back */
+    if (r.active) {
+	r.active = false;
+	m_active--;
+	metric_add(metric_catalogue_dormant, 1);
+    }
+
+    make_room(hash);
+
+    torrent_handle th = m_ses->ses.find_torrent(hash);
+
+    if (!th.is_valid()) {
+	boost::intrusive_ptr<torrent_info> info = r.info ? r.info : load_torrent(r.torrent_file);
+	entry resume;
+
+	if (!r.resume.empty())
+	    resume = resume_data_decode(r.resume.data(), r.resume.size());
+
+	th = m_ses->ses.add_torrent(info, r.save_path, resume, storage_mode_sparse, false, m_storage);
+
+	metric_add(metric_torrents_added, 1);
+    }
+
+    r.active = true;
+    r.handle = th;
+    r.last_active = now();
+
+    m_active++;
+    m_activations++;
+
+    metric_add(metric_catalogue_dormant, -1);
+    metric_add(metric_catalogue_activations, 1);
+
+    h = th;
+
+    return true;
+}
+
+/* back to a record, with the resume data the torrent has now */
+void catalogue::deactivate(record &r) {
+    if (r.handle.is_valid()) {
+	r.resume = resume_data_encode(r.handle.write_resume_data(), m_level);
+	m_ses->ses.remove_torrent(r.handle);
+    }
+
+    r.handle = torrent_handle();
+    r.active = false;
+    r.evicted = now();
+
+    m_active--;
+    m_evictions++;
+
+    metric_add(metric_catalogue_dormant, 1);
+    metric_add(metric_catalogue_evictions, 1);
+}
+
+bool catalogue::evict(const sha1_hash &hash) {
+    record_map::iterator i = m_records.find(hash);
+
+    if (i == m_records.end() || !i->second.active)
+	return false;
+
+    deactivate(i->second);
+
+    return true;
+}
+
+int catalogue::evict_idle() {
+    boost::posix_time::ptime t = now();
+    int n = 0;
+
+    for (record_map::iterator i = m_records.begin(); i != m_records.end(); ++i) {
+	record &r = i->second;
+
+	if (!r.active)
+	    continue;
+
+	if (r.handle.is_valid()) {
+	    torrent_status st = r.handle.status();
+
+	    /* a torrent with peers is in use, one being checked is left to finish */
+	    if (st.num_peers > 0 || st.state == torrent_status::queued_for_checking 
+		|| st.state == torrent_status::checking_files || st.state == torrent_status::allocating) {
+		r.last_active = t;
+		continue;
+	    }
+	}
+
+	if (t - r.last_active >= m_idle) {
+	    deactivate(r);
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+int catalogue::activate_all(const std::vector<sha1_hash> &hashes) {
+    boost::posix_time::ptime t = now();
+    int n = 0;
+
+    for (size_t i = 0; i < hashes.size(); i++) {
+	record_map::iterator r = m_records.find(hashes[i]);
+	torrent_handle h;
+
+	if (r == m_records.end() || r->second.active)
+	    continue;
+
+	/* just evicted for want of peers, asking again would not bring any */
+	if (!r->second.evicted.is_not_a_date_time() && t - r->second.evicted < m_idle)
+	    continue;
+
+	if (activate(hashes[i], h))
+	    n++;
+    }
+
+    return n;
+}
+
+catalogue::stats catalogue::get_stats() const {
+    stats s;
+
+    s.torrents = m_records.size();
+    s.active = m_active;
+    s.activations = m_activations;
+    s.evictions = m_evictions;
+    s.dormant_bytes = 0;
+
+    for (record_map::const_iterator i = m_records.begin(); i != m_records.end(); ++i) {
+	if (!i->second.active)
+	    s.dormant_bytes += dormant_size(i->second);
+    }
+
+    return s;
+}
+
+std::vector<catalogue::torrent> catalogue::list() const {
+    std::vector<torrent> out;
+    boost::posix_time::ptime t = now();
+
+    for (record_map::const_iterator i = m_records.begin(); i != m_records.end(); ++i) {
+	torrent e;
+
+	e.hash = i->first;
+	e.save_path = i->second.save_path;
+	e.active = i->second.active;
+	e.idle = e.active ? (t - i->second.last_active).total_milliseconds() / 1000.0 : 0;
+
+	out.push_back(e);
+    }
+
+    return out;
+}
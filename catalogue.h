@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_CATALOGUE_H
+#define LUATORRENT_CATALOGUE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/torrent_handle.hpp"
+#include "libtorrent/storage.hpp"
+
+struct session_state;
+
+/*
+ * catalogue
+ *
+ *   torrents registered with a session that are only added to it while
+ *   they are in use. A dormant torrent is a record of its save path, its
+ *   zlib compressed resume data and either the path of its .torrent
+ *   file or the torrent_info it was registered with, so a catalogue of
+ *   tens of thousands costs what those records cost rather than what
+ *   libtorrent spends on a torrent (storage, piece picker, peer lists).
+ *
+ *   activate() adds a torrent from its record. evict_idle() takes those
+ *   that had no peers for the idle time back out, keeping their resume
+ *   data, and activating beyond max_active evicts the longest idle.
+ *   activate_all() leaves torrents evicted less than the idle time ago
+ *   dormant, so a torrent that is wanted but gets no peers is not added
+ *   and evicted again on every update. Used from Lua only, so nothing
+ *   is locked.
+ */
+class catalogue {
+public:
+    struct stats {
+	int torrents;
+	int active;
+	long long activations;
+	long long evictions;
+	long long dormant_bytes;
+    };
+
+    struct torrent {
+	libtorrent::sha1_hash hash;
+	std::string save_path;
+	bool active;
+	double idle;  /* seconds without peers, while active */
+    };
+
+    catalogue(boost::shared_ptr<session_state> s, libtorrent::storage_constructor_type storage, int max_active, int idle, int level);
+    ~catalogue();
+
+    boost::shared_ptr<session_state> session() const { return m_ses; }
+
+    /* registers info, or the .torrent file at torrent_file when info is null */
+    libtorrent::sha1_hash add(boost::intrusive_ptr<libtorrent::torrent_info> info, const std::string &torrent_file, 
+	const std::string &save_path, const std::string &resume_data);
+    bool remove(const libtorrent::sha1_hash &hash);
+
+    /* the torrent's handle, adding it to the session if it is dormant; false if unknown */
+    bool activate(const libtorrent::sha1_hash &hash, libtorrent::torrent_handle &h);
+    bool evict(const libtorrent::sha1_hash &hash);
+
+    /* evicts the active torrents idle for long enough, returns how many */
+    int evict_idle();
+
+    /* activates those of hashes that are dormant and were not evicted within the idle time, returns how many */
+    int activate_all(const std::vector<libtorrent::sha1_hash> &hashes);
+
+    stats get_stats() const;
+    std::vector<torrent> list() const;
+
+private:
+    struct record {
+	boost::intrusive_ptr<libtorrent::torrent_info> info;
+	std::string torrent_file;
+	std::string save_path;
+	std::string resume;  /* compressed */
+
+	bool active;
+	libtorrent::torrent_handle handle;
+	boost::posix_time::ptime last_active;
+	boost::posix_time::ptime evicted;  /* not_a_date_time until it first is */
+    };
+
+    typedef std::map<libtorrent::sha1_hash, record> record_map;
+
+    void deactivate(record &r);
+    void make_room(const libtorrent::sha1_hash &keep);
+    long long dormant_size(const record &r) const;
+
+    boost::shared_ptr<session_state> m_ses;
+    libtorrent::storage_constructor_type m_storage;
+    int m_max_active;
+    boost::posix_time::time_duration m_idle;
+    int m_level;
+
+    record_map m_records;
+    int m_active;
+    long long m_activations;
+    long long m_evictions;
+};
+
+#endif
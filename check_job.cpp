@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "libtorrent/hasher.hpp"
+
+#include "check_job.h"
+#include "resume.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+/* pieces a worker claims at a time, so each reads a sequential run */
+#define CHECK_BATCH 16
+
+static boost::posix_time::ptime now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+check_job::check_job(session &ses, boost::intrusive_ptr<torrent_info> info, const std::string &save_path, 
+    storage_constructor_type storage, int threads, bool replace) 
+    : m_ses(ses), m_info(info), m_save_path(save_path), m_storage(storage), m_threads(threads), m_replace(replace), 
+      m_state(checking), m_cancel(false), m_next(0), m_checked(0), m_ok(0), m_bytes(0), 
+      m_have(info->num_pieces(), 0), m_start(now()), m_thread(0) {
+    m_thread = new boost::thread(boost::bind(&check_job::run, this));
+}
+
+check_job::~check_job() {
+    cancel();
+
+    m_thread->join();
+    delete m_thread;
+}
+
+void check_job::cancel() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_cancel = true;
+}
+
+check_job::status check_job::get_status() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    status s;
+    s.state = m_state;
+    s.pieces = m_info->num_pieces();
+    s.checked = m_checked;
+    s.ok = m_ok;
+    s.bytes = m_bytes;
+    s.seconds = ((m_state == checking || m_state == adding ? now() : m_end) - m_start).total_microseconds() / 1e6;
+    s.error = m_error;
+
+    return s;
+}
+
+bool check_job::wait(int ms) {
+    boost::mutex::scoped_lock l(m_mutex);
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(ms);
+
+    while (m_state == checking || m_state == adding) {
+	if (ms < 0)
+	    m_cond.wait(l);
+	else if (!m_cond.timed_wait(l, deadline))
+	    break;
+    }
+
+    return m_state != checking && m_state != adding;
+}
+
+bool check_job::handle(torrent_handle &h) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    if (m_state != done)
+	return false;
+
+    h = m_handle;
+
+    return true;
+}
+
+void check_job::map_files() {
+    for (int i = 0; i < m_info->num_files(); i++) {
+	std::string path = m_save_path + "/" + m_info->file_at(i).path.string();
+	mapped_file f = { -1, 0, 0 };
+
+	f.fd = ::open(path.c_str(), O_RDONLY);
+
+	if (f.fd >= 0) {
+	    struct stat st;
+
+	    if (fstat(f.fd, &st) == 0)
+		f.size = std::min((size_type)st.st_size, m_info->file_at(i).size);
+
+	    if (f.size > 0) {
+		void *p = mmap(0, (size_t)f.size, PROT_READ, MAP_SHARED, f.fd, 0);
+
+		/* too big for the address space, pread it instead */
+		if (p != MAP_FAILED) {
+		    madvise(p, (size_t)f.size, MADV_SEQUENTIAL);
+		    f.data = (const char *)p;
+		}
+	    }
+	}
+
+	m_files.push_back(f);
+    }
+}
+
+void check_job::unmap_files() {
+    for (size_t i = 0; i < m_files.size(); i++) {
+	if (m_files[i].data)
+	    munmap((void *)m_files[i].data, (size_t)m_files[i].size);
+	if (m_files[i].fd >= 0)
+	    ::close(m_files[i].fd);
+    }
+
+    m_files.clear();
+}
+
+bool check_job::next_batch(int &first, int &last) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    if (m_cancel || m_next >= m_info->num_pieces())
+	return false;
+
+    first = m_next;
+    last = std::min(m_next + CHECK_BATCH, m_info->num_pieces()) - 1;
+    m_next = last + 1;
+
+    return true;
+}
+
+bool check_job::check_piece(int piece, std::vector<char> &scratch) {
+    std::vector<file_slice> slices = m_info->map_block(piece, 0, m_info->piece_size(piece));
+    hasher h;
+
+    for (std::vector<file_slice>::const_iterator i = slices.begin(); i != slices.end(); ++i) {
+	const mapped_file &f = m_files[i->file_index];
+
+	if (i->offset + i->size > f.size)
+	    return false;
+
+	if (f.data) {
+	    h.update(f.data + i->offset, (int)i->size);
+	    continue;
+	}
+
+	size_type done = 0;
+
+	while (done < i->size) {
+	    size_t len = (size_t)std::min(i->size - done, (size_type)scratch.size());
+	    ssize_t r = pread(f.fd, &scratch[0], len, i->offset + done);
+
+	    if (r <= 0)
+		return false;
+
+	    h.update(&scratch[0], (int)r);
+	    done += r;
+	}
+    }
+
+    return h.final() == m_info->hash_for_piece(piece);
+}
+
+void check_job::work() {
+    std::vector<char> scratch(1024 * 1024);
+    int first, last;
+
+    while (next_batch(first, last)) {
+	for (int piece = first; piece <= last; piece++) {
+	    bool ok = check_piece(piece, scratch);
+
+	    boost::mutex::scoped_lock l(m_mutex);
+
+	    m_have[piece] = ok;
+	    m_checked++;
+	    m_bytes += m_info->piece_size(piece);
+
+	    if (ok)
+		m_ok++;
+	}
+    }
+}
+
+void check_job::run() {
+    boost::thread_group workers;
+
+    try {
+	if (m_replace) {
+	    torrent_handle old = m_ses.find_torrent(m_info->info_hash());
+
+	    if (old.is_valid())
+		m_ses.remove_torrent(old);
+	}
+
+	map_files();
+
+	for (int i = 0; i < m_threads; i++)
+	    workers.create_thread(boost::bind(&check_job::work, this));
+
+	workers.join_all();
+	unmap_files();
+
+	std::vector<bool> have;
+	{
+	    boost::mutex::scoped_lock l(m_mutex);
+
+	    metric_add(metric_fast_check_bytes, m_bytes);
+
+	    if (m_cancel) {
+		m_state = cancelled;
+		m_end = now();
+		m_cond.notify_all();
+		return;
+	    }
+
+	    have.assign(m_have.begin(), m_have.end());
+	    m_state = adding;
+	}
+
+	entry resume = resume_data_for_pieces(*m_info, m_save_path, have);
+	torrent_handle h = m_ses.add_torrent(m_info, m_save_path, resume, storage_mode_sparse, false, m_storage);
+
+	metric_add(metric_torrents_added, 1);
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	m_handle = h;
+	m_state = done;
+	m_end = now();
+	m_cond.notify_all();
+    } catch (std::exception &e) {
+	cancel();
+	workers.join_all();
+	unmap_files();
+
+	metric_add(metric_add_torrent_errors, 1);
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	m_error = e.what();
+	m_state = failed;
+	m_end = now();
+	m_cond.notify_all();
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_CHECK_JOB_H
+#define LUATORRENT_CHECK_JOB_H
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/torrent_handle.hpp"
+#include "libtorrent/session.hpp"
+#include "libtorrent/storage.hpp"
+
+/*
+ * check_job
+ *
+ *   checks the data of a torrent already under save_path before it is
+ *   added, hashing pieces on threads workers over read-only mappings of
+ *   its files. The pieces that match become fast resume data, and the
+ *   torrent is added with it from the job's thread, so libtorrent only
+ *   compares file sizes instead of hashing everything again on its one
+ *   checker thread.
+ *
+ *   With replace set a copy of the torrent already in the session is
+ *   removed first and re-added with the result, which is how a seed
+ *   mode torrent that failed verification gets rechecked.
+ */
+class check_job {
+public:
+    enum state_t { checking, adding, done, failed, cancelled };
+
+    struct status {
+	state_t state;
+	int pieces;
+	int checked;
+	int ok;
+	long long bytes;
+	double seconds;
+	std::string error;
+    };
+
+    check_job(libtorrent::session &ses, boost::intrusive_ptr<libtorrent::torrent_info> info, 
+	const std::string &save_path, libtorrent::storage_constructor_type storage, int threads, 
+	bool replace = false);
+    ~check_job();
+
+    status get_status();
+    const libtorrent::sha1_hash &info_hash() const { return m_info->info_hash(); }
+
+    /* waits up to ms (forever if negative) for the job to end, true if it has */
+    bool wait(int ms);
+    void cancel();
+
+    /* the added torrent, false until the job is done */
+    bool handle(libtorrent::torrent_handle &h);
+
+private:
+    struct mapped_file {
+	int fd;
+	const char *data;
+	libtorrent::size_type size;
+    };
+
+    void run();
+    void work();
+    bool next_batch(int &first, int &last);
+    bool check_piece(int piece, std::vector<char> &scratch);
+    void map_files();
+    void unmap_files();
+
+    libtorrent::session &m_ses;
+    boost::intrusive_ptr<libtorrent::torrent_info> m_info;
+    std::string m_save_path;
+    libtorrent::storage_constructor_type m_storage;
+    int m_threads;
+    bool m_replace;
+
+    /* written once before the workers start */
+    std::vector<mapped_file> m_files;
+
+    boost::mutex m_mutex;
+    boost::condition m_cond;
+    state_t m_state;
+    bool m_cancel;
+    int m_next;
+    int m_checked;
+    int m_ok;
+    long long m_bytes;
+    std::vector<char> m_have;
+    std::string m_error;
+    libtorrent::torrent_handle m_handle;
+    boost::posix_time::ptime m_start;
+    boost::posix_time::ptime m_end;
+
+    boost::thread *m_thread;
+};
+
+typedef boost::shared_ptr<check_job> check_job_ptr;
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <boost/filesystem/operations.hpp>
+
+#include "libtorrent/hasher.hpp"
+
+#include "cross_seed.h"
+
+using namespace libtorrent;
+
+static bool on_disk(const std::string &path, size_type size) {
+    struct stat st;
+
+    return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size == size;
+}
+
+/* a copy on write clone of source at target, where the filesystem can */
+static bool reflink(const std::string &source, const std::string &target) {
+#ifdef FICLONE
+    int in = ::open(source.c_str(), O_RDONLY);
+
+    if (in < 0)
+	return false;
+
+    int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+    if (out < 0) {
+	::close(in);
+	return false;
+    }
+
+    bool ok = ioctl(out, FICLONE, in) == 0;
+    int err = errno;
+
+    ::close(in);
+    ::close(out);
+
+    if (!ok) {
+	::unlink(target.c_str());
+	errno = err;
+    }
+
+    return ok;
+#else
+    errno = EOPNOTSUPP;
+    return false;
+#endif
+}
+
+/* a plain copy of source at target, removed again if anything fails */
+static bool copy_file(const std::string &source, const std::string &target) {
+    int in = ::open(source.c_str(), O_RDONLY);
+
+    if (in < 0)
+	return false;
+
+    int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+    if (out < 0) {
+	::close(in);
+	return false;
+    }
+
+    std::vector<char> buf(1024 * 1024);
+    off_t pos = 0;
+    bool ok = true;
+
+    while (ok) {
+	ssize_t r = pread(in, &buf[0], buf.size(), pos);
+
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r <= 0) {
+	    ok = r == 0;
+	    break;
+	}
+
+	for (ssize_t done = 0; ok && done < r; ) {
+	    ssize_t w = pwrite(out, &buf[done], r - done, pos + done);
+
+	    if (w < 0 && errno == EINTR)
+		continue;
+
+	    ok = w > 0;
+	    done += w;
+	}
+
+	pos += r;
+    }
+
+    int err = errno;
+
+    ::close(in);
+    ::close(out);
+
+    if (!ok) {
+	::unlink(target.c_str());
+	errno = err;
+    }
+
+    return ok;
+}
+
+/* a file of its own at target with the data of source, "reflink" or "copy" */
+static std::string clone_file(const std::string &source, const std::string &target, 
+    cross_seed_index::link_method method) {
+    if (reflink(source, target))
+	return "reflink";
+
+    if (method != cross_seed_index::link_reflink && copy_file(source, target))
+	return "copy";
+
+    return "";
+}
+
+/*
+ * puts source at target, returns how or an empty string with error set.
+ * A hardlink shares the indexed torrent's inode, and whatever the new
+ * torrent downloads into it would land in the other torrent's file, so
+ * one is only made when hardlink says the data is known to match, and
+ * link() breaks it again unless every piece of the file verifies.
+ * A target that already is the source, the indexed file itself or an
+ * earlier link, comes back "in place" and is never touched again
+ */
+static std::string link_file(const std::string &source, const std::string &target, 
+    cross_seed_index::link_method method, bool hardlink, std::string &error) {
+    struct stat s, t;
+
+    if (::stat(target.c_str(), &t) == 0) {
+	if (::stat(source.c_str(), &s) == 0 && s.st_dev == t.st_dev && s.st_ino == t.st_ino)
+	    return "in place";
+
+	error = "a different file is in the way";
+	return "";
+    }
+
+    boost::filesystem::create_directories(boost::filesystem::path(target).branch_path());
+
+    if (method != cross_seed_index::link_hardlink && reflink(source, target))
+	return "reflink";
+
+    if (method != cross_seed_index::link_reflink && hardlink && ::link(source.c_str(), target.c_str()) == 0)
+	return "hardlink";
+
+    std::string how = clone_file(source, target, method);
+
+    if (how.empty())
+	error = strerror(errno);
+
+    return how;
+}
+
+/*
+ * swaps the hardlink link() just made at target for a file of its own,
+ * removing the hardlink and setting error if that fails
+ */
+static std::string unshare_file(const std::string &source, const std::string &target, std::string &error) {
+    std::string tmp = target + ".unshare";
+    std::string how = clone_file(source, tmp, cross_seed_index::link_auto);
+
+    if (how.empty() || rename(tmp.c_str(), target.c_str()) != 0) {
+	error = strerror(errno);
+	::unlink(tmp.c_str());
+
+	/* only the name link() made, the indexed file keeps its own */
+	::unlink(target.c_str());
+	return "";
+    }
+
+    return how;
+}
+
+cross_seed_index::indexed_file cross_seed_index::describe(const torrent_info &info, int file) {
+    const file_entry &fe = info.file_at(file);
+    int length = info.piece_length();
+
+    indexed_file f;
+    f.torrent = info.info_hash();
+    f.piece_length = length;
+
+    int first = (int)((fe.offset + length - 1) / length);
+    f.phase = (size_type)first * length - fe.offset;
+
+    for (int p = first; p < info.num_pieces(); p++) {
+	if ((size_type)p * length + info.piece_size(p) > fe.offset + fe.size)
+	    break;
+
+	f.hashes.push_back(info.hash_for_piece(p));
+    }
+
+    return f;
+}
+
+bool cross_seed_index::add(const torrent_info &info, const std::string &save_path) {
+    if (!m_torrents.insert(info.info_hash()).second)
+	return false;
+
+    for (int i = 0; i < info.num_files(); i++) {
+	const file_entry &fe = info.file_at(i);
+
+	if (fe.size == 0)
+	    continue;
+
+	indexed_file f = describe(info, i);
+	f.path = save_path + "/" + fe.path.string();
+
+	m_files.insert(std::make_pair(fe.size, f));
+    }
+
+    return true;
+}
+
+bool cross_seed_index::remove(const sha1_hash &hash) {
+    if (m_torrents.erase(hash) == 0)
+	return false;
+
+    for (file_map::iterator i = m_files.begin(); i != m_files.end(); ) {
+	if (i->second.torrent == hash)
+	    m_files.erase(i++);
+	else
+	    ++i;
+    }
+
+    return true;
+}
+
+std::vector<cross_seed_index::match> cross_seed_index::find(const torrent_info &info) const {
+    std::vector<match> matches;
+
+    for (int i = 0; i < info.num_files(); i++) {
+	size_type size = info.file_at(i).size;
+
+	if (size == 0)
+	    continue;
+
+	indexed_file f = describe(info, i);
+	std::pair<file_map::const_iterator, file_map::const_iterator> range = m_files.equal_range(size);
+
+	const indexed_file *best = 0;
+	bool hashed = false;
+
+	for (file_map::const_iterator c = range.first; c != range.second; ++c) {
+	    const indexed_file &candidate = c->second;
+
+	    if (candidate.torrent == f.torrent)
+		continue;
+
+	    /* lined up the same way, the pieces tell whether it is the same data */
+	    bool comparable = candidate.piece_length == f.piece_length && candidate.phase == f.phase 
+		&& !f.hashes.empty();
+
+	    if (comparable && candidate.hashes != f.hashes)
+		continue;
+
+	    if (!on_disk(candidate.path, size))
+		continue;
+
+	    if (comparable) {
+		best = &candidate;
+		hashed = true;
+		break;
+	    }
+
+	    if (!best)
+		best = &candidate;
+	}
+
+	if (best) {
+	    match m = { i, best->path, hashed };
+	    matches.push_back(m);
+	}
+    }
+
+    return matches;
+}
+
+std::vector<cross_seed_index::link_result> cross_seed_index::link(const torrent_info &info, 
+    const std::string &save_path, link_method method, bool verify, std::vector<bool> &have) {
+    std::vector<match> matches = find(info);
+    std::vector<link_result> results;
+
+    /* the result of each linked file */
+    std::vector<int> linked(info.num_files(), -1);
+
+    have.assign(info.num_pieces(), false);
+
+    for (size_t i = 0; i < matches.size(); i++) {
+	link_result r;
+	r.file = matches[i].file;
+	r.source = matches[i].path;
+	r.hashed = matches[i].hashed;
+	r.pieces_ok = 0;
+	r.pieces_failed = 0;
+	r.method = link_file(r.source, save_path + "/" + info.file_at(r.file).path.string(), method, 
+	    verify && r.hashed, r.error);
+
+	if (!r.method.empty())
+	    linked[r.file] = results.size();
+
+	results.push_back(r);
+    }
+
+    std::map<int, int> fds;
+    std::vector<char> buf;
+
+    /* only pieces wholly within linked files can be checked */
+    for (int p = 0; verify && p < info.num_pieces(); p++) {
+	std::vector<file_slice> slices = info.map_block(p, 0, info.piece_size(p));
+	bool covered = true;
+
+	for (std::vector<file_slice>::const_iterator s = slices.begin(); s != slices.end(); ++s) {
+	    if (linked[s->file_index] < 0)
+		covered = false;
+	}
+
+	if (!covered)
+	    continue;
+
+	buf.resize(info.piece_size(p));
+
+	bool ok = true;
+	size_t pos = 0;
+
+	for (std::vector<file_slice>::const_iterator s = slices.begin(); ok && s != slices.end(); ++s) {
+	    std::map<int, int>::iterator fd = fds.find(s->file_index);
+
+	    if (fd == fds.end()) {
+		std::string path = save_path + "/" + info.file_at(s->file_index).path.string();
+		fd = fds.insert(std::make_pair(s->file_index, ::open(path.c_str(), O_RDONLY))).first;
+	    }
+
+	    ok = fd->second >= 0 && pread(fd->second, &buf[pos], s->size, s->offset) == (ssize_t)s->size;
+	    pos += s->size;
+	}
+
+	if (ok) {
+	    hasher h(&buf[0], buf.size());
+	    ok = h.final() == info.hash_for_piece(p);
+	}
+
+	have[p] = ok;
+
+	for (std::vector<file_slice>::const_iterator s = slices.begin(); s != slices.end(); ++s) {
+	    link_result &r = results[linked[s->file_index]];
+
+	    if (ok)
+		r.pieces_ok++;
+	    else
+		r.pieces_failed++;
+	}
+    }
+
+    for (std::map<int, int>::iterator i = fds.begin(); i != fds.end(); ++i) {
+	if (i->second >= 0)
+	    ::close(i->second);
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+	link_result &r = results[i];
+	std::string target = save_path + "/" + info.file_at(r.file).path.string();
+
+	if (r.method.empty())
+	    continue;
+
+	/* a file of the same size that is something else entirely */
+	if (!r.hashed && r.pieces_ok == 0 && r.pieces_failed > 0) {
+	    /* only what this call made is ours to remove */
+	    if (r.method != "in place")
+		::unlink(target.c_str());
+
+	    r.method = "";
+	    r.error = "content differs";
+	    continue;
+	}
+
+	if (r.method != "hardlink")
+	    continue;
+
+	/* a shared inode is only safe when nothing of the file is left to download */
+	const file_entry &fe = info.file_at(r.file);
+	int first = (int)(fe.offset / info.piece_length());
+	int last = (int)((fe.offset + fe.size - 1) / info.piece_length());
+
+	if (verify && r.hashed && r.pieces_ok == last - first + 1)
+	    continue;
+
+	r.method = unshare_file(r.source, target, r.error);
+    }
+
+    return results;
+}
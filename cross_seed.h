@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_CROSS_SEED_H
+#define LUATORRENT_CROSS_SEED_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include "libtorrent/torrent_info.hpp"
+
+/*
+ * cross_seed_index
+ *
+ *   the files of torrents whose data is on disk, by size. For each file
+ *   the hashes of the pieces that lie wholly inside it are kept along
+ *   with the piece length and where the first of them starts, so a file
+ *   of another torrent with the same size and piece alignment can be
+ *   matched by hash, and anything else of the same size by size only.
+ *
+ *   link() reflinks, hardlinks or copies the matches of a new torrent
+ *   into its save path and hashes just the pieces the linked files cover,
+ *   which makes up the fast resume data for adding it. A size only match
+ *   none of whose pieces verify is unlinked again. Hardlinks share the
+ *   inode with the other torrent, so one is kept only for a hash match
+ *   all of whose pieces verify; any other file gets a copy of its own.
+ */
+class cross_seed_index {
+public:
+    enum link_method { link_auto, link_hardlink, link_reflink };
+
+    struct match {
+	int file;          /* in the torrent matched */
+	std::string path;  /* of the file on disk */
+	bool hashed;       /* piece hashes agree, not just the size */
+    };
+
+    struct link_result {
+	int file;
+	std::string source;
+	std::string method;  /* "hardlink", "reflink", "copy" or "in place", empty if not linked */
+	std::string error;
+	bool hashed;
+	int pieces_ok;
+	int pieces_failed;
+    };
+
+    /* indexes info's files under save_path, false if it already was */
+    bool add(const libtorrent::torrent_info &info, const std::string &save_path);
+    bool remove(const libtorrent::sha1_hash &hash);
+
+    /* the best file on disk for each file of info that has one */
+    std::vector<match> find(const libtorrent::torrent_info &info) const;
+
+    /* links the matches of info under save_path, have is set to the pieces verified */
+    std::vector<link_result> link(const libtorrent::torrent_info &info, const std::string &save_path, 
+	link_method method, bool verify, std::vector<bool> &have);
+
+    size_t torrents() const { return m_torrents.size(); }
+    size_t files() const { return m_files.size(); }
+
+private:
+    struct indexed_file {
+	libtorrent::sha1_hash torrent;
+	std::string path;
+	int piece_length;
+	libtorrent::size_type phase;  /* offset of the first whole piece in the file */
+	std::vector<libtorrent::sha1_hash> hashes;
+    };
+
+    typedef std::multimap<libtorrent::size_type, indexed_file> file_map;
+
+    static indexed_file describe(const libtorrent::torrent_info &info, int file);
+
+    file_map m_files;
+    std::set<libtorrent::sha1_hash> m_torrents;
+};
+
+#endif
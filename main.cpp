@@ -45,6 +45,19 @@ extern "C" {
 int torrent_info_register(lua_State *L);
 int torrent_session_register(lua_State *L);
 int torrent_handle_register(lua_State *L);
+int torrent_resume_store_register(lua_State *L);
+int torrent_checkpoint_register(lua_State *L);
+int torrent_session_pool_register(lua_State *L);
+int torrent_metrics_register(lua_State *L);
+int torrent_profile_register(lua_State *L);
+int torrent_tracker_register(lua_State *L);
+int torrent_netemu_register(lua_State *L);
+int torrent_buffer_register(lua_State *L);
+int torrent_file_register(lua_State *L);
+int torrent_check_job_register(lua_State *L);
+int torrent_move_job_register(lua_State *L);
+int torrent_cross_seed_register(lua_State *L);
+int torrent_catalogue_register(lua_State *L);
 
 /*
  *
@@ -60,6 +73,19 @@ LT_EXPORT int luaopen_luatorrent(lua_State *L) {
     torrent_info_register(L);
     torrent_session_register(L);
     torrent_handle_register(L);
+    torrent_resume_store_register(L);
+    torrent_checkpoint_register(L);
+    torrent_session_pool_register(L);
+    torrent_metrics_register(L);
+    torrent_profile_register(L);
+    torrent_tracker_register(L);
+    torrent_netemu_register(L);
+    torrent_buffer_register(L);
+    torrent_file_register(L);
+    torrent_check_job_register(L);
+    torrent_move_job_register(L);
+    torrent_cross_seed_register(L);
+    torrent_catalogue_register(L);
 
     return 1;
 }
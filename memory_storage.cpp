@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/file_pool.hpp"
+
+#include "memory_storage.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+memory_storage::memory_storage(const void *owner, boost::intrusive_ptr<torrent_info const> info, 
+    storage_budget_ptr budget, bool hugepages) 
+    : registered_storage(owner, info), m_budget(budget), m_hugepages(hugepages), 
+      m_data(0), m_size(info->total_size()), m_mapped(0) {
+}
+
+memory_storage::~memory_storage() {
+    unregister();
+    free();
+}
+
+void memory_storage::allocate() {
+    if (m_data)
+	return;
+
+    size_t len = m_size > 0 ? (size_t)m_size : 1;
+
+    if (!m_budget->reserve(len))
+	throw file_error("memory storage budget exceeded");
+
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (m_hugepages) {
+	/* hugetlb mappings must be a multiple of the (2MB) huge page size */
+	size_t huge = (len + (2 << 20) - 1) & ~(size_t)((2 << 20) - 1);
+	p = mmap(0, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (p != MAP_FAILED)
+	    len = huge;
+    }
+#endif
+
+    if (p == MAP_FAILED)
+	p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+	m_budget->release(m_size > 0 ? m_size : 1);
+	throw file_error("cannot allocate memory storage");
+    }
+
+    m_data = (char *)p;
+    m_mapped = len;
+
+    metric_add(metric_memory_storage_bytes, m_mapped);
+}
+
+void memory_storage::free() {
+    if (!m_data)
+	return;
+
+    munmap(m_data, m_mapped);
+    m_budget->release(m_size > 0 ? m_size : 1);
+    metric_add(metric_memory_storage_bytes, -(long long)m_mapped);
+
+    m_data = 0;
+    m_mapped = 0;
+}
+
+char *memory_storage::slot_data(int slot, int offset, int size) {
+    allocate();
+
+    size_type start = (size_type)slot * m_info->piece_length() + offset;
+
+    if (slot < 0 || offset < 0 || size < 0 || start + size > m_size)
+	throw file_error("memory storage access out of range");
+
+    return m_data + start;
+}
+
+size_t memory_storage::copy_out(char *out, size_type offset, size_t size) const {
+    if (offset < 0 || offset >= m_size)
+	return 0;
+
+    if ((size_type)size > m_size - offset)
+	size = (size_t)(m_size - offset);
+
+    /* never written, reads as zeros like a sparse file */
+    if (!m_data)
+	memset(out, 0, size);
+    else
+	memcpy(out, m_data + offset, size);
+
+    return size;
+}
+
+bool memory_storage::initialize(bool allocate_files) {
+    allocate();
+
+    return false;
+}
+
+size_type memory_storage::read(char *buf, int slot, int offset, int size) {
+    memcpy(buf, slot_data(slot, offset, size), size);
+
+    return size;
+}
+
+void memory_storage::write(const char *buf, int slot, int offset, int size) {
+    memcpy(slot_data(slot, offset, size), buf, size);
+}
+
+bool memory_storage::move_storage(fs::path save_path) {
+    return true;
+}
+
+/* nothing survives the process, always check (and download) from scratch */
+bool memory_storage::verify_resume_data(entry &rd, std::string &error) {
+    error = "memory storage has no resume data";
+
+    return false;
+}
+
+void memory_storage::write_resume_data(entry &rd) const {
+}
+
+void memory_storage::move_slot(int src_slot, int dst_slot) {
+    int len = m_info->piece_size(src_slot);
+
+    memmove(slot_data(dst_slot, 0, len), slot_data(src_slot, 0, len), len);
+}
+
+void memory_storage::swap_slots(int slot1, int slot2) {
+    int len1 = m_info->piece_size(slot1);
+    int len2 = m_info->piece_size(slot2);
+
+    std::vector<char> tmp(len1);
+
+    memcpy(&tmp[0], slot_data(slot1, 0, len1), len1);
+    memcpy(slot_data(slot1, 0, len2), slot_data(slot2, 0, len2), len2);
+    memcpy(slot_data(slot2, 0, len1), &tmp[0], len1);
+}
+
+/* slot1 -> slot2, slot2 -> slot3, slot3 -> slot1 */
+void memory_storage::swap_slots3(int slot1, int slot2, int slot3) {
+    int len1 = m_info->piece_size(slot1);
+    int len2 = m_info->piece_size(slot2);
+    int len3 = m_info->piece_size(slot3);
+
+    std::vector<char> tmp1(len1), tmp2(len2);
+
+    memcpy(&tmp1[0], slot_data(slot1, 0, len1), len1);
+    memcpy(&tmp2[0], slot_data(slot2, 0, len2), len2);
+
+    memcpy(slot_data(slot1, 0, len3), slot_data(slot3, 0, len3), len3);
+    memcpy(slot_data(slot2, 0, len1), &tmp1[0], len1);
+    memcpy(slot_data(slot3, 0, len2), &tmp2[0], len2);
+}
+
+sha1_hash memory_storage::hash_for_slot(int slot, partial_hash &ph, int piece_size) {
+    int len = piece_size - ph.offset;
+
+    if (len > 0)
+	ph.h.update(slot_data(slot, ph.offset, len), len);
+
+    return ph.h.final();
+}
+
+void memory_storage::release_files() {
+}
+
+void memory_storage::delete_files() {
+    /* handle:memory_data() and read_range() copy out of m_data under the slot's lock */
+    boost::mutex::scoped_lock l(slot_mutex());
+
+    free();
+}
+
+storage_interface *memory_storage_constructor(boost::intrusive_ptr<torrent_info const> info, 
+    fs::path const &path, file_pool &fp, const void *owner, storage_budget_ptr budget, bool hugepages) {
+    return new memory_storage(owner, info, budget, hugepages);
+}
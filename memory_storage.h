@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_MEMORY_STORAGE_H
+#define LUATORRENT_MEMORY_STORAGE_H
+
+#include "storage.h"
+
+/*
+ * memory_storage
+ *
+ *   keeps a torrent's data in one anonymous mapping of total_size bytes
+ *   (hugepage backed when asked for and available) instead of files under
+ *   save_path. The mapping is charged to the session's budget when the
+ *   torrent is initialised, and freed when libtorrent drops the storage.
+ */
+class memory_storage : public registered_storage {
+public:
+    memory_storage(const void *owner, boost::intrusive_ptr<libtorrent::torrent_info const> info, 
+	storage_budget_ptr budget, bool hugepages);
+    ~memory_storage();
+
+    /* copies size bytes at offset into the torrent out, returns the bytes copied */
+    size_t copy_out(char *out, libtorrent::size_type offset, size_t size) const;
+    libtorrent::size_type size() const { return m_size; }
+
+    bool initialize(bool allocate_files);
+    libtorrent::size_type read(char *buf, int slot, int offset, int size);
+    void write(const char *buf, int slot, int offset, int size);
+    bool move_storage(libtorrent::fs::path save_path);
+    bool verify_resume_data(libtorrent::entry &rd, std::string &error);
+    void write_resume_data(libtorrent::entry &rd) const;
+    void move_slot(int src_slot, int dst_slot);
+    void swap_slots(int slot1, int slot2);
+    void swap_slots3(int slot1, int slot2, int slot3);
+    libtorrent::sha1_hash hash_for_slot(int slot, libtorrent::partial_hash &h, int piece_size);
+    void release_files();
+    void delete_files();
+
+private:
+    char *slot_data(int slot, int offset, int size);
+    void allocate();
+    void free();
+
+    storage_budget_ptr m_budget;
+    bool m_hugepages;
+
+    char *m_data;
+    libtorrent::size_type m_size;
+    size_t m_mapped;
+};
+
+libtorrent::storage_interface *memory_storage_constructor(
+    boost::intrusive_ptr<libtorrent::torrent_info const> info, libtorrent::fs::path const &path, 
+    libtorrent::file_pool &fp, const void *owner, storage_budget_ptr budget, bool hugepages);
+
+#endif
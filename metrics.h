@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_METRICS_H
+#define LUATORRENT_METRICS_H
+
+/*
+ * Process wide binding metrics
+ *
+ *   counters only increase, gauges go up and down, histograms count
+ *   samples (in microseconds) in power of two buckets. Every update is a
+ *   single atomic add so metrics can be updated from any thread without
+ *   a lock. Torrent.Metrics renders them, together with metrics collected
+ *   from sessions, as Prometheus text or a packed binary snapshot.
+ */
+
+enum metric_id {
+    metric_sessions,
+    metric_handles,
+    metric_torrents_added,
+    metric_torrents_removed,
+    metric_add_torrent_errors,
+    metric_resume_encoded,
+    metric_resume_encoded_bytes,
+    metric_resume_store_commits,
+    metric_resume_store_compactions,
+    metric_checkpoints,
+    metric_checkpoint_saved,
+    metric_checkpoint_errors,
+    metric_tracker_announces,
+    metric_tracker_scrapes,
+    metric_tracker_errors,
+    metric_memory_storage_bytes,
+    metric_read_cache_hits,
+    metric_read_cache_misses,
+    metric_read_cache_bytes,
+    metric_write_cache_bytes,
+    metric_write_cache_flushes,
+    metric_disk_reads,
+    metric_disk_read_bytes,
+    metric_disk_writes,
+    metric_disk_write_bytes,
+    metric_fast_check_bytes,
+    metric_seed_mode_verified,
+    metric_seed_mode_failures,
+    metric_move_bytes,
+    metric_move_errors,
+    metric_catalogue_dormant,
+    metric_catalogue_activations,
+    metric_catalogue_evictions,
+    metric_queue_pauses,
+    metric_queue_resumes,
+
+    num_metrics
+};
+
+enum histogram_id {
+    histogram_checkpoint_us,
+    histogram_resume_store_commit_us,
+
+    num_histograms
+};
+
+void metric_add(metric_id m, long long v);
+void metric_observe(histogram_id h, long long us);
+
+#endif
@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <map>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "move_job.h"
+#include "piece_cache.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+/* largest single copy, and the buffer size when copying through memory */
+#define MOVE_CHUNK (4 * 1024 * 1024)
+#define MOVE_ALIGN 4096
+
+static boost::posix_time::ptime now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+static std::string errno_message(const std::string &what, const std::string &path) {
+    return what + " " + path + ": " + strerror(errno);
+}
+
+static void write_all(int fd, const char *data, size_t len, off_t pos, const std::string &path) {
+    while (len > 0) {
+	ssize_t w = pwrite(fd, data, len, pos);
+
+	if (w < 0) {
+	    if (errno == EINTR)
+		continue;
+
+	    throw std::runtime_error(errno_message("cannot write", path));
+	}
+
+	data += w;
+	len -= w;
+	pos += w;
+    }
+}
+
+/* copies what there is of the byte range from one file to the other */
+static void copy_range(int in, int out, size_type offset, size_type size, const std::string &path) {
+    std::vector<char> buf((size_t)std::min(size, (size_type)MOVE_CHUNK));
+
+    while (size > 0) {
+	ssize_t r = pread(in, &buf[0], (size_t)std::min(size, (size_type)buf.size()), offset);
+
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r < 0)
+	    throw std::runtime_error(errno_message("cannot read", path));
+	if (r == 0)
+	    break;
+
+	write_all(out, &buf[0], r, offset, path);
+
+	offset += r;
+	size -= r;
+    }
+}
+
+void storage_move::copy_pieces(const std::set<int> &pieces) {
+    std::map<int, std::pair<int, int> > files;
+
+    try {
+	for (std::set<int>::const_iterator p = pieces.begin(); p != pieces.end(); ++p) {
+	    std::vector<file_slice> slices = info->map_block(*p, 0, info->piece_size(*p));
+
+	    for (std::vector<file_slice>::const_iterator s = slices.begin(); s != slices.end(); ++s) {
+		std::string rel = info->file_at(s->file_index).path.string();
+
+		if (files.find(s->file_index) == files.end()) {
+		    int in = ::open((from + "/" + rel).c_str(), O_RDONLY);
+
+		    /* never written to after all */
+		    if (in < 0 && errno == ENOENT)
+			continue;
+		    if (in < 0)
+			throw std::runtime_error(errno_message("cannot open", from + "/" + rel));
+
+		    boost::filesystem::create_directories(boost::filesystem::path(to + "/" + rel).branch_path());
+
+		    int out = ::open((to + "/" + rel).c_str(), O_WRONLY | O_CREAT, 0644);
+
+		    if (out < 0) {
+			::close(in);
+			throw std::runtime_error(errno_message("cannot open", to + "/" + rel));
+		    }
+
+		    files[s->file_index] = std::make_pair(in, out);
+		}
+
+		std::pair<int, int> fd = files[s->file_index];
+		copy_range(fd.first, fd.second, s->offset, s->size, to + "/" + rel);
+	    }
+	}
+
+	for (std::map<int, std::pair<int, int> >::iterator i = files.begin(); i != files.end(); ++i) {
+	    if (fdatasync(i->second.second) != 0)
+		throw std::runtime_error(std::string("cannot sync moved files: ") + strerror(errno));
+	}
+    } catch (...) {
+	for (std::map<int, std::pair<int, int> >::iterator i = files.begin(); i != files.end(); ++i) {
+	    ::close(i->second.first);
+	    ::close(i->second.second);
+	}
+
+	throw;
+    }
+
+    for (std::map<int, std::pair<int, int> >::iterator i = files.begin(); i != files.end(); ++i) {
+	::close(i->second.first);
+	::close(i->second.second);
+    }
+}
+
+void storage_move::finish(const std::string &why) {
+    boost::mutex::scoped_lock l(mutex);
+
+    if (finished)
+	return;
+
+    finished = true;
+    error = why;
+    cond.notify_all();
+}
+
+move_job::move_job(torrent_handle h, storage_slot_ptr slot, const std::string &to, long long limit) 
+    : m_handle(h), m_slot(slot), 
+      m_move(new storage_move(&h.get_torrent_info(), h.save_path().string(), to)), 
+      m_state(copying), m_cancel(false), m_total(0), m_moved(0), m_files_done(0), m_limit(limit), 
+      m_window(now()), m_window_bytes(0), m_start(now()), m_thread(0) {
+    m_thread = new boost::thread(boost::bind(&move_job::run, this));
+}
+
+move_job::~move_job() {
+    cancel();
+
+    m_thread->join();
+    delete m_thread;
+}
+
+void move_job::cancel() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_cancel = true;
+    m_cond.notify_all();
+}
+
+void move_job::set_limit(long long limit) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_limit = limit;
+    m_window = now();
+    m_window_bytes = 0;
+    m_cond.notify_all();
+}
+
+move_job::status move_job::get_status() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    status s;
+    s.state = m_state;
+    s.total = m_total;
+    s.moved = m_moved;
+    s.files = m_move->info->num_files();
+    s.files_done = m_files_done;
+    s.limit = m_limit;
+    s.seconds = ((m_state == copying || m_state == switching ? now() : m_end) - m_start).total_microseconds() / 1e6;
+    s.method = m_method;
+    s.error = m_error;
+
+    return s;
+}
+
+bool move_job::wait(int ms) {
+    boost::mutex::scoped_lock l(m_mutex);
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(ms);
+
+    while (m_state == copying || m_state == switching) {
+	if (ms < 0)
+	    m_cond.wait(l);
+	else if (!m_cond.timed_wait(l, deadline))
+	    break;
+    }
+
+    return m_state != copying && m_state != switching;
+}
+
+/*
+ * counts n more bytes copied, then sleeps off whatever is over the
+ * limit. Clones cost no I/O and are not throttled
+ */
+void move_job::copied(size_type n, const char *method, bool throttled) {
+    metric_add(metric_move_bytes, n);
+
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_moved += n;
+    m_method = method;
+
+    if (!throttled)
+	return;
+
+    m_window_bytes += n;
+
+    while (m_limit > 0 && !m_cancel) {
+	boost::posix_time::ptime due = m_window + boost::posix_time::microseconds(m_window_bytes * 1000000 / m_limit);
+
+	if (now() >= due)
+	    break;
+
+	m_cond.timed_wait(l, due);
+    }
+}
+
+/* a whole file sharing the source's extents, where the filesystem can */
+bool move_job::clone_file(int in, int out) {
+#ifdef FICLONE
+    return ioctl(out, FICLONE, in) == 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * copy_file_range() keeps the data in the kernel, false once it turns
+ * out not to work here (an old kernel, or across filesystems before
+ * Linux 5.3) with pos at where a buffer copy has to go on from
+ */
+bool move_job::kernel_copy(int in, int out, size_type &pos, size_type size) {
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    while (pos < size) {
+	{
+	    boost::mutex::scoped_lock l(m_mutex);
+
+	    if (m_cancel)
+		return true;
+	}
+
+	loff_t in_pos = pos, out_pos = pos;
+	ssize_t n = copy_file_range(in, &in_pos, out, &out_pos, (size_t)std::min(size - pos, (size_type)MOVE_CHUNK), 0);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+	    return false;
+	if (n < 0)
+	    throw std::runtime_error(std::string("copy_file_range failed: ") + strerror(errno));
+	if (n == 0)
+	    break;
+
+	pos += n;
+	copied(n, "copy_file_range", true);
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void move_job::buffer_copy(int in, int out, size_type &pos, size_type size) {
+    void *p = 0;
+
+    if (posix_memalign(&p, MOVE_ALIGN, MOVE_CHUNK) != 0)
+	throw std::bad_alloc();
+
+    char *buf = (char *)p;
+
+    try {
+	while (pos < size) {
+	    {
+		boost::mutex::scoped_lock l(m_mutex);
+
+		if (m_cancel)
+		    break;
+	    }
+
+	    ssize_t r = pread(in, buf, (size_t)std::min(size - pos, (size_type)MOVE_CHUNK), pos);
+
+	    if (r < 0 && errno == EINTR)
+		continue;
+	    if (r < 0)
+		throw std::runtime_error(std::string("cannot read while moving: ") + strerror(errno));
+	    if (r == 0)
+		break;
+
+	    write_all(out, buf, r, pos, "moved file");
+
+	    pos += r;
+	    copied(r, "buffer", true);
+	}
+    } catch (...) {
+	free(buf);
+	throw;
+    }
+
+    free(buf);
+}
+
+void move_job::copy_file(const std::string &from, const std::string &to, size_type size) {
+    boost::filesystem::create_directories(boost::filesystem::path(to).branch_path());
+
+    int in = ::open(from.c_str(), O_RDONLY);
+
+    if (in < 0)
+	throw std::runtime_error(errno_message("cannot open", from));
+
+    /* never clobber what is already there */
+    int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+    if (out < 0) {
+	::close(in);
+	throw std::runtime_error(errno_message("cannot create", to));
+    }
+
+    m_created.push_back(to);
+
+    try {
+	size_type pos = 0;
+
+	if (size > 0 && clone_file(in, out)) {
+	    copied(size, "clone", false);
+	} else {
+	    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	    if (!kernel_copy(in, out, pos, size))
+		buffer_copy(in, out, pos, size);
+	}
+
+	if (fdatasync(out) != 0)
+	    throw std::runtime_error(errno_message("cannot sync", to));
+
+	/* resume data compares modification times */
+	struct stat st;
+
+	if (fstat(in, &st) == 0) {
+	    struct timeval tv[2];
+
+	    tv[0].tv_sec = st.st_atime;
+	    tv[0].tv_usec = 0;
+	    tv[1].tv_sec = st.st_mtime;
+	    tv[1].tv_usec = 0;
+
+	    futimes(out, tv);
+	}
+    } catch (...) {
+	::close(in);
+	::close(out);
+	throw;
+    }
+
+    ::close(in);
+    ::close(out);
+}
+
+/* removes the torrent's files under root and the directories they leave empty */
+void move_job::remove_files(const std::string &root) {
+    const torrent_info &info = *m_move->info;
+
+    for (int i = 0; i < info.num_files(); i++) {
+	boost::filesystem::path rel = info.file_at(i).path;
+
+	::unlink((root + "/" + rel.string()).c_str());
+
+	for (rel = rel.branch_path(); !rel.empty(); rel = rel.branch_path())
+	    ::rmdir((root + "/" + rel.string()).c_str());
+    }
+}
+
+void move_job::detach() {
+    boost::mutex::scoped_lock l(m_slot->mutex);
+
+    cached_storage *cs = dynamic_cast<cached_storage *>(m_slot->storage);
+
+    if (cs)
+	cs->cancel_move(m_move);
+}
+
+void move_job::run() {
+    const torrent_info &info = *m_move->info;
+
+    try {
+	for (int i = 0; i < info.num_files(); i++) {
+	    std::string rel = info.file_at(i).path.string();
+	    struct stat st;
+
+	    if (::stat((m_move->to + "/" + rel).c_str(), &st) == 0)
+		throw std::runtime_error("already exists: " + m_move->to + "/" + rel);
+	}
+
+	{
+	    boost::mutex::scoped_lock l(m_slot->mutex);
+
+	    cached_storage *cs = dynamic_cast<cached_storage *>(m_slot->storage);
+
+	    if (!cs)
+		throw std::runtime_error("only disk backed torrents can be moved");
+
+	    cs->prepare_move(m_move);
+	}
+
+	/* sized only once the storage tracks writes, so none lands past what is copied untracked */
+	std::vector<size_type> sizes(info.num_files(), -1);
+	long long total = 0;
+
+	for (int i = 0; i < info.num_files(); i++) {
+	    std::string rel = info.file_at(i).path.string();
+	    struct stat st;
+
+	    /* files not downloaded to yet are made by the new storage */
+	    if (::stat((m_move->from + "/" + rel).c_str(), &st) == 0) {
+		sizes[i] = st.st_size;
+		total += st.st_size;
+	    }
+	}
+
+	{
+	    boost::mutex::scoped_lock l(m_mutex);
+	    m_total = total;
+	}
+
+	for (int i = 0; i < info.num_files(); i++) {
+	    std::string rel = info.file_at(i).path.string();
+
+	    if (sizes[i] >= 0)
+		copy_file(m_move->from + "/" + rel, m_move->to + "/" + rel, sizes[i]);
+
+	    boost::mutex::scoped_lock l(m_mutex);
+
+	    if (m_cancel)
+		break;
+
+	    m_files_done++;
+	}
+
+	{
+	    boost::mutex::scoped_lock l(m_mutex);
+
+	    if (m_cancel) {
+		l.unlock();
+
+		detach();
+
+		for (size_t i = 0; i < m_created.size(); i++)
+		    ::unlink(m_created[i].c_str());
+
+		l.lock();
+		m_state = cancelled;
+		m_end = now();
+		m_cond.notify_all();
+		return;
+	    }
+
+	    m_state = switching;
+	}
+
+	m_handle.move_storage(boost::filesystem::path(m_move->to));
+
+	{
+	    boost::mutex::scoped_lock l(m_move->mutex);
+
+	    while (!m_move->finished) {
+		boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(1);
+
+		if (!m_move->cond.timed_wait(l, deadline) && !m_handle.is_valid())
+		    throw std::runtime_error("torrent was removed");
+	    }
+
+	    if (!m_move->error.empty())
+		throw std::runtime_error(m_move->error);
+	}
+
+	remove_files(m_move->from);
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	m_state = done;
+	m_end = now();
+	m_cond.notify_all();
+    } catch (std::exception &e) {
+	detach();
+
+	for (size_t i = 0; i < m_created.size(); i++)
+	    ::unlink(m_created[i].c_str());
+
+	metric_add(metric_move_errors, 1);
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	m_error = e.what();
+	m_state = failed;
+	m_end = now();
+	m_cond.notify_all();
+    }
+}
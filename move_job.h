@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_MOVE_JOB_H
+#define LUATORRENT_MOVE_JOB_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/torrent_handle.hpp"
+
+#include "storage.h"
+
+/*
+ * storage_move
+ *
+ *   a move of a torrent's files from one save path to another that a
+ *   move_job copies ahead of libtorrent's move_storage(). The cached
+ *   storage of the torrent collects the pieces written meanwhile, and
+ *   its move_storage(to) copies those again with copy_pieces() before
+ *   it swaps in a storage at to and calls finish()
+ */
+struct storage_move {
+    boost::intrusive_ptr<libtorrent::torrent_info const> info;
+    std::string from;
+    std::string to;
+
+    boost::mutex mutex;
+    boost::condition cond;
+    bool finished;
+    std::string error;  /* empty if the storage switched to to */
+
+    storage_move(boost::intrusive_ptr<libtorrent::torrent_info const> i, const std::string &f, const std::string &t) 
+	: info(i), from(f), to(t), finished(false) {}
+
+    void copy_pieces(const std::set<int> &pieces);
+    void finish(const std::string &why);
+};
+
+typedef boost::shared_ptr<storage_move> storage_move_ptr;
+
+/*
+ * move_job
+ *
+ *   moves the files of a disk backed torrent to another save path while
+ *   it keeps seeding from the old one. Files are cloned (FICLONE) where
+ *   the filesystem shares extents, else copied in the kernel with
+ *   copy_file_range() or through a large aligned buffer, at most limit
+ *   bytes a second. Once everything is copied and synced the torrent's
+ *   storage switches over and the old files are removed.
+ */
+class move_job {
+public:
+    enum state_t { copying, switching, done, failed, cancelled };
+
+    struct status {
+	state_t state;
+	long long total;
+	long long moved;
+	int files;
+	int files_done;
+	long long limit;
+	double seconds;
+	std::string method;
+	std::string error;
+    };
+
+    move_job(libtorrent::torrent_handle h, storage_slot_ptr slot, const std::string &to, long long limit);
+    ~move_job();
+
+    status get_status();
+    const libtorrent::sha1_hash &info_hash() const { return m_move->info->info_hash(); }
+
+    /* waits up to ms (forever if negative) for the job to end, true if it has */
+    bool wait(int ms);
+
+    /* stops copying, the torrent stays where it was */
+    void cancel();
+
+    /* bytes a second, 0 for no limit */
+    void set_limit(long long limit);
+
+private:
+    void run();
+    void copy_file(const std::string &from, const std::string &to, libtorrent::size_type size);
+    bool clone_file(int in, int out);
+    bool kernel_copy(int in, int out, libtorrent::size_type &pos, libtorrent::size_type size);
+    void buffer_copy(int in, int out, libtorrent::size_type &pos, libtorrent::size_type size);
+    void copied(libtorrent::size_type n, const char *method, bool throttled);
+    void remove_files(const std::string &root);
+    void detach();
+
+    libtorrent::torrent_handle m_handle;
+    storage_slot_ptr m_slot;
+    storage_move_ptr m_move;
+
+    boost::mutex m_mutex;
+    boost::condition m_cond;
+    state_t m_state;
+    bool m_cancel;
+    long long m_total;
+    long long m_moved;
+    int m_files_done;
+    long long m_limit;
+    std::string m_method;
+    std::string m_error;
+
+    /* files this job made under the new path, removed if it fails */
+    std::vector<std::string> m_created;
+
+    /* start of the current limit's window */
+    boost::posix_time::ptime m_window;
+    long long m_window_bytes;
+
+    boost::posix_time::ptime m_start;
+    boost::posix_time::ptime m_end;
+
+    boost::thread *m_thread;
+};
+
+typedef boost::shared_ptr<move_job> move_job_ptr;
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include "netemu.h"
+
+#define NETEMU_CHUNK 16384
+#define NETEMU_MAX_QUEUE (1024 * 1024)
+
+static long long now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void epoll_set(int epfd, int op, int fd, unsigned int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    epoll_ctl(epfd, op, fd, &ev);
+}
+
+netemu::netemu(const netemu_config &defaults) : m_defaults(defaults), m_epoll(-1), m_thread(0) {
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_wake[0] = m_wake[1] = -1;
+
+    m_epoll = epoll_create(256);
+
+    if (m_epoll < 0 || pipe(m_wake) != 0) {
+	close();
+	throw std::runtime_error(std::string("cannot create network emulator: ") + strerror(errno));
+    }
+
+    epoll_set(m_epoll, EPOLL_CTL_ADD, m_wake[0], EPOLLIN);
+
+    m_thread = new boost::thread(boost::bind(&netemu::run, this));
+}
+
+netemu::~netemu() {
+    close();
+}
+
+void netemu::close() {
+    if (m_thread) {
+	char c = 0;
+	write(m_wake[1], &c, 1);
+
+	m_thread->join();
+	delete m_thread;
+	m_thread = 0;
+    }
+
+    boost::mutex::scoped_lock l(m_mutex);
+
+    while (!m_links.empty())
+	close_link(m_links.begin()->second);
+
+    for (std::map<int, listener>::iterator i = m_listeners.begin(); i != m_listeners.end(); ++i)
+	::close(i->first);
+    m_listeners.clear();
+
+    int *fds[] = { &m_epoll, &m_wake[0], &m_wake[1] };
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+	if (*fds[i] >= 0) {
+	    ::close(*fds[i]);
+	    *fds[i] = -1;
+	}
+    }
+}
+
+int netemu::forward(const std::string &host, int port, const netemu_config &cfg) {
+    listener l;
+    l.cfg = cfg;
+
+    memset(&l.target, 0, sizeof(l.target));
+    l.target.sin_family = AF_INET;
+    l.target.sin_port = htons(port);
+
+    if (inet_aton(host.c_str(), &l.target.sin_addr) == 0)
+	throw std::runtime_error("invalid forward address: " + host);
+
+    if (m_epoll < 0)
+	throw std::runtime_error("network emulator is closed");
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+	if (fd >= 0)
+	    ::close(fd);
+
+	throw std::runtime_error(std::string("cannot listen for forward: ") + strerror(errno));
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+
+    set_nonblocking(fd);
+
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    m_listeners[fd] = l;
+    m_stats.forwards++;
+
+    epoll_set(m_epoll, EPOLL_CTL_ADD, fd, EPOLLIN);
+
+    return ntohs(addr.sin_port);
+}
+
+netemu_stats netemu::stats() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_stats;
+}
+
+void netemu::accept_link(int fd, const listener &l) {
+    for (;;) {
+	int client = accept(fd, 0, 0);
+
+	if (client < 0)
+	    return;
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (server < 0) {
+	    ::close(client);
+	    return;
+	}
+
+	set_nonblocking(client);
+	set_nonblocking(server);
+
+	int one = 1;
+	setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(server, (const struct sockaddr *)&l.target, sizeof(l.target)) != 0 && errno != EINPROGRESS) {
+	    ::close(client);
+	    ::close(server);
+	    continue;
+	}
+
+	link *k = new link;
+	k->fds[0] = client;
+	k->fds[1] = server;
+	k->events[0] = EPOLLIN;
+	k->events[1] = EPOLLOUT;
+	k->connected = false;
+	k->cfg = l.cfg;
+
+	for (int s = 0; s < 2; s++) {
+	    direction &d = k->dirs[s];
+	    d.from = k->fds[s];
+	    d.to = k->fds[1 - s];
+	    d.queued = 0;
+	    d.last_release = 0;
+	    d.paced = 0;
+	    d.eof = false;
+	    d.shut = false;
+	    d.blocked = false;
+	}
+
+	m_links[client] = k;
+	m_links[server] = k;
+
+	epoll_set(m_epoll, EPOLL_CTL_ADD, client, k->events[0]);
+	epoll_set(m_epoll, EPOLL_CTL_ADD, server, k->events[1]);
+
+	m_stats.connections++;
+	m_stats.total_connections++;
+    }
+}
+
+/* queue what can be read from d.from, stamped with its release time */
+void netemu::read_dir(link *k, direction &d) {
+    char buf[NETEMU_CHUNK];
+    const netemu_config &cfg = k->cfg;
+
+    while (!d.eof && d.queued < NETEMU_MAX_QUEUE) {
+	ssize_t r = recv(d.from, buf, sizeof(buf), 0);
+
+	if (r < 0 && (errno == EAGAIN || errno == EINTR))
+	    return;
+
+	if (r <= 0) {
+	    d.eof = true;
+	    return;
+	}
+
+	long long now = now_us();
+	long long depart = std::max(now, d.paced);
+
+	if (cfg.rate > 0)
+	    depart += (long long)r * 1000000 / cfg.rate;
+
+	d.paced = depart;
+
+	long long release = depart + cfg.latency_ms * 1000LL;
+
+	if (cfg.jitter_ms > 0)
+	    release += rand() % (cfg.jitter_ms * 1000 + 1);
+
+	if (cfg.loss > 0 && rand() / (RAND_MAX + 1.0) < cfg.loss) {
+	    release += cfg.rto_ms * 1000LL;
+	    m_stats.losses++;
+	}
+
+	/* TCP delivers in order, a chunk never overtakes the one before */
+	if (release < d.last_release)
+	    release = d.last_release;
+
+	d.last_release = release;
+
+	chunk c;
+	c.release = release;
+	c.offset = 0;
+	d.queue.push_back(c);
+	d.queue.back().data.assign(buf, r);
+
+	d.queued += r;
+    }
+}
+
+/* writes the chunks that are due, false if the link failed */
+bool netemu::flush_dir(link *k, direction &d, long long now) {
+    if (!k->connected)
+	return true;
+
+    d.blocked = false;
+
+    while (!d.queue.empty() && d.queue.front().release <= now) {
+	chunk &c = d.queue.front();
+
+	ssize_t w = send(d.to, c.data.data() + c.offset, c.data.size() - c.offset, MSG_NOSIGNAL);
+
+	if (w < 0) {
+	    if (errno == EAGAIN) {
+		d.blocked = true;
+		return true;
+	    }
+
+	    if (errno == EINTR)
+		continue;
+
+	    return false;
+	}
+
+	c.offset += w;
+	m_stats.bytes += w;
+
+	if (c.offset < c.data.size())
+	    continue;
+
+	d.queued -= c.data.size();
+	d.queue.pop_front();
+    }
+
+    if (d.queue.empty() && d.eof && !d.shut) {
+	shutdown(d.to, SHUT_WR);
+	d.shut = true;
+    }
+
+    return true;
+}
+
+void netemu::update_events(link *k) {
+    for (int s = 0; s < 2; s++) {
+	unsigned int ev = 0;
+
+	const direction &in = k->dirs[s];
+	const direction &out = k->dirs[1 - s];
+
+	if (!in.eof && in.queued < NETEMU_MAX_QUEUE && (k->connected || s == 0))
+	    ev |= EPOLLIN;
+
+	if (out.blocked || (s == 1 && !k->connected))
+	    ev |= EPOLLOUT;
+
+	if (ev != k->events[s]) {
+	    epoll_set(m_epoll, EPOLL_CTL_MOD, k->fds[s], ev);
+	    k->events[s] = ev;
+	}
+    }
+}
+
+void netemu::close_link(link *k) {
+    for (int s = 0; s < 2; s++) {
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, k->fds[s], 0);
+	::close(k->fds[s]);
+	m_links.erase(k->fds[s]);
+    }
+
+    m_stats.connections--;
+
+    delete k;
+}
+
+void netemu::run() {
+    struct epoll_event events[256];
+    int timeout = 1000;
+
+    for (;;) {
+	int n = epoll_wait(m_epoll, events, 256, timeout);
+
+	if (n < 0 && errno != EINTR)
+	    break;
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	std::vector<link *> failed;
+
+	for (int i = 0; i < n; i++) {
+	    int fd = events[i].data.fd;
+
+	    if (fd == m_wake[0])
+		return;
+
+	    std::map<int, listener>::const_iterator li = m_listeners.find(fd);
+
+	    if (li != m_listeners.end()) {
+		accept_link(fd, li->second);
+		continue;
+	    }
+
+	    std::map<int, link *>::iterator ki = m_links.find(fd);
+
+	    if (ki == m_links.end())
+		continue;
+
+	    link *k = ki->second;
+	    int s = k->fds[0] == fd ? 0 : 1;
+
+	    if (s == 1 && !k->connected) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+
+		getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+		if (err != 0) {
+		    failed.push_back(k);
+		    continue;
+		}
+
+		k->connected = true;
+	    }
+
+	    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		read_dir(k, k->dirs[s]);
+	}
+
+	for (std::vector<link *>::iterator i = failed.begin(); i != failed.end(); ++i) {
+	    if (m_links.count((*i)->fds[0]))
+		close_link(*i);
+	}
+
+	/* release whatever is due and work out when the next chunk is */
+	long long now = now_us();
+	long long next = now + 1000000;
+
+	std::vector<link *> done;
+
+	for (std::map<int, link *>::iterator i = m_links.begin(); i != m_links.end(); ++i) {
+	    link *k = i->second;
+
+	    if (i->first != k->fds[0])
+		continue;
+
+	    bool ok = flush_dir(k, k->dirs[0], now) && flush_dir(k, k->dirs[1], now);
+
+	    if (!ok || (k->dirs[0].shut && k->dirs[1].shut)) {
+		done.push_back(k);
+		continue;
+	    }
+
+	    update_events(k);
+
+	    for (int s = 0; s < 2; s++) {
+		const direction &d = k->dirs[s];
+
+		if (!d.queue.empty() && !d.blocked && k->connected)
+		    next = std::min(next, d.queue.front().release);
+	    }
+	}
+
+	for (std::vector<link *>::iterator i = done.begin(); i != done.end(); ++i)
+	    close_link(*i);
+
+	timeout = (int)((next - now + 999) / 1000);
+
+	if (timeout < 0)
+	    timeout = 0;
+    }
+}
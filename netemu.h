@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_NETEMU_H
+#define LUATORRENT_NETEMU_H
+
+#include <string>
+#include <deque>
+#include <map>
+
+#include <netinet/in.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+/*
+ * netemu
+ *
+ *   A shaping TCP proxy for test swarms. Each forward() listens on a
+ *   local port and relays every accepted connection to a target port,
+ *   delaying the data in each direction by latency plus random jitter,
+ *   pacing it to a bandwidth cap, and turning a fraction of the chunks
+ *   into a retransmission stall (TCP never loses bytes, so packet loss
+ *   shows up as delay). Peers that connect to the forwarded port instead
+ *   of the target see a WAN-like link on loopback.
+ */
+
+struct netemu_config {
+    int latency_ms;
+    int jitter_ms;
+    int rate;        /* bytes per second in each direction, 0 for no cap */
+    double loss;     /* probability that a chunk needs a retransmission */
+    int rto_ms;      /* stall added for a lost chunk */
+
+    netemu_config() : latency_ms(0), jitter_ms(0), rate(0), loss(0), rto_ms(200) {}
+};
+
+struct netemu_stats {
+    int forwards;
+    int connections;
+    long long total_connections;
+    long long bytes;
+    long long losses;
+};
+
+class netemu {
+public:
+    netemu(const netemu_config &defaults);
+    ~netemu();
+
+    const netemu_config &defaults() const { return m_defaults; }
+
+    /* returns the local port that relays to host:port */
+    int forward(const std::string &host, int port, const netemu_config &cfg);
+
+    netemu_stats stats();
+    void close();
+
+private:
+    struct chunk {
+	long long release;
+	std::string data;
+	size_t offset;
+    };
+
+    struct direction {
+	int from;
+	int to;
+	std::deque<chunk> queue;
+	size_t queued;
+	long long last_release;
+	long long paced;
+	bool eof;
+	bool shut;
+	bool blocked;
+    };
+
+    struct link {
+	int fds[2];
+	unsigned int events[2];
+	bool connected;
+	netemu_config cfg;
+	direction dirs[2];
+    };
+
+    struct listener {
+	struct sockaddr_in target;
+	netemu_config cfg;
+    };
+
+    void run();
+    void accept_link(int fd, const listener &l);
+    void read_dir(link *k, direction &d);
+    bool flush_dir(link *k, direction &d, long long now);
+    void update_events(link *k);
+    void close_link(link *k);
+
+    netemu_config m_defaults;
+
+    int m_epoll;
+    int m_wake[2];
+
+    boost::mutex m_mutex;
+    std::map<int, listener> m_listeners;
+    std::map<int, link *> m_links;
+    netemu_stats m_stats;
+
+    boost::thread *m_thread;
+};
+
+#endif
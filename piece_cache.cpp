@@ -0,0 +1,689 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/file_pool.hpp"
+
+#include "piece_cache.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+/* the part of the cache pieces hit more than once may hold */
+static const double protected_share = 0.8;
+
+#define BLOCK_SIZE (16 * 1024)
+
+piece_cache::piece_cache() 
+    : m_limit(0), m_bytes(0), m_protected_bytes(0), m_hits(0), m_misses(0), m_evictions(0) {
+}
+
+piece_cache::buffer_ptr piece_cache::find(const void *owner, int piece) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<key, entry>::iterator i = m_entries.find(key(owner, piece));
+
+    if (i == m_entries.end()) {
+	m_misses++;
+	metric_add(metric_read_cache_misses, 1);
+	return buffer_ptr();
+    }
+
+    m_hits++;
+    metric_add(metric_read_cache_hits, 1);
+
+    entry &e = i->second;
+
+    if (e.is_protected) {
+	m_protected.splice(m_protected.begin(), m_protected, e.pos);
+    } else {
+	m_probation.erase(e.pos);
+	m_protected.push_front(i->first);
+	e.pos = m_protected.begin();
+	e.is_protected = true;
+	m_protected_bytes += e.data->size();
+
+	/* demote the protected list's tail back to probation */
+	while (m_protected_bytes > m_limit * protected_share && m_protected.size() > 1) {
+	    std::map<key, entry>::iterator d = m_entries.find(m_protected.back());
+
+	    m_protected.pop_back();
+	    m_protected_bytes -= d->second.data->size();
+	    m_probation.push_front(d->first);
+	    d->second.pos = m_probation.begin();
+	    d->second.is_protected = false;
+	}
+    }
+
+    return e.data;
+}
+
+void piece_cache::insert(const void *owner, int piece, buffer_ptr data) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    if ((long long)data->size() > m_limit)
+	return;
+
+    key k(owner, piece);
+    std::map<key, entry>::iterator i = m_entries.find(k);
+
+    if (i != m_entries.end())
+	unlink(i);
+
+    m_probation.push_front(k);
+
+    entry e = { data, false, m_probation.begin() };
+    m_entries[k] = e;
+    m_bytes += data->size();
+    metric_add(metric_read_cache_bytes, data->size());
+
+    evict();
+}
+
+void piece_cache::unlink(std::map<key, entry>::iterator i) {
+    entry &e = i->second;
+
+    if (e.is_protected) {
+	m_protected.erase(e.pos);
+	m_protected_bytes -= e.data->size();
+    } else {
+	m_probation.erase(e.pos);
+    }
+
+    m_bytes -= e.data->size();
+    metric_add(metric_read_cache_bytes, -(long long)e.data->size());
+    m_entries.erase(i);
+}
+
+void piece_cache::evict() {
+    while (m_bytes > m_limit) {
+	std::list<key> &victims = m_probation.empty() ? m_protected : m_probation;
+
+	unlink(m_entries.find(victims.back()));
+	m_evictions++;
+    }
+}
+
+void piece_cache::erase(const void *owner, int piece) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<key, entry>::iterator i = m_entries.find(key(owner, piece));
+
+    if (i != m_entries.end())
+	unlink(i);
+}
+
+void piece_cache::erase_all(const void *owner) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<key, entry>::iterator i = m_entries.lower_bound(key(owner, 0));
+
+    while (i != m_entries.end() && i->first.first == owner)
+	unlink(i++);
+}
+
+void piece_cache::set_limit(long long limit) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_limit = limit;
+    evict();
+}
+
+long long piece_cache::limit() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_limit;
+}
+
+piece_cache::stats piece_cache::get_stats() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    stats s = { m_hits, m_misses, m_evictions, m_bytes, m_limit, m_entries.size() };
+
+    return s;
+}
+
+bool write_cache::enabled() {
+    boost::mutex::scoped_lock l(budget.mutex);
+
+    return budget.limit > 0;
+}
+
+bool write_cache::flush_on_complete() {
+    boost::mutex::scoped_lock l(budget.mutex);
+
+    return flush_complete;
+}
+
+void write_cache::flushed() {
+    boost::mutex::scoped_lock l(budget.mutex);
+
+    flushes++;
+}
+
+void write_cache::add(cached_storage *s) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_storages.insert(s);
+}
+
+/* once this returns no other storage is evicting from s */
+void write_cache::remove(cached_storage *s) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_storages.erase(s);
+}
+
+bool write_cache::evict(cached_storage *self, long long bytes) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    for (std::set<cached_storage *>::iterator i = m_storages.begin(); i != m_storages.end(); ++i) {
+	if (*i != self && (*i)->evict_hashed() && budget.reserve(bytes))
+	    return true;
+    }
+
+    return false;
+}
+
+cached_storage::cached_storage(const void *owner, storage_constructor_type storage, fs::path const &path, 
+    file_pool &fp, boost::intrusive_ptr<torrent_info const> info, piece_cache_ptr cache, write_cache_ptr writes, 
+    boost::function<void()> seed_failed) 
+    : registered_storage(owner, info), m_constructor(storage), m_pool(fp), m_storage(storage(info, path, fp)), 
+      m_cache(cache), m_writes(writes), 
+      m_seed_failed(seed_failed), m_verified(info->num_pieces(), seed_failed.empty()), 
+      m_unverified(seed_failed.empty() ? 0 : info->num_pieces()), m_failed(false) {
+    m_writes->add(this);
+}
+
+/* the next storage may get this address, it must not see our pieces */
+cached_storage::~cached_storage() {
+    unregister();
+    m_writes->remove(this);
+
+    /* what a failed write left buffered still has to go back to the budget */
+    try {
+	flush_all();
+    } catch (std::exception &) {
+	drop_pending();
+    }
+
+    m_cache->erase_all(this);
+
+    if (m_move)
+	m_move->finish("torrent was removed");
+}
+
+bool cached_storage::complete(const pending_piece &p) const {
+    return p.blocks == (int)p.have.size();
+}
+
+/*
+ * writes the buffered blocks of slot, a complete piece in one go. A
+ * piece that fails to write stays buffered, budget and all, for the next
+ * flush or read to retry, only the destructor and delete_files drop it
+ */
+void cached_storage::flush(int slot) {
+    pending_map::iterator i = m_pending.find(slot);
+
+    if (i == m_pending.end())
+	return;
+
+    pending_piece &p = i->second;
+    int n = p.have.size();
+
+    for (int b = 0; b < n; ) {
+	if (!p.have[b]) {
+	    b++;
+	    continue;
+	}
+
+	int end = b;
+	while (end < n && p.have[end])
+	    end++;
+
+	int offset = b * BLOCK_SIZE;
+	int len = std::min(end * BLOCK_SIZE, (int)p.data.size()) - offset;
+
+	disk_write(&p.data[offset], slot, offset, len);
+	b = end;
+    }
+
+    m_writes->budget.release(p.data.size());
+    m_writes->flushed();
+    metric_add(metric_write_cache_bytes, -(long long)p.data.size());
+    metric_add(metric_write_cache_flushes, 1);
+    m_pending.erase(i);
+}
+
+void cached_storage::flush_hashed() {
+    pending_map::iterator i = m_pending.begin();
+
+    while (i != m_pending.end()) {
+	int slot = i->first;
+	bool hashed = i->second.hashed;
+
+	++i;
+
+	if (hashed)
+	    flush(slot);
+    }
+}
+
+void cached_storage::flush_all() {
+    while (!m_pending.empty())
+	flush(m_pending.begin()->first);
+}
+
+/* forgets the buffered pieces without writing them */
+void cached_storage::drop_pending() {
+    for (pending_map::iterator i = m_pending.begin(); i != m_pending.end(); ++i) {
+	m_writes->budget.release(i->second.data.size());
+	metric_add(metric_write_cache_bytes, -(long long)i->second.data.size());
+    }
+
+    m_pending.clear();
+}
+
+/*
+ * flushes the hashed pieces for another storage short of budget, true
+ * if any were. Skipped while this storage is busy, the other one holds
+ * its own lock and taking ours could deadlock
+ */
+bool cached_storage::evict_hashed() {
+    boost::mutex::scoped_try_lock l(m_mutex);
+
+    if (!l)
+	return false;
+
+    size_t before = m_pending.size();
+
+    try {
+	flush_hashed();
+    } catch (std::exception &) {
+    }
+
+    return m_pending.size() < before;
+}
+
+/* buffers a block, false if it has to be written straight through */
+bool cached_storage::buffer_write(const char *buf, int slot, int offset, int size) {
+    int len = m_info->piece_size(slot);
+
+    if (offset % BLOCK_SIZE != 0 || (size != BLOCK_SIZE && offset + size != len) || offset + size > len)
+	return false;
+
+    pending_map::iterator i = m_pending.find(slot);
+
+    if (i == m_pending.end()) {
+	/* under pressure, finished pieces go first, ours then other torrents', then everything */
+	if (!m_writes->budget.reserve(len)) {
+	    flush_hashed();
+
+	    if (!m_writes->budget.reserve(len) && !m_writes->evict(this, len)) {
+		flush_all();
+
+		if (!m_writes->budget.reserve(len))
+		    return false;
+	    }
+	}
+
+	metric_add(metric_write_cache_bytes, len);
+
+	i = m_pending.insert(std::make_pair(slot, pending_piece())).first;
+	i->second.data.resize(len);
+	i->second.have.resize((len + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	i->second.blocks = 0;
+    }
+
+    pending_piece &p = i->second;
+    int b = offset / BLOCK_SIZE;
+
+    memcpy(&p.data[offset], buf, size);
+
+    if (!p.have[b]) {
+	p.have[b] = true;
+	p.blocks++;
+    }
+
+    /* a piece failing its hash check is downloaded again */
+    p.hashed = false;
+
+    return true;
+}
+
+bool cached_storage::initialize(bool allocate_files) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_storage->initialize(allocate_files);
+}
+
+size_type cached_storage::read(char *buf, int slot, int offset, int size) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return read_cached(buf, slot, offset, size);
+}
+
+size_type cached_storage::read_cached(char *buf, int slot, int offset, int size) {
+    pending_map::iterator i = m_pending.find(slot);
+
+    if (i != m_pending.end()) {
+	if (complete(i->second) && offset + size <= (int)i->second.data.size()) {
+	    memcpy(buf, &i->second.data[offset], size);
+	    return size;
+	}
+
+	flush(slot);
+    }
+
+    bool verify = m_unverified > 0 && !m_verified[slot];
+
+    /* a cache too small for the piece would read all of it for every block */
+    if (m_cache->limit() < m_info->piece_size(slot) && !verify)
+	return disk_read(buf, slot, offset, size);
+
+    /* only verified pieces make it into the cache */
+    piece_cache::buffer_ptr piece = verify ? piece_cache::buffer_ptr() : m_cache->find(this, slot);
+
+    if (!piece) {
+	int len = m_info->piece_size(slot);
+
+	/* reads past the end of the piece are left to the storage to fail */
+	if (offset + size > len)
+	    return disk_read(buf, slot, offset, size);
+
+	piece.reset(new std::vector<char>(len));
+	disk_read(&(*piece)[0], slot, 0, len);
+
+	if (verify)
+	    verify_piece(slot, *piece);
+
+	m_cache->insert(this, slot, piece);
+    }
+
+    memcpy(buf, &(*piece)[offset], size);
+
+    return size;
+}
+
+void cached_storage::verify_piece(int slot, const std::vector<char> &data) {
+    hasher h(&data[0], data.size());
+
+    if (h.final() == m_info->hash_for_piece(slot)) {
+	m_verified[slot] = 1;
+	m_unverified--;
+	metric_add(metric_seed_mode_verified, 1);
+	return;
+    }
+
+    metric_add(metric_seed_mode_failures, 1);
+
+    if (!m_failed) {
+	m_failed = true;
+	m_seed_failed();
+    }
+
+    std::ostringstream out;
+    out << "piece " << slot << " failed seed mode verification";
+
+    throw file_error(out.str());
+}
+
+void cached_storage::dirty(int slot) {
+    if (m_move)
+	m_dirty.insert(slot);
+}
+
+void cached_storage::write(const char *buf, int slot, int offset, int size) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_cache->erase(this, slot);
+    dirty(slot);
+
+    if (m_writes->enabled() && buffer_write(buf, slot, offset, size))
+	return;
+
+    flush(slot);
+    disk_write(buf, slot, offset, size);
+}
+
+bool cached_storage::move_storage(fs::path save_path) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    flush_all();
+
+    if (m_move && save_path.string() == m_move->to)
+	return switch_storage();
+
+    /* a move elsewhere beats the one being prepared */
+    if (m_move) {
+	m_move->finish("storage was moved elsewhere");
+	m_move.reset();
+	m_dirty.clear();
+    }
+
+    return m_storage->move_storage(save_path);
+}
+
+/* the files are at m_move->to already, bar the slots written since */
+bool cached_storage::switch_storage() {
+    storage_move_ptr move = m_move;
+
+    m_move.reset();
+
+    try {
+	move->copy_pieces(m_dirty);
+	m_dirty.clear();
+
+	m_storage->release_files();
+	m_storage.reset(m_constructor(m_info, fs::path(move->to), m_pool));
+    } catch (std::exception &e) {
+	m_dirty.clear();
+	move->finish(e.what());
+	return false;
+    }
+
+    move->finish("");
+
+    return true;
+}
+
+/* buffered pieces go to the old files first, so the copy sees them */
+void cached_storage::prepare_move(storage_move_ptr move) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    flush_all();
+
+    if (m_move)
+	m_move->finish("superseded by another move");
+
+    m_move = move;
+    m_dirty.clear();
+}
+
+void cached_storage::cancel_move(storage_move_ptr move) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    if (m_move != move)
+	return;
+
+    m_move.reset();
+    m_dirty.clear();
+}
+
+bool cached_storage::verify_resume_data(entry &rd, std::string &error) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_storage->verify_resume_data(rd, error);
+}
+
+/* resume data must not claim pieces that are only in memory */
+void cached_storage::write_resume_data(entry &rd) const {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    const_cast<cached_storage *>(this)->flush_all();
+
+    m_storage->write_resume_data(rd);
+}
+
+void cached_storage::move_slot(int src_slot, int dst_slot) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    flush(src_slot);
+    flush(dst_slot);
+    dirty(dst_slot);
+    m_cache->erase(this, dst_slot);
+    m_storage->move_slot(src_slot, dst_slot);
+}
+
+void cached_storage::swap_slots(int slot1, int slot2) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    flush(slot1);
+    flush(slot2);
+    dirty(slot1);
+    dirty(slot2);
+    m_cache->erase(this, slot1);
+    m_cache->erase(this, slot2);
+    m_storage->swap_slots(slot1, slot2);
+}
+
+void cached_storage::swap_slots3(int slot1, int slot2, int slot3) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    flush(slot1);
+    flush(slot2);
+    flush(slot3);
+    dirty(slot1);
+    dirty(slot2);
+    dirty(slot3);
+    m_cache->erase(this, slot1);
+    m_cache->erase(this, slot2);
+    m_cache->erase(this, slot3);
+    m_storage->swap_slots3(slot1, slot2, slot3);
+}
+
+/* every read and write that reaches the wrapped storage is counted */
+size_type cached_storage::disk_read(char *buf, int slot, int offset, int size) {
+    size_type n = m_storage->read(buf, slot, offset, size);
+
+    metric_add(metric_disk_reads, 1);
+
+    if (n > 0)
+	metric_add(metric_disk_read_bytes, n);
+
+    return n;
+}
+
+void cached_storage::disk_write(const char *buf, int slot, int offset, int size) {
+    m_storage->write(buf, slot, offset, size);
+
+    metric_add(metric_disk_writes, 1);
+    metric_add(metric_disk_write_bytes, size);
+}
+
+/* a complete buffered piece is hashed where it is, not read back */
+sha1_hash cached_storage::hash_for_slot(int slot, partial_hash &ph, int piece_size) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    pending_map::iterator i = m_pending.find(slot);
+
+    if (i == m_pending.end())
+	return m_storage->hash_for_slot(slot, ph, piece_size);
+
+    pending_piece &p = i->second;
+
+    if (!complete(p) || piece_size > (int)p.data.size()) {
+	flush(slot);
+	return m_storage->hash_for_slot(slot, ph, piece_size);
+    }
+
+    if (piece_size > ph.offset)
+	ph.h.update(&p.data[ph.offset], piece_size - ph.offset);
+
+    p.hashed = true;
+
+    sha1_hash h = ph.h.final();
+
+    if (m_writes->flush_on_complete())
+	flush(slot);
+
+    return h;
+}
+
+void cached_storage::flush_pieces(int first, int last) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    pending_map::iterator i = m_pending.lower_bound(first);
+
+    while (i != m_pending.end() && i->first <= last) {
+	int slot = i->first;
+
+	++i;
+	flush(slot);
+    }
+}
+
+void cached_storage::verify_pieces(int first, int last) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    for (int slot = first; m_unverified > 0 && slot <= last; slot++) {
+	if (m_verified[slot])
+	    continue;
+
+	std::vector<char> piece(m_info->piece_size(slot));
+	disk_read(&piece[0], slot, 0, piece.size());
+
+	verify_piece(slot, piece);
+    }
+}
+
+void cached_storage::release_files() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    flush_all();
+    m_storage->release_files();
+}
+
+void cached_storage::delete_files() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    drop_pending();
+    m_cache->erase_all(this);
+
+    if (m_move) {
+	m_move->finish("files were deleted");
+	m_move.reset();
+	m_dirty.clear();
+    }
+
+    m_storage->delete_files();
+}
+
+storage_interface *cached_storage_constructor(boost::intrusive_ptr<torrent_info const> info, 
+    fs::path const &path, file_pool &fp, const void *owner, storage_constructor_type storage, 
+    piece_cache_ptr cache, write_cache_ptr writes, boost::function<void()> seed_failed) {
+    return new cached_storage(owner, storage, path, fp, info, cache, writes, seed_failed);
+}
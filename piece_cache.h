@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_PIECE_CACHE_H
+#define LUATORRENT_PIECE_CACHE_H
+
+#include <map>
+#include <set>
+#include <list>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "libtorrent/storage.hpp"
+
+#include "storage.h"
+#include "move_job.h"
+
+/*
+ * piece_cache
+ *
+ *   a session's cache of whole pieces read for seeding, bounded by
+ *   limit bytes (0 disables it). Eviction is a segmented LRU: pieces
+ *   enter a probation list and move to a protected list, holding up to
+ *   protected_share of the cache, when they are hit again. A sweep of
+ *   pieces read once (a peer downloading the whole torrent) then only
+ *   displaces other pieces read once, not the ones every peer wants.
+ */
+class piece_cache {
+public:
+    typedef boost::shared_ptr<std::vector<char> > buffer_ptr;
+
+    struct stats {
+	long long hits;
+	long long misses;
+	long long evictions;
+	long long bytes;
+	long long limit;
+	size_t pieces;
+    };
+
+    piece_cache();
+
+    /* the cached piece of storage owner, or an empty pointer */
+    buffer_ptr find(const void *owner, int piece);
+    void insert(const void *owner, int piece, buffer_ptr data);
+    void erase(const void *owner, int piece);
+    void erase_all(const void *owner);
+
+    void set_limit(long long limit);
+    long long limit();
+    stats get_stats();
+
+private:
+    typedef std::pair<const void *, int> key;
+
+    struct entry {
+	buffer_ptr data;
+	bool is_protected;
+	std::list<key>::iterator pos;
+    };
+
+    void unlink(std::map<key, entry>::iterator i);
+    void evict();
+
+    boost::mutex m_mutex;
+    std::map<key, entry> m_entries;
+    std::list<key> m_probation;   /* front is most recently used */
+    std::list<key> m_protected;
+
+    long long m_limit;
+    long long m_bytes;
+    long long m_protected_bytes;
+
+    long long m_hits;
+    long long m_misses;
+    long long m_evictions;
+};
+
+typedef boost::shared_ptr<piece_cache> piece_cache_ptr;
+
+/*
+ * write_cache
+ *
+ *   a session's budget for downloaded blocks held back from disk. A
+ *   budget limit of 0 disables write caching. With flush_complete, a
+ *   piece is written once it has been hashed; otherwise hashed pieces
+ *   stay buffered until the budget runs out (or the storage is released)
+ *   and are then written together in slot order.
+ *
+ *   The storages buffering in the cache are registered with it, so a
+ *   torrent that runs out of budget can flush the hashed pieces other
+ *   torrents hold rather than its own unfinished ones.
+ */
+class cached_storage;
+
+struct write_cache {
+    storage_budget budget;
+    bool flush_complete;  /* guarded by budget.mutex */
+    long long flushes;
+
+    write_cache() : flush_complete(true), flushes(0) {}
+
+    bool enabled();
+    bool flush_on_complete();
+    void flushed();
+
+    void add(cached_storage *s);
+    void remove(cached_storage *s);
+
+    /* flushes hashed pieces of storages other than self until bytes can be reserved, true if they were */
+    bool evict(cached_storage *self, long long bytes);
+
+private:
+    /* guards storages, taken under the evicting storage's lock, the others' only tried */
+    boost::mutex m_mutex;
+    std::set<cached_storage *> m_storages;
+};
+
+typedef boost::shared_ptr<write_cache> write_cache_ptr;
+
+/*
+ * cached_storage
+ *
+ *   wraps the storage libtorrent would otherwise get. A block read that
+ *   misses reads its whole piece into the read cache, so the rest of the
+ *   piece is served from memory. Downloaded blocks collect in a piece
+ *   buffer charged to the write cache, the piece is hashed from there
+ *   and reaches the wrapped storage as one write. It is the registered
+ *   storage of disk backed torrents, so besides libtorrent's disk thread
+ *   Lua readers (handle:read_piece()) call it too, under m_mutex.
+ *
+ *   In seed mode (seed_failed set) the torrent was added as complete
+ *   without a check, and each piece is verified against its hash the
+ *   first time it is read. A piece that fails is not handed out, and
+ *   seed_failed is called once so the session can recheck the torrent.
+ *
+ *   While a move_job copies the files elsewhere the slots written are
+ *   remembered, and move_storage() to the prepared path copies just
+ *   those before swapping in a storage made by the wrapped constructor
+ *   at the new path, rather than moving the files itself.
+ */
+class cached_storage : public registered_storage {
+public:
+    cached_storage(const void *owner, libtorrent::storage_constructor_type storage, 
+	libtorrent::fs::path const &path, libtorrent::file_pool &fp, 
+	boost::intrusive_ptr<libtorrent::torrent_info const> info, piece_cache_ptr cache, write_cache_ptr writes, 
+	boost::function<void()> seed_failed);
+    ~cached_storage();
+
+    bool initialize(bool allocate_files);
+    libtorrent::size_type read(char *buf, int slot, int offset, int size);
+    void write(const char *buf, int slot, int offset, int size);
+    bool move_storage(libtorrent::fs::path save_path);
+    bool verify_resume_data(libtorrent::entry &rd, std::string &error);
+    void write_resume_data(libtorrent::entry &rd) const;
+    void move_slot(int src_slot, int dst_slot);
+    void swap_slots(int slot1, int slot2);
+    void swap_slots3(int slot1, int slot2, int slot3);
+    libtorrent::sha1_hash hash_for_slot(int slot, libtorrent::partial_hash &h, int piece_size);
+    void release_files();
+    void delete_files();
+
+    /* writes out whatever of pieces first to last is still buffered */
+    void flush_pieces(int first, int last);
+
+    /* hashes the seed mode pieces first to last not verified yet, throws if one fails */
+    void verify_pieces(int first, int last);
+
+    /* starts tracking the slots move has to copy again, or stops it */
+    void prepare_move(storage_move_ptr move);
+    void cancel_move(storage_move_ptr move);
+
+private:
+    friend struct write_cache;
+
+    struct pending_piece {
+	std::vector<char> data;
+	std::vector<bool> have;  /* per 16KB block */
+	int blocks;
+	bool hashed;
+    };
+
+    typedef std::map<int, pending_piece> pending_map;
+
+    bool buffer_write(const char *buf, int slot, int offset, int size);
+    bool complete(const pending_piece &p) const;
+    void flush(int slot);
+    void flush_hashed();
+    void flush_all();
+    void drop_pending();
+    bool evict_hashed();
+
+    libtorrent::size_type read_cached(char *buf, int slot, int offset, int size);
+    libtorrent::size_type disk_read(char *buf, int slot, int offset, int size);
+    void disk_write(const char *buf, int slot, int offset, int size);
+    void verify_piece(int slot, const std::vector<char> &data);
+    void dirty(int slot);
+    bool switch_storage();
+
+    libtorrent::storage_constructor_type m_constructor;
+    libtorrent::file_pool &m_pool;
+    boost::scoped_ptr<libtorrent::storage_interface> m_storage;
+    piece_cache_ptr m_cache;
+    write_cache_ptr m_writes;
+
+    boost::function<void()> m_seed_failed;
+    std::vector<char> m_verified;
+    int m_unverified;
+    bool m_failed;
+
+    storage_move_ptr m_move;
+    std::set<int> m_dirty;
+
+    mutable boost::mutex m_mutex;
+
+    /* ordered by slot so flushing several pieces writes sequentially */
+    pending_map m_pending;
+};
+
+libtorrent::storage_interface *cached_storage_constructor(
+    boost::intrusive_ptr<libtorrent::torrent_info const> info, libtorrent::fs::path const &path, 
+    libtorrent::file_pool &fp, const void *owner, libtorrent::storage_constructor_type storage, 
+    piece_cache_ptr cache, write_cache_ptr writes, boost::function<void()> seed_failed);
+
+#endif
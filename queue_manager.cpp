@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "queue_manager.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+/* alerts kept for Lua to pop, the oldest are dropped beyond this */
+#define MAX_QUEUE_ALERTS 1000
+
+static boost::posix_time::ptime now() {
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+queue_manager::queue_manager(session &s, const settings &set) 
+    : m_ses(s), m_settings(set), m_stop(false), m_woken(true), m_thread(0) {
+    m_thread = new boost::thread(boost::bind(&queue_manager::run, this));
+}
+
+queue_manager::~queue_manager() {
+    {
+	boost::mutex::scoped_lock l(m_mutex);
+	m_stop = true;
+	m_cond.notify_all();
+    }
+
+    m_thread->join();
+    delete m_thread;
+}
+
+void queue_manager::set_priority(const sha1_hash &hash, int priority) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<sha1_hash, torrent_state>::iterator i = m_torrents.find(hash);
+
+    if (i == m_torrents.end()) {
+	i = m_torrents.insert(std::make_pair(hash, torrent_state())).first;
+	i->second.first_seen = now();
+    }
+
+    i->second.priority = priority;
+    m_woken = true;
+    m_cond.notify_all();
+}
+
+int queue_manager::priority(const sha1_hash &hash) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<sha1_hash, torrent_state>::iterator i = m_torrents.find(hash);
+
+    return i == m_torrents.end() ? 0 : i->second.priority;
+}
+
+void queue_manager::set_managed(const sha1_hash &hash, bool managed) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<sha1_hash, torrent_state>::iterator i = m_torrents.find(hash);
+
+    if (i == m_torrents.end()) {
+	i = m_torrents.insert(std::make_pair(hash, torrent_state())).first;
+	i->second.first_seen = now();
+    }
+
+    i->second.managed = managed;
+    m_woken = true;
+    m_cond.notify_all();
+}
+
+bool queue_manager::managed(const sha1_hash &hash) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::map<sha1_hash, torrent_state>::iterator i = m_torrents.find(hash);
+
+    return i == m_torrents.end() || i->second.managed;
+}
+
+void queue_manager::wake() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_woken = true;
+    m_cond.notify_all();
+}
+
+void queue_manager::pop_alerts(std::vector<queue_alert> &out) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    out.assign(m_alerts.begin(), m_alerts.end());
+    m_alerts.clear();
+}
+
+void queue_manager::run() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    while (!m_stop) {
+	if (!m_woken)
+	    m_cond.timed_wait(l, boost::get_system_time() + boost::posix_time::milliseconds(m_settings.interval));
+
+	if (m_stop)
+	    break;
+
+	m_woken = false;
+
+	l.unlock();
+
+	try {
+	    update();
+	} catch (std::exception &) {
+	}
+
+	l.lock();
+    }
+}
+
+/* higher priority first, then the lower score, then the older */
+bool queue_manager::ranking::operator()(const candidate &a, const candidate &b) const {
+    if (a.priority != b.priority)
+	return a.priority > b.priority;
+    if (a.score != b.score)
+	return a.score < b.score;
+    if (a.first_seen != b.first_seen)
+	return a.first_seen < b.first_seen;
+
+    return a.hash < b.hash;
+}
+
+double queue_manager::score(const torrent_status &st, bool seed) const {
+    switch (m_settings.rank) {
+    case rank_ratio:
+	/* seeds that gave back least first, upload counted since the torrent was added */
+	if (seed)
+	    return (double)st.total_payload_upload / std::max(st.total_wanted, (size_type)1);
+	return 0;
+
+    case rank_seed_peer: {
+	double seeds = std::max(st.num_complete, 0) + 1;
+	double peers = std::max(st.num_incomplete, 0) + 1;
+
+	/* seeds go where there are few seeds for the peers, downloads where there are many */
+	return seed ? seeds / peers : peers / seeds;
+    }
+
+    default:
+	return 0;
+    }
+}
+
+void queue_manager::update() {
+    std::vector<torrent_handle> handles = m_ses.get_torrents();
+    std::vector<candidate> downloads, seeds;
+    std::map<sha1_hash, torrent_state> current;
+    boost::posix_time::ptime t = now();
+
+    for (std::vector<torrent_handle>::iterator h = handles.begin(); h != handles.end(); ++h) {
+	torrent_status st;
+	sha1_hash hash;
+
+	/* removed since get_torrents() */
+	try {
+	    st = h->status();
+	    hash = h->info_hash();
+	} catch (std::exception &) {
+	    continue;
+	}
+
+	torrent_state ts;
+	{
+	    boost::mutex::scoped_lock l(m_mutex);
+
+	    std::map<sha1_hash, torrent_state>::iterator i = m_torrents.find(hash);
+
+	    if (i == m_torrents.end()) {
+		i = m_torrents.insert(std::make_pair(hash, torrent_state())).first;
+		i->second.first_seen = t;
+	    }
+
+	    ts = i->second;
+	}
+
+	current[hash] = ts;
+
+	if (!ts.managed)
+	    continue;
+
+	/* left to finish checking */
+	if (st.state == torrent_status::queued_for_checking || st.state == torrent_status::checking_files 
+	    || st.state == torrent_status::allocating)
+	    continue;
+
+	bool seed = st.state == torrent_status::finished || st.state == torrent_status::seeding;
+
+	candidate c;
+	c.handle = *h;
+	c.hash = hash;
+	c.paused = st.paused;
+	c.priority = ts.priority;
+	c.score = score(st, seed);
+	c.first_seen = ts.first_seen;
+
+	(seed ? seeds : downloads).push_back(c);
+    }
+
+    /* forget removed torrents, but not what was set for them meanwhile */
+    {
+	boost::mutex::scoped_lock l(m_mutex);
+
+	for (std::map<sha1_hash, torrent_state>::iterator i = m_torrents.begin(); i != m_torrents.end(); ) {
+	    if (current.find(i->first) == current.end() && i->second.first_seen < t)
+		m_torrents.erase(i++);
+	    else
+		++i;
+	}
+    }
+
+    apply(downloads, m_settings.downloads, false);
+    apply(seeds, m_settings.seeds, true);
+}
+
+/* resumes the first limit of queue (all if negative) and pauses the rest */
+void queue_manager::apply(std::vector<candidate> &queue, int limit, bool seed) {
+    std::sort(queue.begin(), queue.end(), ranking());
+
+    for (size_t i = 0; i < queue.size(); i++) {
+	candidate &c = queue[i];
+	bool active = limit < 0 || (int)i < limit;
+
+	if (active == !c.paused)
+	    continue;
+
+	try {
+	    if (active)
+		c.handle.resume();
+	    else
+		c.handle.pause();
+	} catch (std::exception &) {
+	    continue;
+	}
+
+	metric_add(active ? metric_queue_resumes : metric_queue_pauses, 1);
+
+	queue_alert a;
+	a.info_hash = c.hash;
+	a.resumed = active;
+	a.seed = seed;
+	a.position = i;
+	a.reason = active ? "ranked within the active limit" : "ranked beyond the active limit";
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	m_alerts.push_back(a);
+
+	if (m_alerts.size() > MAX_QUEUE_ALERTS)
+	    m_alerts.pop_front();
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_QUEUE_MANAGER_H
+#define LUATORRENT_QUEUE_MANAGER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+/*
+ * queue_manager
+ *
+ *   keeps at most downloads torrents downloading and seeds torrents
+ *   seeding in a session, pausing and resuming the rest from its own
+ *   thread. Each queue is ranked by priority, then by the rank setting,
+ *   then by age (the first time the manager saw the torrent). It looks
+ *   again every interval, or as soon as wake() is called, and the state
+ *   changes of torrents (a download finishing) show up then. Every 
+ *   pause and resume it makes is queued as a queue_alert.
+ *
+ *   Torrents are managed unless set_managed() says otherwise, a paused 
+ *   torrent that is not managed is left alone.
+ */
+struct queue_alert {
+    libtorrent::sha1_hash info_hash;
+    bool resumed;
+    bool seed;      /* the seed queue, else the download queue */
+    int position;   /* in its queue, 0 first */
+    std::string reason;
+};
+
+class queue_manager {
+public:
+    enum rank_t { rank_ratio, rank_seed_peer, rank_age, rank_priority };
+
+    struct settings {
+	int downloads;
+	int seeds;
+	rank_t rank;
+	int interval;  /* ms */
+
+	settings() : downloads(3), seeds(5), rank(rank_ratio), interval(1000) {}
+    };
+
+    queue_manager(libtorrent::session &s, const settings &set);
+    ~queue_manager();
+
+    void set_priority(const libtorrent::sha1_hash &hash, int priority);
+    int priority(const libtorrent::sha1_hash &hash);
+    void set_managed(const libtorrent::sha1_hash &hash, bool managed);
+    bool managed(const libtorrent::sha1_hash &hash);
+
+    /* reconsider the queues now rather than at the next interval */
+    void wake();
+
+    /* moves the alerts queued since the last call to out */
+    void pop_alerts(std::vector<queue_alert> &out);
+
+private:
+    struct torrent_state {
+	int priority;
+	bool managed;
+	boost::posix_time::ptime first_seen;
+
+	torrent_state() : priority(0), managed(true) {}
+    };
+
+    struct candidate {
+	libtorrent::torrent_handle handle;
+	libtorrent::sha1_hash hash;
+	bool paused;
+	int priority;
+	double score;  /* lower first */
+	boost::posix_time::ptime first_seen;
+    };
+
+    struct ranking {
+	bool operator()(const candidate &a, const candidate &b) const;
+    };
+
+    void run();
+    void update();
+    void apply(std::vector<candidate> &queue, int limit, bool seed);
+    double score(const libtorrent::torrent_status &st, bool seed) const;
+
+    libtorrent::session &m_ses;
+    settings m_settings;
+
+    boost::mutex m_mutex;
+    boost::condition m_cond;
+    bool m_stop;
+    bool m_woken;
+
+    std::map<libtorrent::sha1_hash, torrent_state> m_torrents;
+    std::deque<queue_alert> m_alerts;
+
+    boost::thread *m_thread;
+};
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+#include <cctype>
+
+#include <zlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/bencode.hpp"
+
+#include "resume.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+std::string info_hash_to_hex(const sha1_hash &hash) {
+    std::ostringstream out;
+
+    out << std::hex;
+    for (sha1_hash::const_iterator i = hash.begin(); i != hash.end(); ++i) {
+	out << std::setw(2) << std::setfill('0') << (int)*i;
+    }
+
+    return out.str();
+}
+
+bool info_hash_from_hex(const char *hex, sha1_hash &hash) {
+    std::string raw;
+
+    for (int i = 0; i < 20; i++) {
+	int hi = hex[i * 2];
+	int lo = hi ? hex[i * 2 + 1] : 0;
+
+	if (!isxdigit(hi) || !isxdigit(lo))
+	    return false;
+
+	hi = isdigit(hi) ? hi - '0' : tolower(hi) - 'a' + 10;
+	lo = isdigit(lo) ? lo - '0' : tolower(lo) - 'a' + 10;
+
+	raw += (char)((hi << 4) | lo);
+    }
+
+    if (hex[40] != '\0')
+	return false;
+
+    hash = sha1_hash(raw);
+
+    return true;
+}
+
+std::string resume_data_encode(const entry &e, int level) {
+    std::string out;
+
+    libtorrent::bencode(std::back_inserter(out), e);
+
+    metric_add(metric_resume_encoded, 1);
+
+    if (level <= 0) {
+	metric_add(metric_resume_encoded_bytes, out.size());
+	return out;
+    }
+
+    if (level > 9)
+	level = 9;
+
+    uLongf len = compressBound(out.size());
+    std::string z(len, '\0');
+
+    if (compress2((Bytef *)&z[0], &len, (const Bytef *)out.data(), out.size(), level) != Z_OK)
+	throw std::runtime_error("failed to compress resume data");
+
+    z.resize(len);
+
+    metric_add(metric_resume_encoded_bytes, z.size());
+
+    return z;
+}
+
+entry resume_data_decode(const char *data, size_t len) {
+    if (len == 0)
+	return entry();
+
+    if (data[0] == 'd')
+	return bdecode(data, data + len);
+
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+
+    if (inflateInit(&zs) != Z_OK)
+	throw std::runtime_error("failed to initialise zlib");
+
+    std::string out;
+    char buf[16 * 1024];
+    int ret;
+
+    do {
+	zs.next_out = (Bytef *)buf;
+	zs.avail_out = sizeof(buf);
+
+	ret = inflate(&zs, Z_NO_FLUSH);
+
+	if (ret != Z_OK && ret != Z_STREAM_END) {
+	    inflateEnd(&zs);
+	    throw std::runtime_error("corrupt compressed resume data");
+	}
+
+	out.append(buf, sizeof(buf) - zs.avail_out);
+    } while (ret != Z_STREAM_END);
+
+    inflateEnd(&zs);
+
+    return bdecode(out.begin(), out.end());
+}
+
+entry resume_data_load_file(const char *filename) {
+    std::ifstream in(filename, std::ios_base::binary);
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    return resume_data_decode(data.data(), data.size());
+}
+
+/* slots entry for a piece that has no data, libtorrent's unassigned */
+#define SLOT_UNASSIGNED -2
+
+entry resume_data_for_pieces(const torrent_info &info, const std::string &save_path, const std::vector<bool> &have) {
+    entry rd(entry::dictionary_t);
+
+    rd["file-format"] = entry(std::string("libtorrent resume file"));
+    rd["file-version"] = entry((entry::integer_type)1);
+    rd["allocation"] = entry(std::string("sparse"));
+
+    const sha1_hash &hash = info.info_hash();
+    rd["info-hash"] = entry(std::string(hash.begin(), hash.end()));
+
+    rd["blocks per piece"] = entry((entry::integer_type)(info.piece_length() / (16 * 1024)));
+    rd["unfinished"] = entry::list_type();
+    rd["peers"] = entry::list_type();
+
+    entry::list_type &slots = rd["slots"].list();
+
+    for (int i = 0; i < info.num_pieces(); i++)
+	slots.push_back(entry((entry::integer_type)(have[i] ? i : SLOT_UNASSIGNED)));
+
+    entry::list_type &sizes = rd["file sizes"].list();
+
+    for (int i = 0; i < info.num_files(); i++) {
+	std::string path = save_path + "/" + info.file_at(i).path.string();
+	struct stat st;
+	entry::list_type e;
+
+	if (::stat(path.c_str(), &st) == 0) {
+	    e.push_back(entry((entry::integer_type)st.st_size));
+	    e.push_back(entry((entry::integer_type)st.st_mtime));
+	} else {
+	    e.push_back(entry((entry::integer_type)0));
+	    e.push_back(entry((entry::integer_type)0));
+	}
+
+	sizes.push_back(entry(e));
+    }
+
+    return rd;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_RESUME_H
+#define LUATORRENT_RESUME_H
+
+#include <string>
+#include <vector>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/torrent_info.hpp"
+
+/*
+ * Resume data helpers
+ *
+ * resume_data_encode bencodes e into a string, deflating it with zlib
+ * when level is between 1 and 9 (0 leaves it as plain bencode).
+ *
+ * resume_data_decode accepts either form; plain bencoded resume data
+ * always starts with 'd', anything else is treated as a zlib stream.
+ *
+ * info_hash_to_hex / info_hash_from_hex convert between info hashes and
+ * the 40 character hex strings used to name torrents on the Lua side.
+ *
+ * resume_data_for_pieces builds the fast resume data libtorrent would
+ * have written for info saved under save_path with the pieces in have,
+ * so a torrent checked outside libtorrent is added without a recheck.
+ */
+
+std::string info_hash_to_hex(const libtorrent::sha1_hash &hash);
+bool info_hash_from_hex(const char *hex, libtorrent::sha1_hash &hash);
+
+std::string resume_data_encode(const libtorrent::entry &e, int level);
+libtorrent::entry resume_data_decode(const char *data, size_t len);
+libtorrent::entry resume_data_load_file(const char *filename);
+libtorrent::entry resume_data_for_pieces(const libtorrent::torrent_info &info, const std::string &save_path, 
+    const std::vector<bool> &have);
+
+#endif
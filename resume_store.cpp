@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/crc.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "resume_store.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+/*
+ * on disk format
+ *
+ *   file header: "LTRJ" followed by a 4 byte version
+ *   record: "LTRR", 4 byte payload length, 4 byte crc32 of the
+ *           info hash and payload, 20 byte info hash, payload
+ *
+ *   a record with an empty payload removes the torrent
+ */
+static const char file_magic[8] = { 'L', 'T', 'R', 'J', 1, 0, 0, 0 };
+static const char record_magic[4] = { 'L', 'T', 'R', 'R' };
+static const size_t record_header_size = 4 + 4 + 4 + 20;
+
+static void put_u32(char *p, unsigned int v) {
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    p[2] = (char)((v >> 16) & 0xff);
+    p[3] = (char)((v >> 24) & 0xff);
+}
+
+static unsigned int get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+static unsigned int record_crc(const char *hash, const char *data, size_t len) {
+    boost::crc_32_type crc;
+
+    crc.process_bytes(hash, 20);
+    crc.process_bytes(data, len);
+
+    return crc.checksum();
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+	ssize_t w = ::write(fd, data, len);
+
+	if (w < 0) {
+	    if (errno == EINTR)
+		continue;
+
+	    throw std::runtime_error(std::string("resume store write failed: ") + strerror(errno));
+	}
+
+	data += w;
+	len -= w;
+    }
+}
+
+/* make a rename() durable by syncing the directory it happened in */
+static void sync_parent_dir(const std::string &path) {
+    std::string::size_type slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+
+    int fd = ::open(dir.c_str(), O_RDONLY);
+
+    if (fd >= 0) {
+	fsync(fd);
+	::close(fd);
+    }
+}
+
+resume_store::resume_store(const std::string &path) 
+    : m_path(path), m_fd(-1), m_map(0), m_map_size(0), m_file_size(0), m_live_bytes(0) {
+    open();
+}
+
+resume_store::~resume_store() {
+    try {
+	close_file();
+    } catch (std::exception &) {
+    }
+}
+
+void resume_store::open() {
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+
+    if (m_fd < 0)
+	throw std::runtime_error(std::string("cannot open resume store: ") + strerror(errno));
+
+    struct stat st;
+    fstat(m_fd, &st);
+
+    if (st.st_size < (off_t)sizeof(file_magic)) {
+	ftruncate(m_fd, 0);
+	write_all(m_fd, file_magic, sizeof(file_magic));
+	fsync(m_fd);
+
+	m_file_size = sizeof(file_magic);
+	return;
+    }
+
+    m_map_size = st.st_size;
+    m_map = (char *)mmap(0, m_map_size, PROT_READ, MAP_SHARED, m_fd, 0);
+
+    if (m_map == MAP_FAILED) {
+	m_map = 0;
+	::close(m_fd);
+	m_fd = -1;
+	throw std::runtime_error(std::string("cannot map resume store: ") + strerror(errno));
+    }
+
+    if (memcmp(m_map, file_magic, sizeof(file_magic)) != 0) {
+	unmap();
+	::close(m_fd);
+	m_fd = -1;
+	throw std::runtime_error("not a resume store: " + m_path);
+    }
+
+    size_t offset = sizeof(file_magic);
+
+    while (offset + record_header_size <= m_map_size) {
+	const char *p = m_map + offset;
+
+	if (memcmp(p, record_magic, 4) != 0)
+	    break;
+
+	size_t len = get_u32(p + 4);
+
+	if (offset + record_header_size + len > m_map_size)
+	    break;
+
+	if (record_crc(p + 12, p + record_header_size, len) != get_u32(p + 8))
+	    break;
+
+	sha1_hash hash(std::string(p + 12, 20));
+
+	std::map<sha1_hash, record>::iterator i = m_index.find(hash);
+	if (i != m_index.end()) {
+	    m_live_bytes -= i->second.len;
+	    m_index.erase(i);
+	}
+
+	if (len > 0) {
+	    record r = { offset + record_header_size, len };
+	    m_index[hash] = r;
+	    m_live_bytes += len;
+	}
+
+	offset += record_header_size + len;
+    }
+
+    /* drop a partially written batch left behind by a crash */
+    if (offset < m_map_size && (ftruncate(m_fd, offset) != 0 || fsync(m_fd) != 0)) {
+	std::string error = strerror(errno);
+
+	unmap();
+	::close(m_fd);
+	m_fd = -1;
+	throw std::runtime_error("cannot truncate resume store: " + error);
+    }
+
+    m_file_size = offset;
+    lseek(m_fd, m_file_size, SEEK_SET);
+}
+
+void resume_store::unmap() {
+    if (m_map) {
+	munmap(m_map, m_map_size);
+	m_map = 0;
+	m_map_size = 0;
+    }
+}
+
+void resume_store::append(const sha1_hash &hash, const char *data, size_t len) {
+    char header[record_header_size];
+    std::string h(hash.begin(), hash.end());
+
+    memcpy(header, record_magic, 4);
+    put_u32(header + 4, len);
+    put_u32(header + 8, record_crc(h.data(), data, len));
+    memcpy(header + 12, h.data(), 20);
+
+    m_pending.append(header, record_header_size);
+    m_pending.append(data, len);
+}
+
+void resume_store::put(const sha1_hash &hash, const std::string &data) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    if (m_fd < 0)
+	throw std::runtime_error("resume store is closed");
+
+    if (data.empty()) {
+	remove_record(hash);
+	return;
+    }
+
+    size_t offset = m_file_size + m_pending.size() + record_header_size;
+
+    append(hash, data.data(), data.size());
+
+    std::map<sha1_hash, record>::iterator i = m_index.find(hash);
+    if (i != m_index.end())
+	m_live_bytes -= i->second.len;
+
+    record r = { offset, data.size() };
+    m_index[hash] = r;
+    m_live_bytes += data.size();
+}
+
+bool resume_store::get(const sha1_hash &hash, std::string &data) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return read(hash, data);
+}
+
+bool resume_store::read(const sha1_hash &hash, std::string &data) {
+    std::map<sha1_hash, record>::const_iterator i = m_index.find(hash);
+
+    if (i == m_index.end())
+	return false;
+
+    const record &r = i->second;
+
+    /* the map may still cover a torn tail open() cut off, and pending records reuse its offsets */
+    if (r.offset >= m_file_size) {
+	data.assign(m_pending, r.offset - m_file_size, r.len);
+    } else if (r.offset + r.len <= std::min(m_map_size, m_file_size)) {
+	data.assign(m_map + r.offset, r.len);
+    } else {
+	data.resize(r.len);
+
+	if (pread(m_fd, &data[0], r.len, r.offset) != (ssize_t)r.len)
+	    throw std::runtime_error(std::string("resume store read failed: ") + strerror(errno));
+    }
+
+    return true;
+}
+
+void resume_store::remove(const sha1_hash &hash) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    remove_record(hash);
+}
+
+void resume_store::remove_record(const sha1_hash &hash) {
+    std::map<sha1_hash, record>::iterator i = m_index.find(hash);
+
+    if (i == m_index.end())
+	return;
+
+    m_live_bytes -= i->second.len;
+    m_index.erase(i);
+
+    append(hash, "", 0);
+}
+
+void resume_store::commit() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    commit_pending();
+}
+
+void resume_store::commit_pending() {
+    if (m_fd < 0 || m_pending.empty())
+	return;
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    /* a torn batch is cut off again, so the pending records can be retried */
+    try {
+	write_all(m_fd, m_pending.data(), m_pending.size());
+
+	if (fdatasync(m_fd) != 0)
+	    throw std::runtime_error(std::string("resume store sync failed: ") + strerror(errno));
+    } catch (std::exception&) {
+	if (ftruncate(m_fd, m_file_size) == 0)
+	    lseek(m_fd, m_file_size, SEEK_SET);
+
+	throw;
+    }
+
+    m_file_size += m_pending.size();
+    m_pending.clear();
+
+    boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+
+    metric_add(metric_resume_store_commits, 1);
+    metric_observe(histogram_resume_store_commit_us, elapsed.total_microseconds());
+
+    if (m_file_size > 1024 * 1024 && m_live_bytes < m_file_size / 2)
+	compact_file();
+}
+
+void resume_store::compact() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    compact_file();
+}
+
+void resume_store::compact_file() {
+    if (m_fd < 0)
+	return;
+
+    std::string tmp_path = m_path + ".compact";
+
+    int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+	throw std::runtime_error(std::string("cannot create compacted resume store: ") + strerror(errno));
+
+    try {
+	std::string buf(file_magic, sizeof(file_magic));
+	std::string data;
+
+	for (std::map<sha1_hash, record>::const_iterator i = m_index.begin(); i != m_index.end(); ++i) {
+	    read(i->first, data);
+
+	    std::string h(i->first.begin(), i->first.end());
+	    char header[record_header_size];
+
+	    memcpy(header, record_magic, 4);
+	    put_u32(header + 4, data.size());
+	    put_u32(header + 8, record_crc(h.data(), data.data(), data.size()));
+	    memcpy(header + 12, h.data(), 20);
+
+	    buf.append(header, record_header_size);
+	    buf.append(data);
+
+	    if (buf.size() >= 1024 * 1024) {
+		write_all(fd, buf.data(), buf.size());
+		buf.clear();
+	    }
+	}
+
+	write_all(fd, buf.data(), buf.size());
+
+	if (fsync(fd) != 0)
+	    throw std::runtime_error(std::string("resume store fsync failed: ") + strerror(errno));
+    } catch (...) {
+	::close(fd);
+	unlink(tmp_path.c_str());
+	throw;
+    }
+
+    ::close(fd);
+
+    if (rename(tmp_path.c_str(), m_path.c_str()) != 0)
+	throw std::runtime_error(std::string("cannot replace resume store: ") + strerror(errno));
+
+    sync_parent_dir(m_path);
+
+    /* pending records were included above, the old log is obsolete */
+    m_pending.clear();
+    unmap();
+    ::close(m_fd);
+    m_index.clear();
+    m_live_bytes = 0;
+
+    open();
+
+    metric_add(metric_resume_store_compactions, 1);
+}
+
+void resume_store::close() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    close_file();
+}
+
+void resume_store::close_file() {
+    if (m_fd < 0)
+	return;
+
+    commit_pending();
+    unmap();
+    ::close(m_fd);
+    m_fd = -1;
+    m_index.clear();
+    m_live_bytes = 0;
+}
+
+size_t resume_store::count() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_index.size();
+}
+
+size_t resume_store::live_bytes() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_live_bytes;
+}
+
+size_t resume_store::file_bytes() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    return m_file_size + m_pending.size();
+}
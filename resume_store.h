@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_RESUME_STORE_H
+#define LUATORRENT_RESUME_STORE_H
+
+#include <string>
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/torrent_info.hpp"
+
+/*
+ * resume_store
+ *
+ *   a single append-only log of resume data records keyed by info hash.
+ *   Records are buffered by put() and written and fsynced as one batch
+ *   by commit(). On open the log is mmapped and scanned once to build
+ *   the index of the latest record for each torrent, a torn record at
+ *   the tail (from a crash mid-write) is truncated away.
+ *
+ *   Superseded records are reclaimed by compact(), which rewrites the
+ *   live records to a new file and renames it over the old one. commit()
+ *   compacts automatically once more than half the log is garbage.
+ *
+ *   All public methods are serialised by an internal mutex so a store
+ *   can be written from a background checkpoint while Lua reads it.
+ */
+class resume_store {
+public:
+    resume_store(const std::string &path);
+    ~resume_store();
+
+    void put(const libtorrent::sha1_hash &hash, const std::string &data);
+    bool get(const libtorrent::sha1_hash &hash, std::string &data);
+    void remove(const libtorrent::sha1_hash &hash);
+
+    void commit();
+    void compact();
+    void close();
+
+    size_t count();
+    size_t live_bytes();
+    size_t file_bytes();
+
+private:
+    struct record {
+	size_t offset;
+	size_t len;
+    };
+
+    void open();
+    void unmap();
+    void append(const libtorrent::sha1_hash &hash, const char *data, size_t len);
+    bool read(const libtorrent::sha1_hash &hash, std::string &data);
+    void remove_record(const libtorrent::sha1_hash &hash);
+    void commit_pending();
+    void compact_file();
+    void close_file();
+
+    boost::mutex m_mutex;
+
+    std::string m_path;
+    int m_fd;
+    char *m_map;
+    size_t m_map_size;
+    size_t m_file_size;
+    size_t m_live_bytes;
+    std::string m_pending;
+    std::map<libtorrent::sha1_hash, record> m_index;
+};
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <cmath>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "sampler.h"
+
+using namespace libtorrent;
+
+static const char *history_field_names[num_history_fields] = {
+    "download_rate",
+    "upload_rate",
+    "download_payload_rate",
+    "upload_payload_rate",
+    "num_peers",
+    "num_seeds",
+    "progress",
+};
+
+int history_field_from_name(const char *name) {
+    for (int i = 0; i < num_history_fields; i++) {
+	if (strcmp(name, history_field_names[i]) == 0)
+	    return i;
+    }
+
+    return -1;
+}
+
+int history_stat_from_name(const char *name) {
+    if (strcmp(name, "avg") == 0)
+	return history_avg;
+    if (strcmp(name, "min") == 0)
+	return history_min;
+    if (strcmp(name, "max") == 0)
+	return history_max;
+
+    return -1;
+}
+
+void history_ring::init(size_t capacity, bool aggregated) {
+    m_avg.assign(capacity, 0);
+
+    /* raw samples have no spread, only aggregates keep min and max */
+    if (aggregated) {
+	m_min.assign(capacity, 0);
+	m_max.assign(capacity, 0);
+    }
+
+    m_head = 0;
+    m_size = 0;
+}
+
+void history_ring::push(float mn, float mx, float avg) {
+    m_avg[m_head] = avg;
+
+    if (!m_min.empty()) {
+	m_min[m_head] = mn;
+	m_max[m_head] = mx;
+    }
+
+    m_head = (m_head + 1) % m_avg.size();
+
+    if (m_size < m_avg.size())
+	m_size++;
+}
+
+float history_ring::at(size_t age, int stat) const {
+    size_t cap = m_avg.size();
+    size_t i = (m_head + cap - 1 - age) % cap;
+
+    if (stat == history_min && !m_min.empty())
+	return m_min[i];
+    if (stat == history_max && !m_max.empty())
+	return m_max[i];
+
+    return m_avg[i];
+}
+
+void field_history::init(size_t capacity) {
+    for (int t = 0; t < HISTORY_TIERS; t++)
+	tiers[t].init(capacity, t > 0);
+
+    for (int t = 0; t < HISTORY_TIERS - 1; t++) {
+	acc_min[t] = 0;
+	acc_max[t] = 0;
+	acc_sum[t] = 0;
+	acc_n[t] = 0;
+    }
+}
+
+void field_history::push(float v) {
+    tiers[0].push(v, v, v);
+
+    float mn = v, mx = v, avg = v;
+
+    for (int t = 0; t < HISTORY_TIERS - 1; t++) {
+	if (acc_n[t] == 0) {
+	    acc_min[t] = mn;
+	    acc_max[t] = mx;
+	} else {
+	    acc_min[t] = std::min(acc_min[t], mn);
+	    acc_max[t] = std::max(acc_max[t], mx);
+	}
+
+	acc_sum[t] += avg;
+	acc_n[t]++;
+
+	if (acc_n[t] < HISTORY_TIER_FACTOR)
+	    break;
+
+	mn = acc_min[t];
+	mx = acc_max[t];
+	avg = acc_sum[t] / acc_n[t];
+
+	tiers[t + 1].push(mn, mx, avg);
+
+	acc_sum[t] = 0;
+	acc_n[t] = 0;
+    }
+}
+
+void torrent_history::init(size_t capacity) {
+    for (int f = 0; f < num_history_fields; f++)
+	fields[f].init(capacity);
+
+    generation = 0;
+}
+
+sampler::sampler(session &s, int interval_ms, int capacity) 
+    : m_ses(s), m_interval(interval_ms), m_capacity(capacity), 
+      m_generation(0), m_stop(false), m_thread(0) {
+    m_session.init(capacity);
+
+    m_thread = new boost::thread(boost::bind(&sampler::run, this));
+}
+
+sampler::~sampler() {
+    {
+	boost::mutex::scoped_lock l(m_mutex);
+	m_stop = true;
+	m_cond.notify_all();
+    }
+
+    m_thread->join();
+    delete m_thread;
+}
+
+void sampler::run() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    while (!m_stop) {
+	m_cond.timed_wait(l, boost::get_system_time() + boost::posix_time::milliseconds(m_interval));
+
+	if (m_stop)
+	    break;
+
+	l.unlock();
+
+	try {
+	    sample();
+	} catch (std::exception &) {
+	}
+
+	l.lock();
+    }
+}
+
+void sampler::sample() {
+    std::vector<torrent_handle> handles = m_ses.get_torrents();
+    std::vector<std::pair<sha1_hash, torrent_status> > samples;
+
+    samples.reserve(handles.size());
+
+    /* query libtorrent without holding our lock, history() stays responsive */
+    for (std::vector<torrent_handle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
+	try {
+	    samples.push_back(std::make_pair(i->info_hash(), i->status()));
+	} catch (std::exception &) {
+	}
+    }
+
+    session_status ss = m_ses.status();
+
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_generation++;
+
+    float seeds = 0;
+    double progress = 0;
+
+    for (std::vector<std::pair<sha1_hash, torrent_status> >::const_iterator i = samples.begin(); i != samples.end(); ++i) {
+	const torrent_status &st = i->second;
+
+	seeds += st.num_seeds;
+	progress += st.progress;
+
+	std::map<sha1_hash, torrent_history>::iterator h = m_torrents.find(i->first);
+
+	if (h == m_torrents.end())
+	    continue;
+
+	torrent_history &th = h->second;
+	th.generation = m_generation;
+
+	th.fields[history_download_rate].push(st.download_rate);
+	th.fields[history_upload_rate].push(st.upload_rate);
+	th.fields[history_payload_download_rate].push(st.download_payload_rate);
+	th.fields[history_payload_upload_rate].push(st.upload_payload_rate);
+	th.fields[history_num_peers].push(st.num_peers);
+	th.fields[history_num_seeds].push(st.num_seeds);
+	th.fields[history_progress].push(st.progress);
+    }
+
+    /* drop the history of torrents that have left the session */
+    for (std::map<sha1_hash, torrent_history>::iterator i = m_torrents.begin(); i != m_torrents.end();) {
+	if (i->second.generation != m_generation)
+	    m_torrents.erase(i++);
+	else
+	    ++i;
+    }
+
+    m_session.fields[history_download_rate].push(ss.download_rate);
+    m_session.fields[history_upload_rate].push(ss.upload_rate);
+    m_session.fields[history_payload_download_rate].push(ss.payload_download_rate);
+    m_session.fields[history_payload_upload_rate].push(ss.payload_upload_rate);
+    m_session.fields[history_num_peers].push(ss.num_peers);
+    m_session.fields[history_num_seeds].push(seeds);
+    m_session.fields[history_progress].push(samples.empty() ? 0 : progress / samples.size());
+}
+
+bool sampler::history(const sha1_hash *hash, int field, double window, int stat, 
+    std::vector<double> &out, double &step) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    out.clear();
+
+    if (window <= 0)
+	return true;
+
+    const torrent_history *th = &m_session;
+
+    if (hash) {
+	std::map<sha1_hash, torrent_history>::iterator i = m_torrents.find(*hash);
+
+	/* recorded from the next sample on, dropped again if the torrent is not in the session */
+	if (i == m_torrents.end()) {
+	    i = m_torrents.insert(std::make_pair(*hash, torrent_history())).first;
+	    i->second.init(m_capacity);
+	    i->second.generation = m_generation;
+	    return false;
+	}
+
+	th = &i->second;
+    }
+
+    const field_history &fh = th->fields[field];
+
+    /* the finest tier whose span covers the window */
+    int tier = 0;
+    step = m_interval / 1000.0;
+
+    while (tier < HISTORY_TIERS - 1 && window > step * m_capacity) {
+	tier++;
+	step *= HISTORY_TIER_FACTOR;
+    }
+
+    const history_ring &ring = fh.tiers[tier];
+
+    size_t n = (size_t)ceil(window / step);
+    if (n > ring.size())
+	n = ring.size();
+
+    out.resize(n);
+
+    for (size_t age = 0; age < n; age++)
+	out[n - 1 - age] = ring.at(age, stat);
+
+    return true;
+}
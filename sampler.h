@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_SAMPLER_H
+#define LUATORRENT_SAMPLER_H
+
+#include <vector>
+#include <map>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+/*
+ * sampler
+ *
+ *   records the rates, peers and progress of a session as a whole, and of
+ *   each of its torrents history() has been asked about, from a
+ *   background thread at a fixed interval. A torrent's rings take some
+ *   58KB at the default capacity, so they are not kept for torrents
+ *   nobody looks at. Each field keeps three tiers of fixed size ring buffers:
+ *   the raw samples, and min/max/avg aggregates over 10 and 100 samples,
+ *   so a long window can be served at a coarser step.
+ */
+
+enum history_field {
+    history_download_rate,
+    history_upload_rate,
+    history_payload_download_rate,
+    history_payload_upload_rate,
+    history_num_peers,
+    history_num_seeds,
+    history_progress,
+
+    num_history_fields
+};
+
+enum history_stat {
+    history_avg,
+    history_min,
+    history_max
+};
+
+#define HISTORY_TIERS 3
+#define HISTORY_TIER_FACTOR 10
+
+int history_field_from_name(const char *name);
+int history_stat_from_name(const char *name);
+
+class history_ring {
+public:
+    void init(size_t capacity, bool aggregated);
+    void push(float mn, float mx, float avg);
+    float at(size_t age, int stat) const;
+    size_t size() const { return m_size; }
+
+private:
+    std::vector<float> m_min, m_max, m_avg;
+    size_t m_head;
+    size_t m_size;
+};
+
+struct field_history {
+    history_ring tiers[HISTORY_TIERS];
+
+    /* samples waiting to be folded into the next tier up */
+    float acc_min[HISTORY_TIERS - 1];
+    float acc_max[HISTORY_TIERS - 1];
+    double acc_sum[HISTORY_TIERS - 1];
+    int acc_n[HISTORY_TIERS - 1];
+
+    void init(size_t capacity);
+    void push(float v);
+};
+
+struct torrent_history {
+    field_history fields[num_history_fields];
+    unsigned long generation;
+
+    void init(size_t capacity);
+};
+
+class sampler {
+public:
+    sampler(libtorrent::session &s, int interval_ms, int capacity);
+    ~sampler();
+
+    /*
+     * fills out with the values of field over the last window seconds, 
+     * oldest first, for the torrent with the given info hash or for the
+     * session when hash is null. step is set to the seconds between values.
+     * False for a torrent not recorded yet, which is recorded from then on
+     */
+    bool history(const libtorrent::sha1_hash *hash, int field, double window, int stat, 
+	std::vector<double> &out, double &step);
+
+    int interval() const { return m_interval; }
+    int capacity() const { return m_capacity; }
+
+private:
+    void run();
+    void sample();
+
+    libtorrent::session &m_ses;
+    int m_interval;
+    int m_capacity;
+    unsigned long m_generation;
+
+    boost::mutex m_mutex;
+    boost::condition m_cond;
+    bool m_stop;
+
+    torrent_history m_session;
+    std::map<libtorrent::sha1_hash, torrent_history> m_torrents;
+
+    boost::thread *m_thread;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <sstream>
+#include <map>
+#include <cstdlib>
+
+#include <boost/weak_ptr.hpp>
+
+#include "libtorrent/session.hpp"
+
+#include "session_ref.h"
+
+using namespace libtorrent;
+
+/*
+ * process wide table of sessions that have handed out a token, shared
+ * by every lua_State that loaded the module
+ */
+static boost::mutex token_mutex;
+static unsigned long next_token = 1;
+static std::map<unsigned long, boost::weak_ptr<session_state> > tokens;
+
+session *torrent_session_check(lua_State *L, int index) {
+    return &torrent_session_state(L, index)->ses;
+}
+
+session_state *torrent_session_state(lua_State *L, int index) {
+    void *ud = luaL_checkudata(L, index, "Torrent.Session");
+    session_ptr *s = *((session_ptr **)ud);
+
+    if (!s)
+	luaL_error(L, "session has been closed");
+
+    return s->get();
+}
+
+session_ptr torrent_session_ref(lua_State *L, int index) {
+    void *ud = luaL_checkudata(L, index, "Torrent.Session");
+    session_ptr *s = *((session_ptr **)ud);
+
+    if (!s)
+	luaL_error(L, "session has been closed");
+
+    return *s;
+}
+
+void torrent_session_push(lua_State *L, session_ptr s) {
+    session_ptr **ud = (session_ptr **)lua_newuserdata(L, sizeof(session_ptr *));
+    *ud = new session_ptr(s);
+
+    luaL_getmetatable(L, "Torrent.Session");
+    lua_setmetatable(L, -2);
+}
+
+std::string session_token(session_ptr s) {
+    boost::mutex::scoped_lock l(token_mutex);
+
+    if (s->token == 0) {
+	s->token = next_token++;
+	tokens[s->token] = s;
+
+	/* drop tokens of sessions that have since been freed */
+	for (std::map<unsigned long, boost::weak_ptr<session_state> >::iterator i = tokens.begin(); i != tokens.end();) {
+	    if (i->second.expired())
+		tokens.erase(i++);
+	    else
+		++i;
+	}
+    }
+
+    std::ostringstream out;
+    out << "luatorrent.session:" << s->token;
+
+    return out.str();
+}
+
+session_ptr session_from_token(const std::string &token) {
+    const std::string prefix = "luatorrent.session:";
+
+    if (token.compare(0, prefix.size(), prefix) != 0)
+	return session_ptr();
+
+    unsigned long id = strtoul(token.c_str() + prefix.size(), 0, 10);
+
+    boost::mutex::scoped_lock l(token_mutex);
+
+    std::map<unsigned long, boost::weak_ptr<session_state> >::iterator i = tokens.find(id);
+
+    if (i == tokens.end())
+	return session_ptr();
+
+    return i->second.lock();
+}
+
+torrent_handle *torrent_handle_check(lua_State *L, int index) {
+    return &torrent_handle_ref(L, index)->handle;
+}
+
+handle_ref *torrent_handle_ref(lua_State *L, int index) {
+    void *ud = luaL_checkudata(L, index, "Torrent.Handle");
+    handle_ref *h = *((handle_ref **)ud);
+
+    if (!h)
+	luaL_error(L, "handle has been closed");
+
+    return h;
+}
+
+void torrent_handle_push(lua_State *L, const torrent_handle &h, session_ptr s) {
+    handle_ref **ud = (handle_ref **)lua_newuserdata(L, sizeof(handle_ref *));
+    *ud = new handle_ref(h, s);
+
+    luaL_getmetatable(L, "Torrent.Handle");
+    lua_setmetatable(L, -2);
+}
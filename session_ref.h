@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_SESSION_REF_H
+#define LUATORRENT_SESSION_REF_H
+
+#include <string>
+#include <list>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "libtorrent/session.hpp"
+
+#include "metrics.h"
+
+/*
+ * Reference counted sessions and handles
+ *
+ *   A Torrent.Session userdata holds a session_ptr and a Torrent.Handle
+ *   userdata holds a handle_ref, which keeps the handle's session alive.
+ *   The same session can be referenced from several lua_States, e.g.
+ *   lanes running on other OS threads; libtorrent serialises calls into
+ *   a session itself, the mutex below guards the binding's own state.
+ *
+ *   __gc drops the reference and clears the userdata, so any further use
+ *   of a collected (or explicitly closed) object raises a Lua error
+ *   instead of touching freed memory.
+ *
+ *   Tokens are short strings naming a live session or handle. They can
+ *   be passed between states (e.g. through a linda) and turned back into
+ *   userdata with Torrent.Session.FromToken / Torrent.Handle.FromToken.
+ *   A token only resolves while some state still holds the session.
+ *
+ *   Lua errors longjmp past C++ destructors, so a session_ptr or any
+ *   other shared_ptr must not be live when a luaL_check* or luaL_error
+ *   may be raised. Functions that raise while using the session take it
+ *   with torrent_session_state(), which borrows the userdata's reference
+ *   for as long as the userdata stays on the stack, and only copy a
+ *   session_ptr once their arguments have been checked.
+ */
+
+struct checkpoint_stamps;
+struct session_metrics;
+struct storage_budget;
+class sampler;
+class piece_cache;
+struct write_cache;
+class check_job;
+class move_job;
+class queue_manager;
+class resume_store;
+
+/* storage the binding provides, see session:set_settings() */
+struct storage_settings {
+    std::string kind;   /* default storage for add_torrent */
+    bool memory_hugepages;
+    int uring_queue_depth;
+    bool uring_direct;
+
+    storage_settings() : kind("disk"), memory_hugepages(false), uring_queue_depth(32), uring_direct(false) {}
+};
+
+/* a piece Torrent.File readers raised the priority of */
+struct raised_piece {
+    int priority;  /* restored once the last of them lets go */
+    int readers;
+};
+
+struct session_state {
+    libtorrent::session ses;
+
+    boost::mutex mutex;
+    unsigned long token;
+    boost::shared_ptr<checkpoint_stamps> stamps;
+    boost::shared_ptr<session_metrics> metrics;
+
+    storage_settings storage;
+    boost::shared_ptr<storage_budget> memory_budget;
+    boost::shared_ptr<piece_cache> read_cache;
+    boost::shared_ptr<write_cache> write_back;
+
+    /* declared after ses so the sampler thread is stopped before the session goes */
+    boost::shared_ptr<sampler> history;
+    boost::shared_ptr<queue_manager> queue;
+
+    /* fast_check jobs, which add to ses from their own thread */
+    std::list<boost::shared_ptr<check_job> > checks;
+
+    /* handle:move_storage() jobs, kept running when Lua drops them */
+    std::list<boost::shared_ptr<move_job> > moves;
+
+    /* kept per session so readers over the same pieces never save each other's priority */
+    std::map<std::pair<libtorrent::sha1_hash, int>, raised_piece> raised;
+
+    session_state() : token(0) { metric_add(metric_sessions, 1); }
+    ~session_state() { metric_add(metric_sessions, -1); }
+};
+
+typedef boost::shared_ptr<session_state> session_ptr;
+
+struct handle_ref {
+    libtorrent::torrent_handle handle;
+    session_ptr ses;
+
+    handle_ref(const libtorrent::torrent_handle &h, session_ptr s) : handle(h), ses(s) { metric_add(metric_handles, 1); }
+    handle_ref(const handle_ref &r) : handle(r.handle), ses(r.ses) { metric_add(metric_handles, 1); }
+    ~handle_ref() { metric_add(metric_handles, -1); }
+};
+
+/*
+ * the arguments of session:add_torrent, read from the stack before the
+ * session is touched; the strings point into the stack
+ */
+struct add_torrent_options {
+    libtorrent::torrent_info *info;
+    const char *save_path;
+    const char *resume_data;
+    size_t resume_len;
+    const char *resume_file;
+    resume_store *store;
+    const char *storage;
+    int fast_check;
+    bool seed_mode;
+};
+
+libtorrent::session *torrent_session_check(lua_State *L, int index);
+session_state *torrent_session_state(lua_State *L, int index);
+session_ptr torrent_session_ref(lua_State *L, int index);
+void torrent_session_push(lua_State *L, session_ptr s);
+
+void torrent_session_add_options(lua_State *L, int index, add_torrent_options &o);
+libtorrent::torrent_handle torrent_session_add(session_ptr s, const add_torrent_options &o, 
+    boost::shared_ptr<check_job> &job);
+
+std::string session_token(session_ptr s);
+session_ptr session_from_token(const std::string &token);
+
+libtorrent::torrent_handle *torrent_handle_check(lua_State *L, int index);
+handle_ref *torrent_handle_ref(lua_State *L, int index);
+void torrent_handle_push(lua_State *L, const libtorrent::torrent_handle &h, session_ptr s);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <map>
+
+#include "storage.h"
+
+using namespace libtorrent;
+
+typedef std::pair<const void *, sha1_hash> storage_key;
+
+static boost::mutex registry_mutex;
+static std::map<storage_key, storage_slot_ptr> registry;
+
+registered_storage::registered_storage(const void *owner, boost::intrusive_ptr<torrent_info const> info) 
+    : m_info(info), m_owner(owner), m_slot(new storage_slot) {
+    m_slot->storage = this;
+
+    boost::mutex::scoped_lock l(registry_mutex);
+    registry[storage_key(m_owner, m_info->info_hash())] = m_slot;
+}
+
+registered_storage::~registered_storage() {
+    unregister();
+}
+
+void registered_storage::unregister() {
+    if (!m_slot)
+	return;
+
+    {
+	boost::mutex::scoped_lock l(registry_mutex);
+
+	std::map<storage_key, storage_slot_ptr>::iterator i = registry.find(storage_key(m_owner, m_info->info_hash()));
+
+	/* the torrent may have been removed and added again meanwhile */
+	if (i != registry.end() && i->second == m_slot)
+	    registry.erase(i);
+    }
+
+    /* waits for a reader that is using the storage right now */
+    boost::mutex::scoped_lock l(m_slot->mutex);
+    m_slot->storage = 0;
+
+    l.unlock();
+    m_slot.reset();
+}
+
+storage_slot_ptr storage_find(const void *owner, const sha1_hash &hash) {
+    boost::mutex::scoped_lock l(registry_mutex);
+
+    std::map<storage_key, storage_slot_ptr>::const_iterator i = registry.find(storage_key(owner, hash));
+
+    if (i == registry.end())
+	return storage_slot_ptr();
+
+    return i->second;
+}
+
+bool storage_budget::reserve(long long n) {
+    boost::mutex::scoped_lock l(mutex);
+
+    if (limit > 0 && used + n > limit)
+	return false;
+
+    used += n;
+
+    return true;
+}
+
+void storage_budget::release(long long n) {
+    boost::mutex::scoped_lock l(mutex);
+
+    used -= n;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_STORAGE_H
+#define LUATORRENT_STORAGE_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/storage.hpp"
+
+/*
+ * Binding storages
+ *
+ *   Storages the binding hands to libtorrent derive from 
+ *   registered_storage, which makes them reachable by session and info
+ *   hash so the Lua API can read a torrent's data through the same
+ *   storage libtorrent writes it with. libtorrent owns and deletes the
+ *   storage, the registry only hands out a slot that is cleared (under
+ *   the slot's mutex) when the storage goes away. Derived classes call
+ *   unregister() first thing in their destructor, so nobody can reach a
+ *   half destroyed storage through its slot.
+ */
+
+class registered_storage;
+
+struct storage_slot {
+    boost::mutex mutex;
+    registered_storage *storage;
+
+    storage_slot() : storage(0) {}
+};
+
+typedef boost::shared_ptr<storage_slot> storage_slot_ptr;
+
+class registered_storage : public libtorrent::storage_interface {
+public:
+    registered_storage(const void *owner, boost::intrusive_ptr<libtorrent::torrent_info const> info);
+    virtual ~registered_storage();
+
+    const libtorrent::torrent_info &info() const { return *m_info; }
+
+protected:
+    void unregister();
+
+    /* held by readers that found the storage through its slot, until unregister() */
+    boost::mutex &slot_mutex() { return m_slot->mutex; }
+
+    boost::intrusive_ptr<libtorrent::torrent_info const> m_info;
+
+private:
+    const void *m_owner;
+    storage_slot_ptr m_slot;
+};
+
+/* the slot of the storage for hash in the session owner, if it has one */
+storage_slot_ptr storage_find(const void *owner, const libtorrent::sha1_hash &hash);
+
+/*
+ * bytes that storages of one session may hold in memory, shared by the
+ * session and its storages since they can outlive each other
+ */
+struct storage_budget {
+    boost::mutex mutex;
+    long long limit;  /* 0 for no limit */
+    long long used;
+
+    storage_budget() : limit(0), used(0) {}
+
+    bool reserve(long long n);
+    void release(long long n);
+};
+
+typedef boost::shared_ptr<storage_budget> storage_budget_ptr;
+
+#endif
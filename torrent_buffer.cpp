@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "libtorrent/hasher.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "buffer_ref.h"
+
+using namespace libtorrent;
+
+buffer_ref *torrent_buffer_check(lua_State *L, int index) {
+    return *((buffer_ref **)luaL_checkudata(L, index, "Torrent.Buffer"));
+}
+
+void torrent_buffer_push(lua_State *L, buffer_data data, size_t offset, size_t length) {
+    buffer_ref **b = (buffer_ref **)lua_newuserdata(L, sizeof(buffer_ref *));
+    *b = 0;
+
+    luaL_getmetatable(L, "Torrent.Buffer");
+    lua_setmetatable(L, -2);
+
+    *b = new buffer_ref(data, offset, length);
+}
+
+/*
+ * resolves string.sub style arguments i and j at index and index + 1
+ * against a buffer of length bytes, to an offset and length
+ */
+static void check_range(lua_State *L, int index, size_t length, size_t &offset, size_t &count) {
+    long i = luaL_optlong(L, index, 1);
+    long j = luaL_optlong(L, index + 1, -1);
+    long len = (long)length;
+
+    if (i < 0)
+	i += len + 1;
+    if (j < 0)
+	j += len + 1;
+    if (i < 1)
+	i = 1;
+    if (j > len)
+	j = len;
+
+    offset = i - 1;
+    count = i <= j ? j - i + 1 : 0;
+}
+
+/*
+ * length = #buffer
+ *  OR
+ * length = buffer:len()
+ *
+ *   the number of bytes in the buffer
+ */
+static int torrent_buffer_len(lua_State *L) {
+    buffer_ref *b = torrent_buffer_check(L, 1);
+
+    lua_pushnumber(L, b->length);
+
+    return 1;
+}
+
+/*
+ * slice = buffer:sub(i, [j])
+ *
+ *   bytes i to j of the buffer, with string.sub's indexing, as a new
+ *   Torrent.Buffer sharing this one's memory
+ */
+static int torrent_buffer_sub(lua_State *L) {
+    buffer_ref *b = torrent_buffer_check(L, 1);
+
+    size_t offset, count;
+    check_range(L, 2, b->length, offset, count);
+
+    torrent_buffer_push(L, b->data, b->offset + offset, count);
+
+    return 1;
+}
+
+/*
+ * s = buffer:string([i, [j]])
+ *
+ *   copies bytes i to j (default: all of them) into a Lua string
+ */
+static int torrent_buffer_string(lua_State *L) {
+    buffer_ref *b = torrent_buffer_check(L, 1);
+
+    size_t offset, count;
+    check_range(L, 2, b->length, offset, count);
+
+    lua_pushlstring(L, count ? b->begin() + offset : "", count);
+
+    return 1;
+}
+
+/*
+ * hex = buffer:sha1()
+ *
+ *   the SHA-1 digest of the buffer's bytes as 40 hex digits, the same
+ *   form as handle:info_hash()
+ */
+static int torrent_buffer_sha1(lua_State *L) {
+    buffer_ref *b = torrent_buffer_check(L, 1);
+
+    hasher h;
+
+    if (b->length)
+	h.update(b->begin(), (int)b->length);
+
+    lua_pushstring(L, info_hash_to_hex(h.final()).c_str());
+
+    return 1;
+}
+
+/*
+ * resolves the write target at index to a file descriptor: a number, an
+ * io library file or anything with a getfd() method (a luasocket socket)
+ */
+int check_write_target(lua_State *L, int index) {
+    if (lua_type(L, index) == LUA_TNUMBER)
+	return lua_tointeger(L, index);
+
+    if (lua_isuserdata(L, index) && lua_getmetatable(L, index)) {
+	luaL_getmetatable(L, LUA_FILEHANDLE);
+	bool is_file = lua_rawequal(L, -1, -2) != 0;
+	lua_pop(L, 2);
+
+	if (is_file) {
+	    FILE *f = *((FILE **)lua_touserdata(L, index));
+
+	    if (!f)
+		luaL_argerror(L, index, "attempt to use a closed file");
+
+	    /* anything the io library buffered goes first */
+	    fflush(f);
+
+	    return fileno(f);
+	}
+    }
+
+    lua_getfield(L, index, "getfd");
+    if (lua_isfunction(L, -1)) {
+	lua_pushvalue(L, index);
+	lua_call(L, 1, 1);
+
+	int fd = luaL_checkint(L, -1);
+	lua_pop(L, 1);
+
+	return fd;
+    }
+    lua_pop(L, 1);
+
+    luaL_argerror(L, index, "expected a file descriptor, file or socket");
+
+    return -1;
+}
+
+/*
+ * written = buffer:write(target)
+ *  OR
+ * nil, err, written = buffer:write(target)
+ *
+ *   writes the buffer straight from its memory to target, a file 
+ *   descriptor, io library file or luasocket socket. A non-blocking
+ *   socket that fills up fails with err "timeout" (as luasocket's send 
+ *   does), written being what went out; write the rest with buffer:sub()
+ */
+static int torrent_buffer_write(lua_State *L) {
+    buffer_ref *b = torrent_buffer_check(L, 1);
+    int fd = check_write_target(L, 2);
+
+    const char *p = b->begin();
+    size_t left = b->length;
+    size_t written = 0;
+
+    while (left > 0) {
+	ssize_t w = ::write(fd, p + written, left);
+
+	if (w < 0) {
+	    if (errno == EINTR)
+		continue;
+
+	    lua_pushnil(L);
+	    lua_pushstring(L, errno == EAGAIN || errno == EWOULDBLOCK ? "timeout" : strerror(errno));
+	    lua_pushnumber(L, written);
+
+	    return 3;
+	}
+
+	written += w;
+	left -= w;
+    }
+
+    lua_pushnumber(L, written);
+
+    return 1;
+}
+
+static int torrent_buffer_gc(lua_State *L) {
+    buffer_ref **b = (buffer_ref **)luaL_checkudata(L, 1, "Torrent.Buffer");
+
+    delete *b;
+    *b = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_buffer_methods[] = {
+    {"len", torrent_buffer_len},
+    {"sub", torrent_buffer_sub},
+    {"string", torrent_buffer_string},
+    {"sha1", torrent_buffer_sha1},
+    {"write", torrent_buffer_write},
+    {NULL, NULL}
+};
+
+int torrent_buffer_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.Buffer");
+    luaL_register(L, 0, torrent_buffer_methods);  
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_buffer_len);
+    lua_setfield(L, -2, "__len"); 
+
+    lua_pushcfunction(L, torrent_buffer_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    return 1;
+}
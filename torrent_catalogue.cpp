@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <cstdio>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "session_ref.h"
+#include "tracker.h"
+#include "catalogue.h"
+
+using namespace libtorrent;
+
+const char *torrent_storage_kind_error(const char *kind);
+storage_constructor_type torrent_session_storage(session_state *s, const char *kind);
+
+static catalogue *torrent_catalogue_check(lua_State *L, int index) {
+    return *((catalogue **)luaL_checkudata(L, index, "Torrent.Catalogue"));
+}
+
+/* a Torrent.Info or 40 character hex info hash argument */
+static sha1_hash check_hash(lua_State *L, int index) {
+    sha1_hash hash;
+
+    if (lua_isuserdata(L, index))
+	return (*((torrent_info **)luaL_checkudata(L, index, "Torrent.Info")))->info_hash();
+
+    if (!info_hash_from_hex(luaL_checkstring(L, index), hash))
+	luaL_argerror(L, index, "invalid info hash");
+
+    return hash;
+}
+
+/*
+ * catalogue = Torrent.Catalogue.New(session, [options])
+ *
+ *   creates a catalogue of torrents that are only in session while they
+ *   are in use. options is a table which may contain:
+ *     max_active - torrents in the session at once, activating another
+ *                  evicts the longest idle (default 0, no limit)
+ *     idle       - seconds without peers before catalogue:update()
+ *                  evicts a torrent (default 600)
+ *     level      - zlib level dormant resume data is kept at (default 6)
+ *     storage    - storage kind torrents are added with, as add_torrent
+ */
+static int torrent_catalogue_new(lua_State *L) {
+    torrent_session_state(L, 1);
+
+    int max_active = 0;
+    int idle = 600;
+    int level = 6;
+    const char *kind = 0;
+
+    if (lua_istable(L, 2)) {
+	lua_getfield(L, 2, "max_active");
+	max_active = luaL_optint(L, -1, max_active);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "idle");
+	idle = luaL_optint(L, -1, idle);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "level");
+	level = luaL_optint(L, -1, level);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "storage");
+	kind = luaL_optstring(L, -1, 0);
+	lua_pop(L, 1);
+    }
+
+    if (max_active < 0 || idle < 0 || level < 0 || level > 9)
+	luaL_argerror(L, 2, "max_active and idle must not be negative, level is 0 to 9");
+
+    if (kind && torrent_storage_kind_error(kind))
+	luaL_argerror(L, 2, torrent_storage_kind_error(kind));
+
+    catalogue **c = (catalogue **)lua_newuserdata(L, sizeof(catalogue *));
+    *c = 0;
+
+    luaL_getmetatable(L, "Torrent.Catalogue");
+    lua_setmetatable(L, -2);
+
+    char error[256] = "";
+
+    try {
+	session_ptr s = torrent_session_ref(L, 1);
+
+	*c = new catalogue(s, torrent_session_storage(s.get(), kind), max_active, idle, level);
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * info_hash = catalogue:add(torrent, save_path, [resume_data])
+ *
+ *   registers a dormant torrent, given as a Torrent.Info or the path of
+ *   its .torrent file, with its data under save_path. A path is all the
+ *   catalogue keeps of a .torrent file until the torrent is activated,
+ *   which makes for the smallest records. Returns the hex info hash
+ */
+static int torrent_catalogue_add(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+
+    boost::intrusive_ptr<torrent_info> info;
+    std::string torrent_file;
+
+    if (lua_isuserdata(L, 2))
+	info = *((torrent_info **)luaL_checkudata(L, 2, "Torrent.Info"));
+    else
+	torrent_file = luaL_checkstring(L, 2);
+
+    const char *path = luaL_checkstring(L, 3);
+    size_t len = 0;
+    const char *resume = luaL_optlstring(L, 4, "", &len);
+
+    try {
+	sha1_hash hash = c->add(info, torrent_file, path, std::string(resume, len));
+
+	lua_pushstring(L, info_hash_to_hex(hash).c_str());
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * removed = catalogue:remove(info_hash)
+ *
+ *   forgets a torrent, taking it out of the session if it is active
+ */
+static int torrent_catalogue_remove(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+    sha1_hash hash = check_hash(L, 2);
+
+    try {
+	lua_pushboolean(L, c->remove(hash));
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * torrent_handle = catalogue:activate(info_hash)
+ *
+ *   returns the handle of the torrent, adding it to the session with its
+ *   resume data first if it is dormant; nil if it is not in the catalogue
+ */
+static int torrent_catalogue_activate(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+    sha1_hash hash = check_hash(L, 2);
+
+    try {
+	torrent_handle h;
+
+	if (c->activate(hash, h))
+	    torrent_handle_push(L, h, c->session());
+	else
+	    lua_pushnil(L);
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * evicted = catalogue:evict(info_hash)
+ *
+ *   takes an active torrent out of the session, keeping its resume data.
+ *   Its handles are invalid from then on
+ */
+static int torrent_catalogue_evict(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+    sha1_hash hash = check_hash(L, 2);
+
+    try {
+	lua_pushboolean(L, c->evict(hash));
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * evicted, activated = catalogue:update([tracker])
+ *
+ *   the catalogue's schedule, to be called every so often: evicts active
+ *   torrents that had no peers for the idle time, and given a 
+ *   Torrent.Tracker, activates the dormant torrents peers are asking it
+ *   for, except those evicted less than the idle time ago (including by
+ *   this call). Returns the number of each
+ */
+static int torrent_catalogue_update(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+    std::vector<sha1_hash> wanted;
+
+    if (!lua_isnoneornil(L, 2)) {
+	tracker **t = (tracker **)luaL_checkudata(L, 2, "Torrent.Tracker");
+
+	if (!*t)
+	    luaL_argerror(L, 2, "tracker has been closed");
+
+	std::vector<tracker_torrent_stats> torrents = (*t)->torrents();
+
+	for (size_t i = 0; i < torrents.size(); i++) {
+	    if (torrents[i].leechers > 0)
+		wanted.push_back(torrents[i].info_hash);
+	}
+    }
+
+    try {
+	int evicted = c->evict_idle();
+	int activated = c->activate_all(wanted);
+
+	lua_pushinteger(L, evicted);
+	lua_pushinteger(L, activated);
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 2;
+}
+
+/*
+ * stats = catalogue:stats()
+ *
+ *   returns a table with:
+ *     torrents      - registered
+ *     active        - of those in the session
+ *     activations, evictions - since the catalogue was created
+ *     dormant_bytes - memory the dormant records take, not counting the
+ *                     Torrent.Info objects some were registered with
+ */
+static int torrent_catalogue_stats(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+
+    catalogue::stats st = c->get_stats();
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_INT("torrents", st.torrents);
+    LUA_PUSH_ATTRIB_INT("active", st.active);
+    LUA_PUSH_ATTRIB_FLOAT("activations", st.activations);
+    LUA_PUSH_ATTRIB_FLOAT("evictions", st.evictions);
+    LUA_PUSH_ATTRIB_FLOAT("dormant_bytes", st.dormant_bytes);
+
+    return 1;
+}
+
+/*
+ * torrents = catalogue:torrents()
+ *
+ *   returns an array of {info_hash, save_path, active, idle} tables, idle
+ *   being the seconds an active torrent has been without peers
+ */
+static int torrent_catalogue_torrents(lua_State *L) {
+    catalogue *c = torrent_catalogue_check(L, 1);
+
+    std::vector<catalogue::torrent> torrents = c->list();
+
+    lua_newtable(L);
+
+    for (size_t i = 0; i < torrents.size(); i++) {
+	lua_newtable(L);
+
+	LUA_PUSH_ATTRIB_STRING("info_hash", info_hash_to_hex(torrents[i].hash).c_str());
+	LUA_PUSH_ATTRIB_STRING("save_path", torrents[i].save_path.c_str());
+	LUA_PUSH_ATTRIB_BOOL("active", torrents[i].active);
+	LUA_PUSH_ATTRIB_FLOAT("idle", torrents[i].idle);
+
+	lua_rawseti(L, -2, i + 1);
+    }
+
+    return 1;
+}
+
+/*
+ * __gc
+ */
+static int torrent_catalogue_gc(lua_State *L) {
+    catalogue **c = (catalogue **)luaL_checkudata(L, 1, "Torrent.Catalogue");
+
+    delete *c;
+    *c = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_catalogue_methods[] = {
+    {"add", torrent_catalogue_add},
+    {"remove", torrent_catalogue_remove},
+    {"activate", torrent_catalogue_activate},
+    {"evict", torrent_catalogue_evict},
+    {"update", torrent_catalogue_update},
+    {"stats", torrent_catalogue_stats},
+    {"torrents", torrent_catalogue_torrents},
+    {NULL, NULL}
+};
+
+static const luaL_Reg torrent_catalogue_class_methods[] = {
+    {"New", torrent_catalogue_new},
+    {NULL, NULL}
+};
+
+int torrent_catalogue_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.Catalogue");
+    luaL_register(L, 0, torrent_catalogue_methods);  
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_catalogue_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    luaL_register(L, "Torrent.Catalogue", torrent_catalogue_class_methods);  
+
+    return 1;
+}
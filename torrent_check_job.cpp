@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "session_ref.h"
+#include "check_job.h"
+
+using namespace libtorrent;
+
+struct check_job_ref {
+    check_job_ptr job;
+    session_ptr ses;
+
+    check_job_ref(check_job_ptr j, session_ptr s) : job(j), ses(s) {}
+};
+
+static check_job_ref *torrent_check_job_check(lua_State *L, int index) {
+    return *((check_job_ref **)luaL_checkudata(L, index, "Torrent.CheckJob"));
+}
+
+void torrent_check_job_push(lua_State *L, check_job_ptr job, session_ptr s) {
+    check_job_ref **ud = (check_job_ref **)lua_newuserdata(L, sizeof(check_job_ref *));
+    *ud = 0;
+
+    luaL_getmetatable(L, "Torrent.CheckJob");
+    lua_setmetatable(L, -2);
+
+    *ud = new check_job_ref(job, s);
+}
+
+/* the table job:status() and session:checks() return for job */
+void torrent_check_job_status_push(lua_State *L, check_job &job) {
+    static const char *states[] = {"checking", "adding", "done", "failed", "cancelled"};
+
+    check_job::status st = job.get_status();
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_STRING("info_hash", info_hash_to_hex(job.info_hash()).c_str());
+    LUA_PUSH_ATTRIB_STRING("state", states[st.state]);
+    LUA_PUSH_ATTRIB_FLOAT("progress", st.pieces ? (double)st.checked / st.pieces : 1.0);
+    LUA_PUSH_ATTRIB_INT("pieces", st.pieces);
+    LUA_PUSH_ATTRIB_INT("checked", st.checked);
+    LUA_PUSH_ATTRIB_INT("ok", st.ok);
+    LUA_PUSH_ATTRIB_FLOAT("bytes", st.bytes);
+    LUA_PUSH_ATTRIB_FLOAT("seconds", st.seconds);
+    LUA_PUSH_ATTRIB_FLOAT("rate", st.seconds > 0 ? st.bytes / st.seconds : 0);
+
+    if (!st.error.empty()) {
+	LUA_PUSH_ATTRIB_STRING("error", st.error.c_str());
+    }
+}
+
+/*
+ * status = job:status()
+ *
+ *   returns a table with:
+ *     info_hash - of the torrent being checked
+ *     state     - "checking", "adding", "done", "failed" or "cancelled"
+ *     progress  - fraction of pieces checked
+ *     pieces, checked, ok - piece counts, ok being the ones that matched
+ *     bytes, seconds, rate - bytes hashed, time taken and bytes/second
+ *     error     - why the job failed
+ */
+static int torrent_check_job_status(lua_State *L) {
+    check_job_ref *ref = torrent_check_job_check(L, 1);
+
+    torrent_check_job_status_push(L, *ref->job);
+
+    return 1;
+}
+
+/*
+ * finished = job:wait([ms])
+ *
+ *   waits up to ms milliseconds (default: until it ends) for the job to
+ *   be done, failed or cancelled, returns whether it is
+ */
+static int torrent_check_job_wait(lua_State *L) {
+    check_job_ref *ref = torrent_check_job_check(L, 1);
+    int ms = luaL_optint(L, 2, -1);
+
+    lua_pushboolean(L, ref->job->wait(ms));
+
+    return 1;
+}
+
+/*
+ * job:cancel()
+ *
+ *   stops the check, the torrent is not added
+ */
+static int torrent_check_job_cancel(lua_State *L) {
+    check_job_ref *ref = torrent_check_job_check(L, 1);
+
+    ref->job->cancel();
+
+    return 0;
+}
+
+/*
+ * torrent_handle = job:handle()
+ *
+ *   the added torrent once the job is done, nil before
+ */
+static int torrent_check_job_handle(lua_State *L) {
+    check_job_ref *ref = torrent_check_job_check(L, 1);
+    torrent_handle h;
+
+    if (ref->job->handle(h))
+	torrent_handle_push(L, h, ref->ses);
+    else
+	lua_pushnil(L);
+
+    return 1;
+}
+
+static int torrent_check_job_gc(lua_State *L) {
+    check_job_ref **ref = (check_job_ref **)luaL_checkudata(L, 1, "Torrent.CheckJob");
+
+    delete *ref;
+    *ref = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_check_job_methods[] = {
+    {"status", torrent_check_job_status},
+    {"wait", torrent_check_job_wait},
+    {"cancel", torrent_check_job_cancel},
+    {"handle", torrent_check_job_handle},
+    {NULL, NULL}
+};
+
+int torrent_check_job_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.CheckJob");
+    luaL_register(L, 0, torrent_check_job_methods);  
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_check_job_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    return 1;
+}
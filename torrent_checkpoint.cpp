@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <iomanip>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "resume_store.h"
+#include "session_ref.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+/*
+ * what a torrent looked like when it was last checkpointed, a torrent
+ * whose stamp is unchanged is skipped by dirty only checkpoints
+ */
+struct checkpoint_stamp {
+    int state;
+    bool paused;
+    size_type total_done;
+    size_type total_payload_upload;
+
+    bool operator==(const checkpoint_stamp &o) const {
+	return state == o.state && paused == o.paused 
+	    && total_done == o.total_done && total_payload_upload == o.total_payload_upload;
+    }
+};
+
+struct checkpoint_stamps {
+    boost::mutex mutex;
+    std::map<sha1_hash, checkpoint_stamp> stamps;
+};
+
+struct checkpoint_record {
+    sha1_hash hash;
+    checkpoint_stamp stamp;
+    entry resume;
+};
+
+/*
+ * checkpoint_job
+ *
+ *   owns a snapshot of resume data taken on the Lua thread, and
+ *   encodes and writes it out on a background thread
+ */
+class checkpoint_job {
+public:
+    checkpoint_job() 
+	: store(0), store_ref(LUA_NOREF), level(0), skipped(0), 
+	  m_thread(0), m_done(false), m_saved(0), m_bytes(0), m_seconds(0) {
+    }
+
+    ~checkpoint_job() {
+	wait();
+    }
+
+    void start() {
+	m_thread = new boost::thread(boost::bind(&checkpoint_job::run, this));
+    }
+
+    void wait() {
+	if (m_thread) {
+	    m_thread->join();
+	    delete m_thread;
+	    m_thread = 0;
+	}
+    }
+
+    bool done() {
+	boost::mutex::scoped_lock l(m_mutex);
+	return m_done;
+    }
+
+    void push_result(lua_State *L);
+
+    std::vector<checkpoint_record> records;
+    boost::shared_ptr<checkpoint_stamps> stamps;
+    resume_store *store;
+    int store_ref;
+    std::string dir;
+    int level;
+    int skipped;
+
+private:
+    void run();
+    void write_file(const checkpoint_record &r, const std::string &data);
+
+    boost::thread *m_thread;
+    boost::mutex m_mutex;
+    bool m_done;
+    int m_saved;
+    size_type m_bytes;
+    double m_seconds;
+    std::vector<std::string> m_errors;
+};
+
+void checkpoint_job::write_file(const checkpoint_record &r, const std::string &data) {
+    std::string path = dir + "/" + info_hash_to_hex(r.hash) + ".resume";
+    std::string tmp = path + ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+	throw std::runtime_error(tmp + ": " + strerror(errno));
+
+    const char *p = data.data();
+    size_t left = data.size();
+
+    while (left > 0) {
+	ssize_t w = ::write(fd, p, left);
+
+	if (w < 0 && errno == EINTR)
+	    continue;
+
+	if (w < 0) {
+	    std::string err = tmp + ": " + strerror(errno);
+	    ::close(fd);
+	    unlink(tmp.c_str());
+	    throw std::runtime_error(err);
+	}
+
+	p += w;
+	left -= w;
+    }
+
+    /* the old file stays until the new one is known to be on disk */
+    if (fdatasync(fd) != 0) {
+	std::string err = tmp + ": " + strerror(errno);
+	::close(fd);
+	unlink(tmp.c_str());
+	throw std::runtime_error(err);
+    }
+
+    if (::close(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+	std::string err = path + ": " + strerror(errno);
+	unlink(tmp.c_str());
+	throw std::runtime_error(err);
+    }
+}
+
+void checkpoint_job::run() {
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    std::vector<sha1_hash> saved;
+    std::vector<std::string> errors;
+    size_type bytes = 0;
+
+    for (std::vector<checkpoint_record>::iterator i = records.begin(); i != records.end(); ++i) {
+	try {
+	    std::string data = resume_data_encode(i->resume, level);
+
+	    if (store)
+		store->put(i->hash, data);
+	    else
+		write_file(*i, data);
+
+	    bytes += data.size();
+	    saved.push_back(i->hash);
+	} catch (std::exception &e) {
+	    errors.push_back(info_hash_to_hex(i->hash) + ": " + e.what());
+	}
+
+	i->resume = entry();
+    }
+
+    try {
+	if (store) {
+	    store->commit();
+	} else {
+	    int fd = ::open(dir.c_str(), O_RDONLY);
+	    if (fd >= 0) {
+		fsync(fd);
+		::close(fd);
+	    }
+	}
+    } catch (std::exception &e) {
+	errors.push_back(e.what());
+	saved.clear();
+    }
+
+    /* only torrents that made it to disk count as clean */
+    if (stamps) {
+	boost::mutex::scoped_lock l(stamps->mutex);
+
+	size_t n = 0;
+	for (std::vector<checkpoint_record>::const_iterator i = records.begin(); i != records.end() && n < saved.size(); ++i) {
+	    if (i->hash == saved[n]) {
+		stamps->stamps[i->hash] = i->stamp;
+		n++;
+	    }
+	}
+    }
+
+    boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+
+    boost::mutex::scoped_lock l(m_mutex);
+    m_saved = saved.size();
+    m_bytes = bytes;
+    m_errors.swap(errors);
+    m_seconds = elapsed.total_microseconds() / 1000000.0;
+    m_done = true;
+
+    metric_add(metric_checkpoints, 1);
+    metric_add(metric_checkpoint_saved, m_saved);
+    metric_add(metric_checkpoint_errors, m_errors.size());
+    metric_observe(histogram_checkpoint_us, elapsed.total_microseconds());
+}
+
+void checkpoint_job::push_result(lua_State *L) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_INT("saved", m_saved);
+    LUA_PUSH_ATTRIB_INT("skipped", skipped);
+    LUA_PUSH_ATTRIB_FLOAT("bytes", m_bytes);
+    LUA_PUSH_ATTRIB_FLOAT("seconds", m_seconds);
+
+    lua_pushstring(L, "errors");
+    lua_newtable(L);
+    int c = 1;
+    for (std::vector<std::string>::const_iterator i = m_errors.begin(); i != m_errors.end(); ++i) {
+	LUA_PUSH_ARRAY_STRING(c, i->c_str());
+    }
+    lua_settable(L, -3);
+}
+
+/*
+ * checkpoint = session:checkpoint_async(dest, [options])
+ *
+ *   snapshots the resume data of the torrents in this session and writes
+ *   it on a background thread. dest is either a Torrent.ResumeStore or a
+ *   directory, in which one <info_hash>.resume file is written per torrent.
+ *
+ *   options is a table which may contain:
+ *     dirty_only - only save torrents that changed since they were last saved
+ *     level      - zlib compression level (1-9) for the resume data
+ *
+ *   returns a Torrent.Checkpoint that can be polled for completion
+ */
+int torrent_session_checkpoint_async(lua_State *L) {
+    session_state *ss = torrent_session_state(L, 1);
+    session *s = &ss->ses;
+
+    bool dirty_only = false;
+    int level = 0;
+
+    if (lua_istable(L, 3)) {
+	lua_getfield(L, 3, "dirty_only");
+	dirty_only = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 3, "level");
+	level = luaL_optint(L, -1, 0);
+	lua_pop(L, 1);
+    }
+
+    checkpoint_job **cj = (checkpoint_job **)lua_newuserdata(L, sizeof(checkpoint_job *));
+    *cj = new checkpoint_job();
+
+    luaL_getmetatable(L, "Torrent.Checkpoint");
+    lua_setmetatable(L, -2);
+
+    checkpoint_job *job = *cj;
+    job->level = level;
+
+    if (lua_isuserdata(L, 2)) {
+	job->store = *((resume_store **)luaL_checkudata(L, 2, "Torrent.ResumeStore"));
+
+	/* keep the store alive for as long as the job may write to it */
+	lua_pushvalue(L, 2);
+	job->store_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    } else {
+	job->dir = luaL_checkstring(L, 2);
+    }
+
+    {
+	boost::mutex::scoped_lock l(ss->mutex);
+
+	if (!ss->stamps)
+	    ss->stamps.reset(new checkpoint_stamps());
+
+	job->stamps = ss->stamps;
+    }
+
+    checkpoint_stamps *stamps = job->stamps.get();
+
+    try {
+	std::vector<torrent_handle> handles = s->get_torrents();
+
+	job->records.reserve(handles.size());
+
+	for (std::vector<torrent_handle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
+	    if (!i->has_metadata())
+		continue;
+
+	    torrent_status status = i->status();
+
+	    checkpoint_stamp stamp;
+	    stamp.state = status.state;
+	    stamp.paused = status.paused;
+	    stamp.total_done = status.total_done;
+	    stamp.total_payload_upload = status.total_payload_upload;
+
+	    sha1_hash hash = i->info_hash();
+
+	    if (dirty_only) {
+		boost::mutex::scoped_lock l(stamps->mutex);
+		std::map<sha1_hash, checkpoint_stamp>::const_iterator old = stamps->stamps.find(hash);
+
+		if (old != stamps->stamps.end() && old->second == stamp) {
+		    job->skipped++;
+		    continue;
+		}
+	    }
+
+	    job->records.push_back(checkpoint_record());
+
+	    checkpoint_record &r = job->records.back();
+	    r.hash = hash;
+	    r.stamp = stamp;
+	    r.resume = i->write_resume_data();
+	}
+
+	job->start();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 1;
+}
+
+/*
+ * bool = checkpoint:done()
+ *
+ *   returns true once the checkpoint has been written
+ */
+static int torrent_checkpoint_done(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.Checkpoint");
+    checkpoint_job *job = *((checkpoint_job **)ud);
+
+    lua_pushboolean(L, job->done());
+
+    return 1;
+}
+
+/*
+ * result = checkpoint:wait()
+ *
+ *   blocks until the checkpoint has been written and returns its result
+ */
+static int torrent_checkpoint_wait(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.Checkpoint");
+    checkpoint_job *job = *((checkpoint_job **)ud);
+
+    job->wait();
+    job->push_result(L);
+
+    return 1;
+}
+
+/*
+ * result = checkpoint:result()
+ *
+ *   returns nil while the checkpoint is still running, otherwise a table 
+ *   with the number of torrents saved and skipped, the bytes written,
+ *   the time taken in seconds and a list of errors
+ */
+static int torrent_checkpoint_result(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.Checkpoint");
+    checkpoint_job *job = *((checkpoint_job **)ud);
+
+    if (!job->done()) {
+	lua_pushnil(L);
+	return 1;
+    }
+
+    job->push_result(L);
+
+    return 1;
+}
+
+/*
+ * __gc
+ *
+ *   waits for the background write to finish before freeing the job
+ */
+static int torrent_checkpoint_gc(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.Checkpoint");
+    checkpoint_job *job = *((checkpoint_job **)ud);
+
+    job->wait();
+    luaL_unref(L, LUA_REGISTRYINDEX, job->store_ref);
+
+    delete job;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_checkpoint_methods[] = {
+    {"done", torrent_checkpoint_done},
+    {"wait", torrent_checkpoint_wait},
+    {"result", torrent_checkpoint_result},
+    {NULL, NULL}
+};
+
+int torrent_checkpoint_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.Checkpoint");
+    luaL_register(L, 0, torrent_checkpoint_methods);  
+    lua_pushvalue(L,-1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_checkpoint_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    return 1;
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include "libtorrent/torrent_info.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "cross_seed.h"
+
+using namespace libtorrent;
+
+static cross_seed_index *torrent_cross_seed_check(lua_State *L, int index) {
+    return *((cross_seed_index **)luaL_checkudata(L, index, "Torrent.CrossSeedIndex"));
+}
+
+static torrent_info *check_info(lua_State *L, int index) {
+    return *((torrent_info **)luaL_checkudata(L, index, "Torrent.Info"));
+}
+
+/*
+ * index = Torrent.CrossSeedIndex.New()
+ *
+ *   creates an empty index of torrent files on disk
+ */
+static int torrent_cross_seed_new(lua_State *L) {
+    cross_seed_index **ci = (cross_seed_index **)lua_newuserdata(L, sizeof(cross_seed_index *));
+    *ci = 0;
+
+    luaL_getmetatable(L, "Torrent.CrossSeedIndex");
+    lua_setmetatable(L, -2);
+
+    *ci = new cross_seed_index();
+
+    return 1;
+}
+
+/*
+ * added = index:add(torrent_info, save_path)
+ *
+ *   indexes the files of torrent_info, whose data is under save_path.
+ *   Returns false if the torrent was indexed already
+ */
+static int torrent_cross_seed_add(lua_State *L) {
+    cross_seed_index *ci = torrent_cross_seed_check(L, 1);
+    torrent_info *ti = check_info(L, 2);
+    const char *path = luaL_checkstring(L, 3);
+
+    try {
+	lua_pushboolean(L, ci->add(*ti, path));
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * removed = index:remove(torrent_info)
+ *  OR
+ * removed = index:remove(info_hash)
+ *
+ *   drops a torrent, given as a Torrent.Info or a hex info hash, from
+ *   the index
+ */
+static int torrent_cross_seed_remove(lua_State *L) {
+    cross_seed_index *ci = torrent_cross_seed_check(L, 1);
+    sha1_hash hash;
+
+    if (lua_isuserdata(L, 2))
+	hash = check_info(L, 2)->info_hash();
+    else if (!info_hash_from_hex(luaL_checkstring(L, 2), hash))
+	luaL_argerror(L, 2, "invalid info hash");
+
+    lua_pushboolean(L, ci->remove(hash));
+
+    return 1;
+}
+
+/*
+ * matches = index:match(torrent_info)
+ *
+ *   returns an array with a table for each file of torrent_info an
+ *   indexed file on disk could provide:
+ *     file   - index of the file in torrent_info (1 based)
+ *     path   - of the file on disk
+ *     hashed - true if piece hashes agree, false if only the size does
+ */
+static int torrent_cross_seed_match(lua_State *L) {
+    cross_seed_index *ci = torrent_cross_seed_check(L, 1);
+    torrent_info *ti = check_info(L, 2);
+
+    try {
+	std::vector<cross_seed_index::match> matches = ci->find(*ti);
+
+	lua_newtable(L);
+
+	for (size_t i = 0; i < matches.size(); i++) {
+	    lua_newtable(L);
+
+	    LUA_PUSH_ATTRIB_INT("file", matches[i].file + 1);
+	    LUA_PUSH_ATTRIB_STRING("path", matches[i].path.c_str());
+	    LUA_PUSH_ATTRIB_BOOL("hashed", matches[i].hashed);
+
+	    lua_rawseti(L, -2, i + 1);
+	}
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * report = index:link(torrent_info, save_path, [options])
+ *
+ *   puts the matches of torrent_info (see index:match()) at their place
+ *   under save_path, then hashes the pieces that lie wholly in linked
+ *   files. A size only match none of whose pieces check out is unlinked
+ *   again. A hardlink is only left for a hash match every piece of which
+ *   verifies, anything else is copied, since the new torrent would
+ *   otherwise download into the indexed file. options is a table which
+ *   may contain:
+ *     method - "auto" (reflink, else hardlink, else copy; the default),
+ *              "hardlink" (else reflink or copy) or "reflink" (only)
+ *     verify - false to skip hashing, and leave checking to add_torrent
+ *              (with fast_check, say)
+ *
+ *   report is a table with:
+ *     files       - an array of {file, source, method, error, hashed,
+ *                   pieces_ok, pieces_failed} for each match, method
+ *                   being "reflink", "hardlink", "copy", "in place"
+ *                   (the target already is the source, left untouched)
+ *                   or nil if the file was not linked
+ *     linked      - number of files in place
+ *     pieces      - number of pieces verified
+ *     resume_data - fast resume data with the verified pieces, for 
+ *                   session:add_torrent(torrent_info, save_path, 
+ *                   {resume_data = report.resume_data}). nil without verify
+ */
+static int torrent_cross_seed_link(lua_State *L) {
+    static const char *methods[] = {"auto", "hardlink", "reflink", NULL};
+
+    cross_seed_index *ci = torrent_cross_seed_check(L, 1);
+    torrent_info *ti = check_info(L, 2);
+    const char *path = luaL_checkstring(L, 3);
+
+    int method = cross_seed_index::link_auto;
+    bool verify = true;
+
+    if (lua_istable(L, 4)) {
+	lua_getfield(L, 4, "method");
+	if (!lua_isnil(L, -1))
+	    method = luaL_checkoption(L, -1, NULL, methods);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 4, "verify");
+	if (!lua_isnil(L, -1))
+	    verify = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+    }
+
+    try {
+	std::vector<bool> have;
+	std::vector<cross_seed_index::link_result> results = 
+	    ci->link(*ti, path, (cross_seed_index::link_method)method, verify, have);
+
+	int linked = 0;
+	int pieces = 0;
+
+	lua_newtable(L);
+
+	lua_pushstring(L, "files");
+	lua_newtable(L);
+
+	for (size_t i = 0; i < results.size(); i++) {
+	    const cross_seed_index::link_result &r = results[i];
+
+	    lua_newtable(L);
+
+	    LUA_PUSH_ATTRIB_INT("file", r.file + 1);
+	    LUA_PUSH_ATTRIB_STRING("source", r.source.c_str());
+	    LUA_PUSH_ATTRIB_BOOL("hashed", r.hashed);
+	    LUA_PUSH_ATTRIB_INT("pieces_ok", r.pieces_ok);
+	    LUA_PUSH_ATTRIB_INT("pieces_failed", r.pieces_failed);
+
+	    if (!r.method.empty()) {
+		LUA_PUSH_ATTRIB_STRING("method", r.method.c_str());
+		linked++;
+	    }
+
+	    if (!r.error.empty()) {
+		LUA_PUSH_ATTRIB_STRING("error", r.error.c_str());
+	    }
+
+	    lua_rawseti(L, -2, i + 1);
+	}
+
+	lua_settable(L, -3);
+
+	for (size_t p = 0; p < have.size(); p++) {
+	    if (have[p])
+		pieces++;
+	}
+
+	LUA_PUSH_ATTRIB_INT("linked", linked);
+	LUA_PUSH_ATTRIB_INT("pieces", pieces);
+
+	if (verify) {
+	    std::string data = resume_data_encode(resume_data_for_pieces(*ti, path, have), 0);
+
+	    lua_pushstring(L, "resume_data");
+	    lua_pushlstring(L, data.data(), data.size());
+	    lua_settable(L, -3);
+	}
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * stats = index:stats()
+ *
+ *   returns a table with the number of torrents and files indexed
+ */
+static int torrent_cross_seed_stats(lua_State *L) {
+    cross_seed_index *ci = torrent_cross_seed_check(L, 1);
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_INT("torrents", ci->torrents());
+    LUA_PUSH_ATTRIB_INT("files", ci->files());
+
+    return 1;
+}
+
+/*
+ * __gc
+ */
+static int torrent_cross_seed_gc(lua_State *L) {
+    cross_seed_index **ci = (cross_seed_index **)luaL_checkudata(L, 1, "Torrent.CrossSeedIndex");
+
+    delete *ci;
+    *ci = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_cross_seed_methods[] = {
+    {"add", torrent_cross_seed_add},
+    {"remove", torrent_cross_seed_remove},
+    {"match", torrent_cross_seed_match},
+    {"link", torrent_cross_seed_link},
+    {"stats", torrent_cross_seed_stats},
+    {NULL, NULL}
+};
+
+static const luaL_Reg torrent_cross_seed_class_methods[] = {
+    {"New", torrent_cross_seed_new},
+    {NULL, NULL}
+};
+
+int torrent_cross_seed_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.CrossSeedIndex");
+    luaL_register(L, 0, torrent_cross_seed_methods);  
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_cross_seed_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    luaL_register(L, "Torrent.CrossSeedIndex", torrent_cross_seed_class_methods);  
+
+    return 1;
+}
@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <map>
+#include <set>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+
+#include <boost/thread/thread.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "session_ref.h"
+#include "buffer_ref.h"
+
+using namespace libtorrent;
+
+bool handle_read(handle_ref *ref, size_type offset, size_type length, buffer_data &data, char *error, size_t size);
+
+/* piece priorities inside the readahead window, libtorrent's highest */
+#define URGENT_PRIORITY 7
+#define READAHEAD_PRIORITY 6
+#define URGENT_PIECES 2
+
+/*
+ * file_reader
+ *
+ *   a read cursor over one file of a torrent. The pieces from the cursor
+ *   to readahead pieces past it get raised priorities (the first two the
+ *   highest) so the piece picker fetches them ahead of everything else,
+ *   and get their old priority back once the cursor leaves them behind.
+ *   libtorrent 0.13 has no piece deadlines, the tiers stand in for them.
+ *   Readers over the same pieces share the saved priorities through the
+ *   session, which restores a piece once the last of them moves on.
+ */
+struct file_reader {
+    handle_ref ref;
+    sha1_hash hash;
+    size_type begin;   /* the file's offset in the torrent */
+    size_type size;
+    size_type pos;
+    int readahead;
+    int piece_length;
+
+    std::set<int> raised;  /* window pieces this reader counts in session_state::raised */
+
+    file_reader(const handle_ref &r, const sha1_hash &h, size_type b, size_type s, int ra, int pl) 
+	: ref(r), hash(h), begin(b), size(s), pos(0), readahead(ra), piece_length(pl) {}
+};
+
+static file_reader *torrent_file_check(lua_State *L, int index) {
+    file_reader **f = (file_reader **)luaL_checkudata(L, index, "Torrent.File");
+
+    if (!*f)
+	luaL_error(L, "attempt to use a closed file");
+
+    return *f;
+}
+
+/* whether piece is downloaded, status.pieces as in handle:status() */
+static bool have_piece(const torrent_status &st, int piece) {
+    if (st.pieces)
+	return (*st.pieces)[piece];
+
+    return st.state == torrent_status::seeding;
+}
+
+/* raises piece p to priority, saving what it had if no other reader raised it */
+static void raise_piece(file_reader *f, int p, int priority) {
+    session_state *s = f->ref.ses.get();
+    boost::mutex::scoped_lock l(s->mutex);
+
+    std::pair<sha1_hash, int> key(f->hash, p);
+    std::map<std::pair<sha1_hash, int>, raised_piece>::iterator i = s->raised.find(key);
+
+    if (i == s->raised.end()) {
+	raised_piece r = { f->ref.handle.piece_priority(p), 0 };
+	i = s->raised.insert(std::make_pair(key, r)).first;
+    }
+
+    if (f->raised.insert(p).second)
+	i->second.readers++;
+
+    f->ref.handle.piece_priority(p, priority);
+}
+
+/* lets go of pieces, restoring those no other reader holds */
+static void release_pieces(file_reader *f, const std::vector<int> &pieces) {
+    session_state *s = f->ref.ses.get();
+    boost::mutex::scoped_lock l(s->mutex);
+
+    std::vector<std::pair<int, int> > restore;
+
+    for (size_t n = 0; n < pieces.size(); n++) {
+	std::map<std::pair<sha1_hash, int>, raised_piece>::iterator i = s->raised.find(std::make_pair(f->hash, pieces[n]));
+
+	f->raised.erase(pieces[n]);
+
+	if (i != s->raised.end() && --i->second.readers == 0) {
+	    restore.push_back(std::make_pair(pieces[n], i->second.priority));
+	    s->raised.erase(i);
+	}
+    }
+
+    /* under the lock, so a reader raising one of them again saves the old priority */
+    for (size_t n = 0; n < restore.size(); n++)
+	f->ref.handle.piece_priority(restore[n].first, restore[n].second);
+}
+
+/* moves the priority window to the cursor, throws like the handle */
+static void update_window(file_reader *f, const torrent_status &st) {
+    int first = -1, last = -2;
+
+    if (f->pos < f->size) {
+	size_type end = std::min(f->begin + f->size, f->begin + f->pos + (size_type)f->readahead * f->piece_length);
+
+	first = (int)((f->begin + f->pos) / f->piece_length);
+	last = (int)((end - 1) / f->piece_length);
+    }
+
+    std::vector<int> behind;
+
+    for (std::set<int>::iterator i = f->raised.begin(); i != f->raised.end(); ++i) {
+	if (*i < first || *i > last)
+	    behind.push_back(*i);
+    }
+
+    release_pieces(f, behind);
+
+    for (int p = first; p <= last; p++) {
+	if (have_piece(st, p))
+	    continue;
+
+	raise_piece(f, p, p - first < URGENT_PIECES ? URGENT_PRIORITY : READAHEAD_PRIORITY);
+    }
+}
+
+static void restore_window(file_reader *f) {
+    release_pieces(f, std::vector<int>(f->raised.begin(), f->raised.end()));
+}
+
+/*
+ * file = handle:open_file(file_index, [readahead])
+ *
+ *   opens file_index (1 based, as info:file_at()) of the torrent for
+ *   streaming reads. readahead (default 8) is how many pieces past the
+ *   read cursor are fetched with raised priority
+ */
+int torrent_handle_open_file(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+    int index = luaL_checkint(L, 2);
+    int readahead = luaL_optint(L, 3, 8);
+
+    if (readahead < 1)
+	luaL_argerror(L, 3, "readahead must be at least 1");
+
+    file_reader *f = 0;
+
+    try {
+	const torrent_info &info = ref->handle.get_torrent_info();
+
+	if (index < 1 || index > info.num_files())
+	    luaL_argerror(L, 2, "no such file");
+
+	const file_entry &fe = info.file_at(index - 1);
+
+	f = new file_reader(*ref, info.info_hash(), fe.offset, fe.size, readahead, info.piece_length());
+	update_window(f, ref->handle.status());
+    } catch (std::exception& e) {
+	if (f) {
+	    try {
+		restore_window(f);
+	    } catch (std::exception&) {
+	    }
+	}
+
+	delete f;
+	luaL_error(L, "%s", e.what());
+    }
+
+    file_reader **ud = (file_reader **)lua_newuserdata(L, sizeof(file_reader *));
+    *ud = f;
+
+    luaL_getmetatable(L, "Torrent.File");
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+/*
+ * buffer = file:try_read(n)
+ *  OR
+ * false, piece_index = file:try_read(n)
+ *
+ *   up to n bytes from the cursor as a Torrent.Buffer, stopping short
+ *   at the first piece not downloaded yet, nil at the end of the file.
+ *   If not even one byte is there, returns false and the piece to wait
+ *   for. file:read() is built on it
+ */
+static int torrent_file_try_read(lua_State *L) {
+    file_reader *f = torrent_file_check(L, 1);
+    size_type n = (size_type)luaL_checknumber(L, 2);
+
+    if (n < 0)
+	luaL_argerror(L, 2, "negative read size");
+
+    if (f->pos >= f->size) {
+	lua_pushnil(L);
+	return 1;
+    }
+
+    size_type offset = f->begin + f->pos;
+    size_type length = std::min(n, f->size - f->pos);
+    int missing = -1;
+
+    try {
+	torrent_status st = f->ref.handle.status();
+
+	update_window(f, st);
+
+	/* trim to the pieces that are there */
+	int first = (int)(offset / f->piece_length);
+	int last = length ? (int)((offset + length - 1) / f->piece_length) : first - 1;
+
+	for (int p = first; p <= last; p++) {
+	    if (!have_piece(st, p)) {
+		missing = p;
+		length = (size_type)p * f->piece_length - offset;
+		break;
+	    }
+	}
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    if (length <= 0 && n > 0) {
+	lua_pushboolean(L, 0);
+	lua_pushinteger(L, missing);
+	return 2;
+    }
+
+    char error[256] = "";
+
+    {
+	buffer_data data;
+
+	if (handle_read(&f->ref, offset, length, data, error, sizeof(error))) {
+	    f->pos += length;
+	    torrent_buffer_push(L, data, 0, data->size());
+	}
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * arrived = file:wait(piece_index, [timeout_ms])
+ *
+ *   blocks until piece_index is downloaded or timeout_ms (default: no
+ *   limit) passes, returning whether it arrived
+ */
+static int torrent_file_wait(lua_State *L) {
+    file_reader *f = torrent_file_check(L, 1);
+    int piece = luaL_checkint(L, 2);
+    int timeout = luaL_optint(L, 3, -1);
+
+    int pieces = 0;
+    char error[256] = "";
+
+    try {
+	pieces = f->ref.handle.get_torrent_info().num_pieces();
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    if (piece < 0 || piece >= pieces)
+	luaL_argerror(L, 2, "no such piece");
+
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+    bool arrived = false;
+
+    try {
+	while (!(arrived = have_piece(f->ref.handle.status(), piece))) {
+	    if (timeout >= 0 && boost::get_system_time() >= deadline)
+		break;
+
+	    boost::thread::sleep(boost::get_system_time() + boost::posix_time::milliseconds(10));
+	}
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    lua_pushboolean(L, arrived);
+
+    return 1;
+}
+
+/*
+ * ready = file:ready()
+ *
+ *   whether file:read() would return without waiting
+ */
+static int torrent_file_ready(lua_State *L) {
+    file_reader *f = torrent_file_check(L, 1);
+    bool ready = true;
+
+    try {
+	if (f->pos < f->size)
+	    ready = have_piece(f->ref.handle.status(), (int)((f->begin + f->pos) / f->piece_length));
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    lua_pushboolean(L, ready);
+
+    return 1;
+}
+
+/*
+ * position = file:seek([whence, [offset]])
+ *
+ *   moves the cursor like io's file:seek, whence being "set", "cur" 
+ *   (default) or "end", and moves the priority window along with it
+ */
+static int torrent_file_seek(lua_State *L) {
+    static const char *const modes[] = {"set", "cur", "end", NULL};
+
+    file_reader *f = torrent_file_check(L, 1);
+    int whence = luaL_checkoption(L, 2, "cur", modes);
+    size_type offset = (size_type)luaL_optnumber(L, 3, 0);
+
+    size_type base = whence == 0 ? 0 : whence == 1 ? f->pos : f->size;
+
+    if (base + offset < 0) {
+	lua_pushnil(L);
+	lua_pushstring(L, "invalid seek position");
+	return 2;
+    }
+
+    size_type old = f->pos;
+    f->pos = base + offset;
+
+    if (f->pos != old) {
+	try {
+	    update_window(f, f->ref.handle.status());
+	} catch (std::exception& e) {
+	    luaL_error(L, "%s", e.what());
+	}
+    }
+
+    lua_pushnumber(L, f->pos);
+
+    return 1;
+}
+
+/*
+ * size = file:size()
+ */
+static int torrent_file_size(lua_State *L) {
+    file_reader *f = torrent_file_check(L, 1);
+
+    lua_pushnumber(L, f->size);
+
+    return 1;
+}
+
+/*
+ * file:close()
+ *
+ *   gives the window's pieces their old priorities back, also done when
+ *   the file is collected
+ */
+static int torrent_file_close(lua_State *L) {
+    file_reader **f = (file_reader **)luaL_checkudata(L, 1, "Torrent.File");
+
+    if (*f) {
+	try {
+	    restore_window(*f);
+	} catch (std::exception&) {
+	    /* the torrent went away, so did its priorities */
+	}
+
+	delete *f;
+	*f = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * buffer = file:read(n)
+ *
+ *   up to n bytes from the cursor, at least one, as a Torrent.Buffer,
+ *   nil at the end of the file. While the next piece is missing, a read
+ *   inside a coroutine yields (file, piece_index) to whoever resumed it,
+ *   and is retried when resumed; outside one it blocks in file:wait()
+ */
+static const char *reader_read = 
+    "local try_read = ...\n"
+    "return function(self, n)\n"
+    "    while true do\n"
+    "        local buf, piece = try_read(self, n)\n"
+    "        if buf ~= false then return buf end\n"
+    "        if coroutine.running() then\n"
+    "            coroutine.yield(self, piece)\n"
+    "        else\n"
+    "            self:wait(piece)\n"
+    "        end\n"
+    "    end\n"
+    "end\n";
+
+static const luaL_Reg torrent_file_methods[] = {
+    {"try_read", torrent_file_try_read},
+    {"wait", torrent_file_wait},
+    {"ready", torrent_file_ready},
+    {"seek", torrent_file_seek},
+    {"size", torrent_file_size},
+    {"close", torrent_file_close},
+    {NULL, NULL}
+};
+
+int torrent_file_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.File");
+    luaL_register(L, 0, torrent_file_methods);  
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_file_close);
+    lua_setfield(L, -2, "__gc"); 
+
+    if (luaL_loadstring(L, reader_read) != 0)
+	lua_error(L);
+
+    lua_pushcfunction(L, torrent_file_try_read);
+    lua_call(L, 1, 1);
+    lua_setfield(L, -2, "read");
+
+    return 1;
+}
@@ -34,6 +34,16 @@ extern "C" {
 #include <fstream>
 #include <iterator>
 #include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
@@ -45,10 +55,22 @@ extern "C" {
 #include "libtorrent/session.hpp"
 
 #include "utils.h"
+#include "resume.h"
+#include "session_ref.h"
+#include "storage.h"
+#include "memory_storage.h"
+#include "buffer_ref.h"
+#include "piece_cache.h"
+#include "move_job.h"
+#include "queue_manager.h"
 
 using namespace libtorrent;
 using namespace boost::filesystem;
 
+int torrent_history_push(lua_State *L, session_state *s, const sha1_hash *hash, int index);
+int torrent_handle_open_file(lua_State *L);
+void torrent_move_job_push(lua_State *L, move_job_ptr job);
+
 /*
  * status_table = handle:status()
  *
@@ -56,10 +78,7 @@ using namespace boost::filesystem;
  *  about this torrent
  */
 static int torrent_handle_status(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     torrent_status status = h->status();
 
@@ -115,10 +134,7 @@ static int torrent_handle_status(lua_State *L) {
  *  otherwise false
  */
 static int torrent_handle_is_seed(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushboolean(L, h->is_seed());
 
@@ -132,10 +148,7 @@ static int torrent_handle_is_seed(lua_State *L) {
  *  otherwise false
  */
 static int torrent_handle_is_paused(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushboolean(L, h->is_paused());
 
@@ -148,10 +161,7 @@ static int torrent_handle_is_paused(lua_State *L) {
  *  unconditionally pauses this torrent
  */
 static int torrent_handle_pause(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     h->pause();
 
@@ -165,10 +175,7 @@ static int torrent_handle_pause(lua_State *L) {
  *  the opposite of handle:pause()
  */
 static int torrent_handle_resume(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     h->resume();
 
@@ -181,10 +188,7 @@ static int torrent_handle_resume(lua_State *L) {
  *  forces this torrent to do another tracker request to receive new peers
  */
 static int torrent_handle_force_reannounce(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     h->force_reannounce();
 
@@ -196,10 +200,7 @@ static int torrent_handle_force_reannounce(lua_State *L) {
  *  returns the name of this torrent
  */
 static int torrent_handle_name(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushstring(L, h->name().c_str());
 
@@ -212,10 +213,7 @@ static int torrent_handle_name(lua_State *L) {
  *  limit the upload bandwidth used by this torrent to bytes_per_second
  */
 static int torrent_handle_set_upload_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     int limit = luaL_checkint(L, 2);
 
@@ -230,10 +228,7 @@ static int torrent_handle_set_upload_limit(lua_State *L) {
  *  limit the download bandwidth used by this torrent to bytes_per_second
  */
 static int torrent_handle_set_download_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     int limit = luaL_checkint(L, 2);
 
@@ -248,10 +243,7 @@ static int torrent_handle_set_download_limit(lua_State *L) {
  *  missing from libtorrent docs, deprecated?
  */
 static int torrent_handle_set_sequenced_download_threshold(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     int threshold = (int)lua_tonumber(L, 2);
 
@@ -266,10 +258,7 @@ static int torrent_handle_set_sequenced_download_threshold(lua_State *L) {
  *  sets the desired download / upload ratio. If set to 0, it is considered being infinite
  */
 static int torrent_handle_set_ratio(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     float up_down_ratio = (float)lua_tonumber(L, 2);
 
@@ -284,10 +273,7 @@ static int torrent_handle_set_ratio(lua_State *L) {
  *  returns the save path of this torrent
  */
 static int torrent_handle_save_path(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     boost::filesystem::path path = h->save_path();
 
@@ -303,10 +289,7 @@ static int torrent_handle_save_path(lua_State *L) {
  *  If you set this to -1, there will be no limit.
  */
 static int torrent_handle_set_max_uploads(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     int max_uploads = luaL_checkint(L, 2);
 
@@ -325,10 +308,7 @@ static int torrent_handle_set_max_uploads(lua_State *L) {
  *  If -1 is given to the function, it means unlimited.
  */
 static int torrent_handle_set_max_connections(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     int max_connections = luaL_checkint(L, 2);
 
@@ -345,10 +325,7 @@ static int torrent_handle_set_max_connections(lua_State *L) {
  *  the HTTP-request of the tracker announce.
  */
 static int torrent_handle_set_tracker_login(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     const char *username = lua_tostring(L, 2);
     const char *password = lua_tostring(L, 3);
@@ -364,10 +341,7 @@ static int torrent_handle_set_tracker_login(lua_State *L) {
  *  returns true if this torrent has metadata
  */
 static int torrent_handle_has_metadata(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushboolean(L, h->has_metadata());
 
@@ -380,10 +354,7 @@ static int torrent_handle_has_metadata(lua_State *L) {
  *  returns the torrent_info object associated with this torrent
  */
 static int torrent_handle_get_torrent_info(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     const torrent_info **ti = (const torrent_info **)lua_newuserdata(L, sizeof(torrent_info *));
     const torrent_info &info = h->get_torrent_info();
@@ -403,10 +374,7 @@ static int torrent_handle_get_torrent_info(lua_State *L) {
  *  or false if it hasn't been initialized or if the torrent it refers to has been aborted.
  */
 static int torrent_handle_is_valid(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushboolean(L, h->is_valid());
 
@@ -420,10 +388,7 @@ static int torrent_handle_is_valid(lua_State *L) {
  *  bytes downloaded of each file in this torrent.
  */
 static int torrent_handle_file_progress(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     std::vector<float> progress;
 
@@ -445,10 +410,7 @@ static int torrent_handle_file_progress(lua_State *L) {
  *  for each peer connected to this torrent
  */
 static int torrent_handle_get_peer_info(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     std::vector<peer_info> peers;
 
@@ -529,20 +491,146 @@ static int torrent_handle_get_download_queue(lua_State *L) {
 
 /*
  * handle:move_storage(newpath)
+ *  OR
+ * job = handle:move_storage(newpath, options)
  *
  *  moves the file(s) that this torrent are currently seeding from or downloading to.
+ *
+ *  with an options table the files are copied by a Torrent.MoveJob while
+ *  the torrent keeps seeding from where they are, and the torrent only
+ *  switches over once the copy is complete (see job:status(), 
+ *  session:moves()). Only disk backed torrents can be moved this way,
+ *  and newpath must not hold any of their files yet. options:
+ *    limit - bytes/second the copy may take from the disks, default no
+ *            limit (see job:set_limit())
  */
 static int torrent_handle_move_storage(lua_State *L) {
-    void* ud = 0;
+    if (!lua_istable(L, 3)) {
+	torrent_handle *h = torrent_handle_check(L, 1);
 
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+	boost::filesystem::path newpath(lua_tostring(L, 2)); 
+
+	h->move_storage(newpath);
 
-    boost::filesystem::path newpath(lua_tostring(L, 2)); 
+	return 0;
+    }
 
-    h->move_storage(newpath);
+    handle_ref *ref = torrent_handle_ref(L, 1);
+    const char *newpath = luaL_checkstring(L, 2);
+    long long limit = 0;
 
-    return 0;
+    lua_getfield(L, 3, "limit");
+    if (!lua_isnil(L, -1))
+	limit = (long long)luaL_checknumber(L, -1);
+    lua_pop(L, 1);
+
+    if (limit < 0)
+	luaL_argerror(L, 3, "limit must not be negative");
+
+    char error[256] = "";
+
+    try {
+	std::string to = complete(path(newpath)).string();
+
+	storage_slot_ptr slot = storage_find(ref->ses.get(), ref->handle.info_hash());
+
+	if (to == complete(ref->handle.save_path()).string())
+	    throw std::runtime_error("torrent is already there");
+	if (!slot)
+	    throw std::runtime_error("torrent has no storage yet");
+
+	move_job_ptr job(new move_job(ref->handle, slot, to, limit));
+
+	{
+	    boost::mutex::scoped_lock l(ref->ses->mutex);
+	    ref->ses->moves.push_back(job);
+	}
+
+	torrent_move_job_push(L, job);
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/* the session's queue manager, throwing if it has none */
+static boost::shared_ptr<queue_manager> handle_queue(handle_ref *ref) {
+    boost::shared_ptr<queue_manager> qm;
+    {
+	boost::mutex::scoped_lock l(ref->ses->mutex);
+	qm = ref->ses->queue;
+    }
+
+    if (!qm)
+	throw std::runtime_error("the session has no queue, see session:start_queue()");
+
+    return qm;
+}
+
+/*
+ * priority = handle:queue_priority([priority])
+ *
+ *   gets or sets where the session's queue manager ranks this torrent,
+ *   higher before lower (default 0)
+ */
+static int torrent_handle_queue_priority(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+    bool set = !lua_isnoneornil(L, 2);
+    int priority = set ? luaL_checkint(L, 2) : 0;
+
+    char error[256] = "";
+
+    try {
+	boost::shared_ptr<queue_manager> qm = handle_queue(ref);
+	sha1_hash hash = ref->handle.info_hash();
+
+	if (set)
+	    qm->set_priority(hash, priority);
+
+	lua_pushinteger(L, qm->priority(hash));
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * managed = handle:auto_managed([managed])
+ *
+ *   gets or sets whether the session's queue manager pauses and resumes
+ *   this torrent (default true)
+ */
+static int torrent_handle_auto_managed(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+    bool set = !lua_isnoneornil(L, 2);
+    bool managed = lua_toboolean(L, 2) != 0;
+
+    char error[256] = "";
+
+    try {
+	boost::shared_ptr<queue_manager> qm = handle_queue(ref);
+	sha1_hash hash = ref->handle.info_hash();
+
+	if (set)
+	    qm->set_managed(hash, managed);
+
+	lua_pushboolean(L, qm->managed(hash));
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
 }
 
 /*
@@ -551,10 +639,7 @@ static int torrent_handle_move_storage(lua_State *L) {
  *  returns the current limit setting for upload
  */
 static int torrent_handle_upload_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushinteger(L, h->upload_limit());
     return 1;
@@ -566,10 +651,7 @@ static int torrent_handle_upload_limit(lua_State *L) {
  *  returns the current limit setting for download
  */
 static int torrent_handle_download_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     lua_pushinteger(L, h->download_limit());
     return 1;
@@ -585,10 +667,7 @@ static int torrent_handle_download_limit(lua_State *L) {
 
 static int torrent_handle_piece_priority(lua_State *L) {
     int n = lua_gettop(L);
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     int index = luaL_checkinteger(L, 1);
 
@@ -610,10 +689,7 @@ static int torrent_handle_piece_priority(lua_State *L) {
  *  All the piece priorities will be updated with the priorities in the vector.
  */
 static int torrent_handle_prioritize_pieces(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     std::vector<int> pieces;
 
@@ -638,10 +714,7 @@ static int torrent_handle_prioritize_pieces(lua_State *L) {
  *  Each element is the current priority of that piece.
  */
 static int torrent_handle_piece_priorities(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     std::vector<int> pieces = h->piece_priorities();
 
@@ -661,10 +734,7 @@ static int torrent_handle_piece_priorities(lua_State *L) {
  *  files in the torrent. Each entry is the priority of that file.
  */
 static int torrent_handle_prioritize_files(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     std::vector<int> files;
 
@@ -688,10 +758,7 @@ static int torrent_handle_prioritize_files(lua_State *L) {
  *  send a scrape request to the tracker
  */
 static int torrent_handle_scrape_tracker(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     h->scrape_tracker();    
 
@@ -704,10 +771,7 @@ static int torrent_handle_scrape_tracker(lua_State *L) {
  *  sets the network interface this torrent will use when it opens outgoing connections
  */
 static int torrent_handle_use_interface(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     h->use_interface(luaL_checkstring(L, 2));
 
@@ -715,36 +779,522 @@ static int torrent_handle_use_interface(lua_State *L) {
 }
 
 /*
- * handle:write_resume_data(filepath)
+ * handle:write_resume_data(filepath, [level])
  *
- *  writes resume data to the file named filepath
+ *  writes resume data to the file named filepath, zlib compressed
+ *  at level (1-9) if given
  */
 static int torrent_handle_write_resume_data(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    torrent_handle *h = torrent_handle_check(L, 1);
 
     const char *filepath = luaL_checkstring(L, 2);
+    int level = luaL_optint(L, 3, 0);
 
-    ofstream out(complete(filepath), std::ios_base::binary);
+    try {
+	std::string data = resume_data_encode(h->write_resume_data(), level);
 
-    entry e = h->write_resume_data();
-    libtorrent::bencode(std::ostream_iterator<char>(out), e);
+	ofstream out(complete(filepath), std::ios_base::binary);
+	out.write(data.data(), data.size());
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
 
     return 0;
 }
 
+/*
+ * data = handle:resume_data([level])
+ *
+ *  returns the resume data for this torrent as a string, zlib compressed
+ *  at level (1-9) if given. The result can be passed back to 
+ *  session:add_torrent() as the resume_data option
+ */
+static int torrent_handle_resume_data(lua_State *L) {
+    torrent_handle *h = torrent_handle_check(L, 1);
+
+    int level = luaL_optint(L, 2, 0);
+
+    try {
+	std::string data = resume_data_encode(h->write_resume_data(), level);
+
+	lua_pushlstring(L, data.data(), data.size());
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * data = handle:memory_data([offset, [length]])
+ *
+ *   returns length bytes (default: up to the end) from offset (default
+ *   0) of a torrent added with storage = "memory", as laid out in the
+ *   torrent's files
+ */
+static int torrent_handle_memory_data(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+
+    size_type offset = (size_type)luaL_optnumber(L, 2, 0);
+    size_type length = (size_type)luaL_optnumber(L, 3, -1);
+
+    sha1_hash hash;
+
+    try {
+	hash = ref->handle.info_hash();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    storage_slot_ptr slot = storage_find(ref->ses.get(), hash);
+    std::string data;
+    bool found = false;
+
+    if (slot) {
+	boost::mutex::scoped_lock l(slot->mutex);
+	memory_storage *ms = dynamic_cast<memory_storage *>(slot->storage);
+
+	if (ms) {
+	    if (length < 0)
+		length = ms->size() - offset;
+
+	    if (offset >= 0 && length > 0 && offset < ms->size()) {
+		data.resize((size_t)std::min(length, ms->size() - offset));
+		data.resize(ms->copy_out(&data[0], offset, data.size()));
+	    }
+
+	    found = true;
+	}
+    }
+
+    if (!found)
+	luaL_error(L, "torrent is not in memory storage");
+
+    lua_pushlstring(L, data.data(), data.size());
+
+    return 1;
+}
+
+/*
+ * reads length bytes at offset of the torrent behind ref into a new
+ * buffer, a piece at a time through the torrent's registered storage.
+ * Returns false with data empty and error set instead of raising, so
+ * nothing that needs destroying is live when the caller does
+ */
+bool handle_read(handle_ref *ref, size_type offset, size_type length, buffer_data &data, char *error, size_t size) {
+    data.reset();
+
+    try {
+	const torrent_info &info = ref->handle.get_torrent_info();
+	torrent_status st = ref->handle.status();
+
+	if (offset < 0 || length < 0 || offset + length > info.total_size()) {
+	    snprintf(error, size, "range is outside the torrent");
+	    return false;
+	}
+
+	int first = (int)(offset / info.piece_length());
+	int last = length ? (int)((offset + length - 1) / info.piece_length()) : first - 1;
+
+	for (int p = first; p <= last; p++) {
+	    bool have = st.pieces ? (*st.pieces)[p] : st.state == torrent_status::seeding;
+
+	    if (!have) {
+		snprintf(error, size, "piece %d is not downloaded", p);
+		return false;
+	    }
+	}
+
+	storage_slot_ptr slot = storage_find(ref->ses.get(), info.info_hash());
+
+	if (!slot) {
+	    snprintf(error, size, "torrent has no readable storage");
+	    return false;
+	}
+
+	boost::mutex::scoped_lock l(slot->mutex);
+
+	if (!slot->storage) {
+	    snprintf(error, size, "torrent has no readable storage");
+	    return false;
+	}
+
+	data.reset(new std::vector<char>((size_t)length));
+
+	size_t pos = 0;
+
+	for (int p = first; p <= last; p++) {
+	    size_type piece_start = (size_type)p * info.piece_length();
+	    int start = (int)(std::max(offset, piece_start) - piece_start);
+	    int end = (int)(std::min(offset + length, piece_start + info.piece_size(p)) - piece_start);
+
+	    if (slot->storage->read(&(*data)[pos], p, start, end - start) != end - start) {
+		data.reset();
+		snprintf(error, size, "short read of piece %d", p);
+		return false;
+	    }
+
+	    pos += end - start;
+	}
+    } catch (std::exception& e) {
+	data.reset();
+	snprintf(error, size, "%s", e.what());
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * buffer = handle:read_piece(piece_index)
+ *
+ *   reads the downloaded piece piece_index (0 based, as piece_priority)
+ *   through the torrent's storage into a Torrent.Buffer. Works for disk,
+ *   uring and memory storage
+ */
+static int torrent_handle_read_piece(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+    int piece = luaL_checkint(L, 2);
+
+    size_type offset = 0, length = 0;
+    int pieces = 0;
+    char error[256] = "";
+
+    try {
+	const torrent_info &info = ref->handle.get_torrent_info();
+
+	pieces = info.num_pieces();
+
+	if (piece >= 0 && piece < pieces) {
+	    offset = (size_type)piece * info.piece_length();
+	    length = info.piece_size(piece);
+	}
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    luaL_argcheck(L, piece >= 0 && piece < pieces, 2, "no such piece");
+
+    {
+	buffer_data data;
+
+	if (handle_read(ref, offset, length, data, error, sizeof(error)))
+	    torrent_buffer_push(L, data, 0, data->size());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * buffer = handle:read_range(offset, length)
+ *
+ *   reads length bytes from offset into the torrent, as laid out in its
+ *   files, into a Torrent.Buffer. Every piece the range touches must be
+ *   downloaded
+ */
+static int torrent_handle_read_range(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+
+    size_type offset = (size_type)luaL_checknumber(L, 2);
+    size_type length = (size_type)luaL_checknumber(L, 3);
+    char error[256] = "";
+
+    {
+	buffer_data data;
+
+	if (handle_read(ref, offset, length, data, error, sizeof(error)))
+	    torrent_buffer_push(L, data, 0, data->size());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * checks that the pieces under length bytes at offset into file_index
+ * (1 based) are downloaded and on disk, flushing them from the write
+ * cache if need be and hashing those a seed mode torrent has not
+ * verified yet, and finds the file's path. Returns false with error
+ * set instead of raising
+ */
+static bool handle_file_range(handle_ref *ref, int file_index, size_type offset, size_type length, 
+    std::string &path, std::string &error) {
+    try {
+	const torrent_info &info = ref->handle.get_torrent_info();
+
+	if (file_index < 1 || file_index > info.num_files()) {
+	    error = "no such file";
+	    return false;
+	}
+
+	const file_entry &fe = info.file_at(file_index - 1);
+
+	if (offset < 0 || length <= 0 || offset + length > fe.size) {
+	    error = "range is outside the file";
+	    return false;
+	}
+
+	torrent_status st = ref->handle.status();
+	int first = (int)((fe.offset + offset) / info.piece_length());
+	int last = (int)((fe.offset + offset + length - 1) / info.piece_length());
+
+	for (int p = first; p <= last; p++) {
+	    bool have = st.pieces ? (*st.pieces)[p] : st.state == torrent_status::seeding;
+
+	    if (!have) {
+		std::ostringstream out;
+		out << "piece " << p << " is not downloaded";
+
+		error = out.str();
+		return false;
+	    }
+	}
+
+	storage_slot_ptr slot = storage_find(ref->ses.get(), info.info_hash());
+
+	if (slot) {
+	    boost::mutex::scoped_lock l(slot->mutex);
+
+	    if (dynamic_cast<memory_storage *>(slot->storage)) {
+		error = "torrent is in memory storage, use read_range():write()";
+		return false;
+	    }
+
+	    cached_storage *cs = dynamic_cast<cached_storage *>(slot->storage);
+
+	    if (cs) {
+		cs->flush_pieces(first, last);
+		cs->verify_pieces(first, last);
+	    }
+	}
+
+	path = (ref->handle.save_path() / fe.path).string();
+    } catch (std::exception& e) {
+	error = e.what();
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * sent = handle:send_range(target, file_index, offset, length)
+ *  OR
+ * nil, err, sent = handle:send_range(target, file_index, offset, length)
+ *
+ *   sends length bytes at offset into file file_index (1 based) of the
+ *   torrent to target (a socket fd, io file or luasocket socket) 
+ *   straight from the file with sendfile(), without the data passing
+ *   through Lua. Every piece under the range must be downloaded, and a
+ *   seed mode torrent hashes those it has not verified first. A
+ *   non-blocking socket that fills up fails with err "timeout" as 
+ *   buffer:write() does; send the rest from offset + sent
+ */
+static int torrent_handle_send_range(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+    int out = check_write_target(L, 2);
+    int file_index = luaL_checkint(L, 3);
+    size_type offset = (size_type)luaL_checknumber(L, 4);
+    size_type length = (size_type)luaL_checknumber(L, 5);
+
+    char error[256] = "";
+    int in = -1;
+
+    {
+	std::string path, message;
+
+	if (!handle_file_range(ref, file_index, offset, length, path, message))
+	    snprintf(error, sizeof(error), "%s", message.c_str());
+	else if ((in = ::open(path.c_str(), O_RDONLY)) < 0)
+	    snprintf(error, sizeof(error), "cannot open %s: %s", path.c_str(), strerror(errno));
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    off_t pos = offset;
+    size_type sent = 0;
+    int err = 0;
+
+    while (sent < length) {
+	size_t chunk = (size_t)std::min(length - sent, (size_type)(1 << 30));
+
+#ifdef __linux__
+	ssize_t w = sendfile(out, in, &pos, chunk);
+#else
+	char buf[64 * 1024];
+	ssize_t w = pread(in, buf, std::min(chunk, sizeof(buf)), pos);
+
+	if (w > 0) {
+	    w = ::write(out, buf, w);
+
+	    if (w > 0)
+		pos += w;
+	}
+#endif
+
+	if (w < 0 && errno == EINTR)
+	    continue;
+
+	if (w < 0) {
+	    err = errno;
+	    break;
+	}
+
+	if (w == 0) {
+	    err = -1;
+	    break;
+	}
+
+	sent += w;
+    }
+
+    ::close(in);
+
+    if (err) {
+	lua_pushnil(L);
+	lua_pushstring(L, err == -1 ? "file is shorter than the torrent says" : 
+	    err == EAGAIN || err == EWOULDBLOCK ? "timeout" : strerror(err));
+	lua_pushnumber(L, sent);
+
+	return 3;
+    }
+
+    lua_pushnumber(L, sent);
+
+    return 1;
+}
+
+/*
+ * handle:connect_peer(ip, port)
+ *
+ *   makes the torrent connect to the peer at ip:port, without waiting
+ *   for a tracker to hand it out
+ */
+static int torrent_handle_connect_peer(lua_State *L) {
+    torrent_handle *h = torrent_handle_check(L, 1);
+
+    const char *ip = luaL_checkstring(L, 2);
+    int port = luaL_checkint(L, 3);
+
+    try {
+	h->connect_peer(tcp::endpoint(address::from_string(ip), port));
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 0;
+}
+
+/*
+ * data, step = handle:history(field, window, [stat])
+ *
+ *   returns the values of field for this torrent over the last window
+ *   seconds as a string of packed native doubles, see session:history.
+ *   Returns nil until the sampler has recorded the torrent, which the
+ *   first call for it starts
+ */
+static int torrent_handle_history(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+
+    sha1_hash hash;
+
+    try {
+	hash = ref->handle.info_hash();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return torrent_history_push(L, ref->ses.get(), &hash, 2);
+}
+
+/*
+ * token = handle:token()
+ *
+ *   returns a string naming this torrent that can be passed to another
+ *   Lua state and turned back into a handle with Torrent.Handle.FromToken
+ */
+static int torrent_handle_token(lua_State *L) {
+    handle_ref *ref = torrent_handle_ref(L, 1);
+
+    try {
+	std::string token = session_token(ref->ses);
+
+	token.replace(0, token.find(':'), "luatorrent.handle");
+	token += ":" + info_hash_to_hex(ref->handle.info_hash());
+
+	lua_pushstring(L, token.c_str());
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * handle = Torrent.Handle.FromToken(token)
+ *
+ *   returns a handle for the torrent named by token, or nil if its
+ *   session no longer exists or the torrent has been removed
+ */
+static int torrent_handle_from_token(lua_State *L) {
+    const char *token = luaL_checkstring(L, 1);
+    const char *prefix = "luatorrent.handle:";
+    const char *sep = strrchr(token, ':');
+    sha1_hash hash;
+
+    if (strncmp(token, prefix, strlen(prefix)) != 0 || sep < token + strlen(prefix) 
+	|| !info_hash_from_hex(sep + 1, hash)) {
+	luaL_argerror(L, 1, "invalid handle token");
+    }
+
+    char error[256] = "";
+
+    try {
+	std::string id(token + strlen(prefix), sep);
+	session_ptr s = session_from_token("luatorrent.session:" + id);
+	torrent_handle h;
+
+	if (s)
+	    h = s->ses.find_torrent(hash);
+
+	if (h.is_valid())
+	    torrent_handle_push(L, h, s);
+	else
+	    lua_pushnil(L);
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
 /*
  * __gc
+ *
+ *   drops this handle and its reference to the session
  */
 static int torrent_handle_gc(lua_State *L) {
     void* ud = 0;
 
     ud = luaL_checkudata(L, 1, "Torrent.Handle");
-    torrent_handle *h = *((torrent_handle **)ud);
+    handle_ref **h = (handle_ref **)ud;
 
-    delete h;
+    delete *h;
+    *h = 0;
 
     return 0;
 }
@@ -790,6 +1340,15 @@ static const luaL_Reg torrent_handle_methods[] = {
 
     {"use_interface", torrent_handle_use_interface},
     {"write_resume_data", torrent_handle_write_resume_data}, 
+    {"resume_data", torrent_handle_resume_data},
+    {"token", torrent_handle_token},
+    {"history", torrent_handle_history},
+    {"connect_peer", torrent_handle_connect_peer},
+    {"memory_data", torrent_handle_memory_data},
+    {"read_piece", torrent_handle_read_piece},
+    {"read_range", torrent_handle_read_range},
+    {"open_file", torrent_handle_open_file},
+    {"send_range", torrent_handle_send_range},
 
 
 
@@ -798,6 +1357,8 @@ static const luaL_Reg torrent_handle_methods[] = {
     {"get_download_queue", torrent_handle_get_download_queue},
 
     {"move_storage", torrent_handle_move_storage},
+    {"queue_priority", torrent_handle_queue_priority},
+    {"auto_managed", torrent_handle_auto_managed},
     {"upload_limit", torrent_handle_upload_limit},
     {"download_limit", torrent_handle_download_limit},
 
@@ -815,6 +1376,9 @@ int torrent_handle_register(lua_State *L) {
 
     luaL_register(L, "Torrent.Handle", torrent_handle_methods);  
 
+    lua_pushcfunction(L, torrent_handle_from_token);
+    lua_setfield(L, -2, "FromToken");
+
     return 1;
 }
 
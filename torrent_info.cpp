@@ -50,12 +50,29 @@ extern "C" {
 
 
 #include "utils.h"
+#include "resume.h"
 
 using namespace libtorrent;
 using namespace boost::filesystem;
 
+/*
+ * info = Torrent.Info.New([filename])
+ *
+ *   loads the .torrent file filename, or creates an empty torrent to be
+ *   filled in with set_piece_size, add_file and generate_hashes
+ */
 static int torrent_info_new(lua_State *L) {
     try {
+	if (lua_isnoneornil(L, 1)) {
+	    torrent_info **ti = (torrent_info **)lua_newuserdata(L, sizeof(torrent_info *));
+	    *ti = new torrent_info();
+
+	    luaL_getmetatable(L, "Torrent.Info");
+	    lua_setmetatable(L, -2);
+
+	    return 1;
+	}
+
 	const char *filename = luaL_checkstring(L, 1);
 
 	std::ifstream in(filename, std::ios_base::binary);
@@ -387,12 +404,85 @@ static int torrent_info_set_piece_size(lua_State *L) {
     return 0;
 }
 
+/*
+ * info:set_hash(piece, hash)
+ *
+ *   sets the hash of piece (0 based, as piece_size) to hash, given
+ *   either as 40 hex digits or 20 raw bytes
+ */
 static int torrent_info_set_hash(lua_State *L) {
     void* ud = 0;
 
     ud = luaL_checkudata(L, 1, "Torrent.Info");
+    torrent_info *ti = *((torrent_info **)ud);
+
+    int index = luaL_checkint(L, 2);
+    size_t len = 0;
+    const char *hex = luaL_checklstring(L, 3, &len);
 
-    luaL_error(L, "Not implemented");
+    sha1_hash hash;
+
+    if (len == 20)
+	hash = sha1_hash(std::string(hex, len));
+    else if (!info_hash_from_hex(hex, hash))
+	luaL_argerror(L, 3, "expected 40 hex digits or 20 bytes");
+
+    luaL_argcheck(L, index >= 0 && index < ti->num_pieces(), 2, "piece index out of range");
+
+    ti->set_hash(index, hash);
+
+    return 0;
+}
+
+/*
+ * info:generate_hashes(root)
+ *
+ *   reads the torrent's files from below the directory root and sets
+ *   the hash of every piece, as needed before save_to_file for a 
+ *   torrent built with add_file
+ */
+static int torrent_info_generate_hashes(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.Info");
+    torrent_info *ti = *((torrent_info **)ud);
+
+    path root(luaL_checkstring(L, 2));
+
+    try {
+	std::vector<char> buf(ti->piece_length());
+	int piece = 0;
+	int fill = 0;
+
+	for (torrent_info::file_iterator i = ti->begin_files(); i != ti->end_files(); ++i) {
+	    boost::filesystem::ifstream in(root / i->path, std::ios_base::binary);
+
+	    if (!in)
+		throw std::runtime_error("cannot open " + (root / i->path).string());
+
+	    size_type left = i->size;
+
+	    while (left > 0) {
+		int want = std::min((size_type)(ti->piece_size(piece) - fill), left);
+
+		in.read(&buf[fill], want);
+
+		if (in.gcount() != want)
+		    throw std::runtime_error("short read from " + (root / i->path).string());
+
+		fill += want;
+		left -= want;
+
+		if (fill == ti->piece_size(piece)) {
+		    ti->set_hash(piece, hasher(&buf[0], fill).final());
+		    piece++;
+		    fill = 0;
+		}
+	    }
+	}
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
 
     return 0;
 }
@@ -412,6 +502,11 @@ static int torrent_info_add_tracker(lua_State *L) {
     return 0;
 }
 
+/*
+ * info:add_file(path, [size])
+ *
+ *   adds a file to the torrent, its size is taken from disk unless given
+ */
 static int torrent_info_add_file(lua_State *L) {
     void* ud = 0;
 
@@ -420,7 +515,10 @@ static int torrent_info_add_file(lua_State *L) {
 
     boost::filesystem::path fp(luaL_checkstring(L, 2));
 
-    ti->add_file(fp, file_size(fp));
+    if (lua_isnoneornil(L, 3))
+	ti->add_file(fp, file_size(fp));
+    else
+	ti->add_file(fp, (size_type)luaL_checknumber(L, 3));
 
     return 0;
 }
@@ -515,6 +613,7 @@ static const luaL_Reg torrent_info_methods[] = {
     {"set_creator", torrent_info_set_creator},
     {"set_piece_size", torrent_info_set_piece_size},
     {"set_hash", torrent_info_set_hash},
+    {"generate_hashes", torrent_info_generate_hashes},
     {"add_tracker", torrent_info_add_tracker},
     {"add_file", torrent_info_add_file},
     {"add_url_seed", torrent_info_add_url_seed},
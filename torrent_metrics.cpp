@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <iomanip>
+#include <cstdio>
+#include <set>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+#include "libtorrent/peer_info.hpp"
+
+#include "utils.h"
+#include "metrics.h"
+#include "session_ref.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define METRIC_ATOMIC_ADD(p, v) InterlockedExchangeAdd64((volatile LONGLONG *)(p), (v))
+#else
+#define METRIC_ATOMIC_ADD(p, v) __sync_fetch_and_add((p), (v))
+#endif
+
+using namespace libtorrent;
+
+#define HISTOGRAM_BUCKETS 24
+
+struct metric_def {
+    const char *name;
+    const char *type;
+    const char *help;
+};
+
+static const metric_def metric_defs[num_metrics] = {
+    {"luatorrent_sessions", "gauge", "Sessions currently alive"},
+    {"luatorrent_handles", "gauge", "Torrent.Handle objects currently alive"},
+    {"luatorrent_torrents_added_total", "counter", "Torrents added through the binding"},
+    {"luatorrent_torrents_removed_total", "counter", "Torrents removed through the binding"},
+    {"luatorrent_add_torrent_errors_total", "counter", "add_torrent calls that failed"},
+    {"luatorrent_resume_encoded_total", "counter", "Resume data records encoded"},
+    {"luatorrent_resume_encoded_bytes_total", "counter", "Bytes of resume data encoded"},
+    {"luatorrent_resume_store_commits_total", "counter", "Resume store batches written and fsynced"},
+    {"luatorrent_resume_store_compactions_total", "counter", "Resume store compactions"},
+    {"luatorrent_checkpoints_total", "counter", "Asynchronous checkpoints completed"},
+    {"luatorrent_checkpoint_saved_total", "counter", "Torrents saved by asynchronous checkpoints"},
+    {"luatorrent_checkpoint_errors_total", "counter", "Torrents that failed to save in a checkpoint"},
+    {"luatorrent_tracker_announces_total", "counter", "Announces served by embedded trackers"},
+    {"luatorrent_tracker_scrapes_total", "counter", "Scrapes served by embedded trackers"},
+    {"luatorrent_tracker_errors_total", "counter", "Invalid requests received by embedded trackers"},
+    {"luatorrent_memory_storage_bytes", "gauge", "Bytes mapped by memory backed torrent storage"},
+    {"luatorrent_read_cache_hits_total", "counter", "Block reads served from the seeding read cache"},
+    {"luatorrent_read_cache_misses_total", "counter", "Block reads that missed the seeding read cache"},
+    {"luatorrent_read_cache_bytes", "gauge", "Bytes held by seeding read caches"},
+    {"luatorrent_write_cache_bytes", "gauge", "Bytes of downloaded pieces buffered by write caches"},
+    {"luatorrent_write_cache_flushes_total", "counter", "Buffered pieces written to storage"},
+    {"luatorrent_disk_reads_total", "counter", "Reads cached storage passed on to the torrent's files"},
+    {"luatorrent_disk_read_bytes_total", "counter", "Bytes read from the torrent's files by cached storage"},
+    {"luatorrent_disk_writes_total", "counter", "Writes cached storage passed on to the torrent's files"},
+    {"luatorrent_disk_write_bytes_total", "counter", "Bytes written to the torrent's files by cached storage"},
+    {"luatorrent_fast_check_bytes_total", "counter", "Bytes hashed by add_torrent fast checks"},
+    {"luatorrent_seed_mode_verified_total", "counter", "Pieces of seed mode torrents verified on first upload"},
+    {"luatorrent_seed_mode_failures_total", "counter", "Pieces of seed mode torrents that failed verification"},
+    {"luatorrent_move_bytes_total", "counter", "Bytes copied by storage move jobs"},
+    {"luatorrent_move_errors_total", "counter", "Storage move jobs that failed"},
+    {"luatorrent_catalogue_dormant", "gauge", "Catalogue torrents not currently in a session"},
+    {"luatorrent_catalogue_activations_total", "counter", "Catalogue torrents added to their session"},
+    {"luatorrent_catalogue_evictions_total", "counter", "Catalogue torrents taken out of their session"},
+    {"luatorrent_queue_pauses_total", "counter", "Torrents paused by queue managers"},
+    {"luatorrent_queue_resumes_total", "counter", "Torrents resumed by queue managers"},
+};
+
+static const metric_def histogram_defs[num_histograms] = {
+    {"luatorrent_checkpoint_seconds", "histogram", "Time to encode and write an asynchronous checkpoint"},
+    {"luatorrent_resume_store_commit_seconds", "histogram", "Time to write and fsync a resume store batch"},
+};
+
+struct histogram {
+    long long buckets[HISTOGRAM_BUCKETS];
+    long long sum;
+    long long count;
+};
+
+static long long metric_values[num_metrics];
+static histogram histograms[num_histograms];
+
+void metric_add(metric_id m, long long v) {
+    METRIC_ATOMIC_ADD(&metric_values[m], v);
+}
+
+/*
+ * bucket i counts samples of at most 2^i microseconds, the last
+ * bucket also takes everything above
+ */
+void metric_observe(histogram_id h, long long us) {
+    int b = 0;
+
+    while (b < HISTOGRAM_BUCKETS - 1 && us > (1LL << b))
+	b++;
+
+    METRIC_ATOMIC_ADD(&histograms[h].buckets[b], 1);
+    METRIC_ATOMIC_ADD(&histograms[h].sum, us);
+    METRIC_ATOMIC_ADD(&histograms[h].count, 1);
+}
+
+/*
+ * per session metrics state, the set of peers seen at the last
+ * collection lets connection churn be counted between collections
+ */
+struct session_metrics {
+    boost::mutex mutex;
+    std::set<tcp::endpoint> peers;
+    long long opened;
+    long long closed;
+
+    session_metrics() : opened(0), closed(0) {}
+};
+
+enum session_metric_id {
+    sm_torrents,
+    sm_torrents_paused,
+    sm_torrents_checking,
+    sm_torrents_downloading,
+    sm_torrents_seeding,
+    sm_peers,
+    sm_seeds,
+    sm_connections,
+    sm_uploads,
+    sm_upload_rate,
+    sm_download_rate,
+    sm_payload_upload_rate,
+    sm_payload_download_rate,
+    sm_total_download,
+    sm_total_upload,
+    sm_total_payload_download,
+    sm_total_payload_upload,
+    sm_failed_bytes,
+    sm_redundant_bytes,
+    sm_peer_download_queue,
+    sm_peer_upload_queue,
+    sm_connections_opened,
+    sm_connections_closed,
+
+    num_session_metrics
+};
+
+static const metric_def session_metric_defs[num_session_metrics] = {
+    {"luatorrent_session_torrents", "gauge", "Torrents in the session"},
+    {"luatorrent_session_torrents_paused", "gauge", "Paused torrents"},
+    {"luatorrent_session_torrents_checking", "gauge", "Torrents queued for or checking files"},
+    {"luatorrent_session_torrents_downloading", "gauge", "Torrents downloading"},
+    {"luatorrent_session_torrents_seeding", "gauge", "Torrents finished or seeding"},
+    {"luatorrent_session_peers", "gauge", "Connected peers"},
+    {"luatorrent_session_seeds", "gauge", "Connected peers that are seeds"},
+    {"luatorrent_session_connections", "gauge", "Connections, including half-open ones"},
+    {"luatorrent_session_uploads", "gauge", "Unchoked peers"},
+    {"luatorrent_session_upload_rate_bytes", "gauge", "Upload rate in bytes per second"},
+    {"luatorrent_session_download_rate_bytes", "gauge", "Download rate in bytes per second"},
+    {"luatorrent_session_payload_upload_rate_bytes", "gauge", "Payload upload rate in bytes per second"},
+    {"luatorrent_session_payload_download_rate_bytes", "gauge", "Payload download rate in bytes per second"},
+    {"luatorrent_session_download_bytes_total", "counter", "Bytes downloaded"},
+    {"luatorrent_session_upload_bytes_total", "counter", "Bytes uploaded"},
+    {"luatorrent_session_payload_download_bytes_total", "counter", "Payload bytes downloaded"},
+    {"luatorrent_session_payload_upload_bytes_total", "counter", "Payload bytes uploaded"},
+    {"luatorrent_session_hash_failed_bytes_total", "counter", "Bytes downloaded that failed the hash check"},
+    {"luatorrent_session_redundant_bytes_total", "counter", "Bytes downloaded more than once"},
+    {"luatorrent_session_peer_download_queue", "gauge", "Blocks requested from peers and not yet received"},
+    {"luatorrent_session_peer_upload_queue", "gauge", "Blocks requested by peers and not yet sent"},
+    {"luatorrent_session_connections_opened_total", "counter", "Peer connections seen opening between collections"},
+    {"luatorrent_session_connections_closed_total", "counter", "Peer connections seen closing between collections"},
+};
+
+static void collect_session(session_state *s, double *v) {
+    session_status st = s->ses.status();
+
+    v[sm_connections] += s->ses.num_connections();
+    v[sm_uploads] += s->ses.num_uploads();
+    v[sm_upload_rate] += st.upload_rate;
+    v[sm_download_rate] += st.download_rate;
+    v[sm_payload_upload_rate] += st.payload_upload_rate;
+    v[sm_payload_download_rate] += st.payload_download_rate;
+    v[sm_total_download] += st.total_download;
+    v[sm_total_upload] += st.total_upload;
+    v[sm_total_payload_download] += st.total_payload_download;
+    v[sm_total_payload_upload] += st.total_payload_upload;
+
+    std::set<tcp::endpoint> peers;
+    std::vector<peer_info> info;
+    std::vector<torrent_handle> handles = s->ses.get_torrents();
+
+    for (std::vector<torrent_handle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
+	torrent_status ts = i->status();
+
+	v[sm_torrents] += 1;
+
+	if (ts.paused)
+	    v[sm_torrents_paused] += 1;
+
+	switch (ts.state) {
+	case torrent_status::queued_for_checking:
+	case torrent_status::checking_files:
+	case torrent_status::allocating:
+	    v[sm_torrents_checking] += 1;
+	    break;
+	case torrent_status::finished:
+	case torrent_status::seeding:
+	    v[sm_torrents_seeding] += 1;
+	    break;
+	default:
+	    v[sm_torrents_downloading] += 1;
+	    break;
+	}
+
+	v[sm_seeds] += ts.num_seeds;
+	v[sm_failed_bytes] += ts.total_failed_bytes;
+	v[sm_redundant_bytes] += ts.total_redundant_bytes;
+
+	i->get_peer_info(info);
+
+	for (std::vector<peer_info>::const_iterator p = info.begin(); p != info.end(); ++p) {
+	    v[sm_peer_download_queue] += p->download_queue_length;
+	    v[sm_peer_upload_queue] += p->upload_queue_length;
+
+	    peers.insert(p->ip);
+	}
+    }
+
+    v[sm_peers] += peers.size();
+
+    boost::shared_ptr<session_metrics> m;
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+
+	if (!s->metrics)
+	    s->metrics.reset(new session_metrics());
+
+	m = s->metrics;
+    }
+
+    boost::mutex::scoped_lock l(m->mutex);
+
+    for (std::set<tcp::endpoint>::const_iterator i = peers.begin(); i != peers.end(); ++i) {
+	if (m->peers.find(*i) == m->peers.end())
+	    m->opened++;
+    }
+
+    for (std::set<tcp::endpoint>::const_iterator i = m->peers.begin(); i != m->peers.end(); ++i) {
+	if (peers.find(*i) == peers.end())
+	    m->closed++;
+    }
+
+    m->peers.swap(peers);
+
+    v[sm_connections_opened] += m->opened;
+    v[sm_connections_closed] += m->closed;
+}
+
+/*
+ * a metric family and its samples, in the order they are rendered
+ */
+struct metric_family {
+    const metric_def *def;
+    std::vector<std::pair<std::string, double> > samples;
+};
+
+static std::string bucket_label(const char *name, int b) {
+    char buf[64];
+
+    if (b == HISTOGRAM_BUCKETS - 1)
+	return std::string(name) + "_bucket{le=\"+Inf\"}";
+
+    snprintf(buf, sizeof(buf), "_bucket{le=\"%.6f\"}", (1LL << b) / 1000000.0);
+
+    return name + std::string(buf);
+}
+
+/* raises for anything but a session from index onwards, before collect() builds anything */
+static void check_sessions(lua_State *L, int index) {
+    for (int i = index; i <= lua_gettop(L); i++)
+	torrent_session_state(L, i);
+}
+
+/*
+ * gathers the binding metrics, and the metrics of every Torrent.Session
+ * passed as an argument from index onwards (summed together), which
+ * check_sessions() has vouched for
+ */
+static void collect(lua_State *L, int index, std::vector<metric_family> &out) {
+    int n = lua_gettop(L);
+
+    for (int i = 0; i < num_metrics; i++) {
+	metric_family f;
+	f.def = &metric_defs[i];
+	f.samples.push_back(std::make_pair(std::string(f.def->name), (double)metric_values[i]));
+	out.push_back(f);
+    }
+
+    for (int i = 0; i < num_histograms; i++) {
+	metric_family f;
+	f.def = &histogram_defs[i];
+
+	const histogram &h = histograms[i];
+	long long cumulative = 0;
+
+	for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+	    cumulative += h.buckets[b];
+	    f.samples.push_back(std::make_pair(bucket_label(f.def->name, b), (double)cumulative));
+	}
+
+	f.samples.push_back(std::make_pair(std::string(f.def->name) + "_sum", h.sum / 1000000.0));
+	f.samples.push_back(std::make_pair(std::string(f.def->name) + "_count", (double)h.count));
+
+	out.push_back(f);
+    }
+
+    if (n < index)
+	return;
+
+    double v[num_session_metrics] = { 0 };
+
+    for (int i = index; i <= n; i++) {
+	collect_session(torrent_session_state(L, i), v);
+    }
+
+    for (int i = 0; i < num_session_metrics; i++) {
+	metric_family f;
+	f.def = &session_metric_defs[i];
+	f.samples.push_back(std::make_pair(std::string(f.def->name), v[i]));
+	out.push_back(f);
+    }
+}
+
+/*
+ * text = Torrent.Metrics.prometheus([session, ...])
+ *
+ *   returns the binding metrics, and the summed metrics of the given
+ *   sessions, in the Prometheus text exposition format
+ */
+static int torrent_metrics_prometheus(lua_State *L) {
+    check_sessions(L, 1);
+
+    char error[256] = "";
+
+    {
+	std::vector<metric_family> families;
+
+	try {
+	    collect(L, 1, families);
+	} catch (std::exception& e) {
+	    snprintf(error, sizeof(error), "%s", e.what());
+	}
+
+	if (!*error) {
+	    std::ostringstream out;
+	    char value[64];
+
+	    for (std::vector<metric_family>::const_iterator f = families.begin(); f != families.end(); ++f) {
+		out << "# HELP " << f->def->name << " " << f->def->help << "\n";
+		out << "# TYPE " << f->def->name << " " << f->def->type << "\n";
+
+		for (std::vector<std::pair<std::string, double> >::const_iterator s = f->samples.begin(); s != f->samples.end(); ++s) {
+		    snprintf(value, sizeof(value), "%.15g", s->second);
+		    out << s->first << " " << value << "\n";
+		}
+	    }
+
+	    std::string text = out.str();
+	    lua_pushlstring(L, text.data(), text.size());
+	}
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * data = Torrent.Metrics.snapshot([session, ...])
+ *
+ *   returns the same samples as prometheus() packed as native doubles, 
+ *   in the order given by Torrent.Metrics.names()
+ */
+static int torrent_metrics_snapshot(lua_State *L) {
+    check_sessions(L, 1);
+
+    char error[256] = "";
+
+    {
+	std::vector<metric_family> families;
+
+	try {
+	    collect(L, 1, families);
+	} catch (std::exception& e) {
+	    snprintf(error, sizeof(error), "%s", e.what());
+	}
+
+	if (!*error) {
+	    std::vector<double> values;
+
+	    for (std::vector<metric_family>::const_iterator f = families.begin(); f != families.end(); ++f) {
+		for (std::vector<std::pair<std::string, double> >::const_iterator s = f->samples.begin(); s != f->samples.end(); ++s) {
+		    values.push_back(s->second);
+		}
+	    }
+
+	    lua_pushlstring(L, values.empty() ? "" : (const char *)&values[0], values.size() * sizeof(double));
+	}
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * names = Torrent.Metrics.names([with_sessions])
+ *
+ *   returns the sample names of snapshot() in order, including the 
+ *   session samples if with_sessions is true
+ */
+static int torrent_metrics_names(lua_State *L) {
+    bool with_sessions = lua_toboolean(L, 1);
+
+    lua_settop(L, 0);
+
+    std::vector<metric_family> families;
+    collect(L, 1, families);
+
+    if (with_sessions) {
+	for (int i = 0; i < num_session_metrics; i++) {
+	    metric_family f;
+	    f.def = &session_metric_defs[i];
+	    f.samples.push_back(std::make_pair(std::string(f.def->name), 0.0));
+	    families.push_back(f);
+	}
+    }
+
+    int c = 1;
+    lua_newtable(L);
+
+    for (std::vector<metric_family>::const_iterator f = families.begin(); f != families.end(); ++f) {
+	for (std::vector<std::pair<std::string, double> >::const_iterator s = f->samples.begin(); s != f->samples.end(); ++s) {
+	    LUA_PUSH_ARRAY_STRING(c, s->first.c_str());
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * metrics = Torrent.Metrics.get([session, ...])
+ *
+ *   returns a table of sample name to value
+ */
+static int torrent_metrics_get(lua_State *L) {
+    check_sessions(L, 1);
+
+    char error[256] = "";
+
+    {
+	std::vector<metric_family> families;
+
+	try {
+	    collect(L, 1, families);
+	} catch (std::exception& e) {
+	    snprintf(error, sizeof(error), "%s", e.what());
+	}
+
+	if (!*error) {
+	    lua_newtable(L);
+
+	    for (std::vector<metric_family>::const_iterator f = families.begin(); f != families.end(); ++f) {
+		for (std::vector<std::pair<std::string, double> >::const_iterator s = f->samples.begin(); s != f->samples.end(); ++s) {
+		    LUA_PUSH_ATTRIB_FLOAT(s->first.c_str(), s->second);
+		}
+	    }
+	}
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+static const luaL_Reg torrent_metrics_class_methods[] = {
+    {"prometheus", torrent_metrics_prometheus},
+    {"snapshot", torrent_metrics_snapshot},
+    {"names", torrent_metrics_names},
+    {"get", torrent_metrics_get},
+    {NULL, NULL}
+};
+
+int torrent_metrics_register(lua_State *L) {
+    luaL_register(L, "Torrent.Metrics", torrent_metrics_class_methods);  
+
+    return 1;
+}
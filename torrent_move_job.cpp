@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "session_ref.h"
+#include "move_job.h"
+
+using namespace libtorrent;
+
+static move_job_ptr *torrent_move_job_check(lua_State *L, int index) {
+    return *((move_job_ptr **)luaL_checkudata(L, index, "Torrent.MoveJob"));
+}
+
+void torrent_move_job_push(lua_State *L, move_job_ptr job) {
+    move_job_ptr **ud = (move_job_ptr **)lua_newuserdata(L, sizeof(move_job_ptr *));
+    *ud = 0;
+
+    luaL_getmetatable(L, "Torrent.MoveJob");
+    lua_setmetatable(L, -2);
+
+    *ud = new move_job_ptr(job);
+}
+
+/* the table job:status() and session:moves() return for job */
+void torrent_move_job_status_push(lua_State *L, move_job &job) {
+    static const char *states[] = {"copying", "switching", "done", "failed", "cancelled"};
+
+    move_job::status st = job.get_status();
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_STRING("info_hash", info_hash_to_hex(job.info_hash()).c_str());
+    LUA_PUSH_ATTRIB_STRING("state", states[st.state]);
+    LUA_PUSH_ATTRIB_FLOAT("progress", st.total ? (double)st.moved / st.total : 1.0);
+    LUA_PUSH_ATTRIB_FLOAT("total", st.total);
+    LUA_PUSH_ATTRIB_FLOAT("moved", st.moved);
+    LUA_PUSH_ATTRIB_INT("files", st.files);
+    LUA_PUSH_ATTRIB_INT("files_done", st.files_done);
+    LUA_PUSH_ATTRIB_FLOAT("limit", st.limit);
+    LUA_PUSH_ATTRIB_FLOAT("seconds", st.seconds);
+    LUA_PUSH_ATTRIB_FLOAT("rate", st.seconds > 0 ? st.moved / st.seconds : 0);
+
+    if (!st.method.empty()) {
+	LUA_PUSH_ATTRIB_STRING("method", st.method.c_str());
+    }
+
+    if (!st.error.empty()) {
+	LUA_PUSH_ATTRIB_STRING("error", st.error.c_str());
+    }
+}
+
+/*
+ * status = job:status()
+ *
+ *   returns a table with:
+ *     info_hash - of the torrent being moved
+ *     state     - "copying", "switching" (to the new path), "done", 
+ *                 "failed" or "cancelled"
+ *     progress  - fraction of the bytes copied
+ *     total, moved - bytes to copy and copied so far
+ *     files, files_done - file counts
+ *     limit     - bytes/second the copy is held to, 0 for none
+ *     seconds, rate - time taken and bytes/second
+ *     method    - how the last bytes were copied: "clone", 
+ *                 "copy_file_range" or "buffer"
+ *     error     - why the job failed
+ */
+static int torrent_move_job_status(lua_State *L) {
+    move_job_ptr *job = torrent_move_job_check(L, 1);
+
+    torrent_move_job_status_push(L, **job);
+
+    return 1;
+}
+
+/*
+ * finished = job:wait([ms])
+ *
+ *   waits up to ms milliseconds (default: until it ends) for the job to
+ *   be done, failed or cancelled, returns whether it is
+ */
+static int torrent_move_job_wait(lua_State *L) {
+    move_job_ptr *job = torrent_move_job_check(L, 1);
+    int ms = luaL_optint(L, 2, -1);
+
+    lua_pushboolean(L, (*job)->wait(ms));
+
+    return 1;
+}
+
+/*
+ * job:cancel()
+ *
+ *   stops copying and removes the copies, the torrent stays where it
+ *   was. Too late once the job is switching
+ */
+static int torrent_move_job_cancel(lua_State *L) {
+    move_job_ptr *job = torrent_move_job_check(L, 1);
+
+    (*job)->cancel();
+
+    return 0;
+}
+
+/*
+ * job:set_limit(bytes_per_second)
+ *
+ *   changes how fast the job copies, 0 for as fast as it can
+ */
+static int torrent_move_job_set_limit(lua_State *L) {
+    move_job_ptr *job = torrent_move_job_check(L, 1);
+    long long limit = (long long)luaL_checknumber(L, 2);
+
+    if (limit < 0)
+	luaL_argerror(L, 2, "limit must not be negative");
+
+    (*job)->set_limit(limit);
+
+    return 0;
+}
+
+static int torrent_move_job_gc(lua_State *L) {
+    move_job_ptr **job = (move_job_ptr **)luaL_checkudata(L, 1, "Torrent.MoveJob");
+
+    delete *job;
+    *job = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_move_job_methods[] = {
+    {"status", torrent_move_job_status},
+    {"wait", torrent_move_job_wait},
+    {"cancel", torrent_move_job_cancel},
+    {"set_limit", torrent_move_job_set_limit},
+    {NULL, NULL}
+};
+
+int torrent_move_job_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.MoveJob");
+    luaL_register(L, 0, torrent_move_job_methods);  
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_move_job_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    return 1;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <string>
+
+#include "utils.h"
+#include "netemu.h"
+
+static netemu *torrent_netemu_check(lua_State *L, int index) {
+    netemu **e = (netemu **)luaL_checkudata(L, index, "Torrent.NetEmu");
+
+    if (!*e)
+	luaL_error(L, "network emulator has been closed");
+
+    return *e;
+}
+
+/*
+ * reads the link settings in the table at index over cfg
+ */
+static void netemu_config_from_table(lua_State *L, int index, netemu_config &cfg) {
+    if (!lua_istable(L, index))
+	return;
+
+    lua_getfield(L, index, "latency_ms");
+    if (!lua_isnil(L, -1))
+	cfg.latency_ms = luaL_checkint(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, index, "jitter_ms");
+    if (!lua_isnil(L, -1))
+	cfg.jitter_ms = luaL_checkint(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, index, "rate_kb");
+    if (!lua_isnil(L, -1))
+	cfg.rate = (int)(luaL_checknumber(L, -1) * 1024);
+    lua_pop(L, 1);
+
+    lua_getfield(L, index, "loss");
+    if (!lua_isnil(L, -1))
+	cfg.loss = luaL_checknumber(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, index, "rto_ms");
+    if (!lua_isnil(L, -1))
+	cfg.rto_ms = luaL_checkint(L, -1);
+    lua_pop(L, 1);
+
+    luaL_argcheck(L, cfg.latency_ms >= 0 && cfg.jitter_ms >= 0 && cfg.rate >= 0 && cfg.rto_ms >= 0, 
+	index, "link settings must not be negative");
+    luaL_argcheck(L, cfg.loss >= 0 && cfg.loss < 1, index, "loss must be between 0 and 1");
+}
+
+/*
+ * emu = Torrent.NetEmu.New([config])
+ *
+ *   starts a shaping proxy for test swarms. config is the default link
+ *   for every forward, a table which may contain:
+ *     latency_ms - one way delay
+ *     jitter_ms  - extra random delay of up to jitter_ms
+ *     rate_kb    - bandwidth cap in KB/s for each direction of a connection
+ *     loss       - fraction of chunks (0 to 1) that stall for a retransmission
+ *     rto_ms     - length of that stall, default 200
+ */
+static int torrent_netemu_new(lua_State *L) {
+    netemu_config cfg;
+
+    netemu_config_from_table(L, 1, cfg);
+
+    try {
+	netemu **e = (netemu **)lua_newuserdata(L, sizeof(netemu *));
+	*e = 0;
+
+	luaL_getmetatable(L, "Torrent.NetEmu");
+	lua_setmetatable(L, -2);
+
+	*e = new netemu(cfg);
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * local_port = emu:forward(port, [config])
+ *
+ *   listens on a free 127.0.0.1 port and relays every connection made
+ *   to it to port, shaped by config (which may also give the target
+ *   "host", default 127.0.0.1) over the emulator's defaults. Pass 
+ *   local_port to handle:connect_peer() instead of port
+ */
+static int torrent_netemu_forward(lua_State *L) {
+    netemu *e = torrent_netemu_check(L, 1);
+
+    int port = luaL_checkint(L, 2);
+    std::string host = "127.0.0.1";
+
+    netemu_config cfg = e->defaults();
+
+    netemu_config_from_table(L, 3, cfg);
+
+    if (lua_istable(L, 3)) {
+	lua_getfield(L, 3, "host");
+	if (!lua_isnil(L, -1))
+	    host = luaL_checkstring(L, -1);
+	lua_pop(L, 1);
+    }
+
+    try {
+	lua_pushinteger(L, e->forward(host, port, cfg));
+    } catch (std::exception& ex) {
+	luaL_error(L, "%s", ex.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * stats = emu:stats()
+ *
+ *   returns a table with the number of forwards, open connections,
+ *   total_connections, bytes relayed and simulated losses
+ */
+static int torrent_netemu_stats(lua_State *L) {
+    netemu *e = torrent_netemu_check(L, 1);
+
+    netemu_stats s = e->stats();
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_INT("forwards", s.forwards);
+    LUA_PUSH_ATTRIB_INT("connections", s.connections);
+    LUA_PUSH_ATTRIB_FLOAT("total_connections", s.total_connections);
+    LUA_PUSH_ATTRIB_FLOAT("bytes", s.bytes);
+    LUA_PUSH_ATTRIB_FLOAT("losses", s.losses);
+
+    return 1;
+}
+
+/*
+ * emu:close()
+ *
+ *   closes every forward and relayed connection
+ */
+static int torrent_netemu_close(lua_State *L) {
+    netemu **e = (netemu **)luaL_checkudata(L, 1, "Torrent.NetEmu");
+
+    delete *e;
+    *e = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_netemu_methods[] = {
+    {"forward", torrent_netemu_forward},
+    {"stats", torrent_netemu_stats},
+    {"close", torrent_netemu_close},
+    {NULL, NULL}
+};
+
+static const luaL_Reg torrent_netemu_class_methods[] = {
+    {"New", torrent_netemu_new},
+    {NULL, NULL}
+};
+
+int torrent_netemu_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.NetEmu");
+    luaL_register(L, 0, torrent_netemu_methods);  
+    lua_pushvalue(L,-1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_netemu_close);
+    lua_setfield(L, -2, "__gc"); 
+
+    luaL_register(L, "Torrent.NetEmu", torrent_netemu_class_methods);  
+
+    return 1;
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <boost/thread/mutex.hpp>
+
+#include "utils.h"
+
+/*
+ * Torrent.Profile
+ *
+ *   Opt-in instrumentation of the binding's methods. Enabling it replaces
+ *   every method in the class metatables below with a closure that calls
+ *   the original and records its wall time and the Lua memory allocated
+ *   meanwhile. Disabling it puts the original functions back, so there
+ *   is no cost at all while profiling is off.
+ *
+ *   Calls that raise a Lua error are not recorded.
+ */
+
+#define PROFILE_BUCKETS 48
+
+static const char *profiled_classes[] = {
+    "Torrent.Session",
+    "Torrent.Handle",
+    "Torrent.Info",
+    "Torrent.SessionPool",
+    "Torrent.ResumeStore",
+    "Torrent.Checkpoint",
+    "Torrent.Tracker",
+    "Torrent.NetEmu",
+    NULL
+};
+
+static const char *saved_key = "Torrent.Profile.saved";
+
+struct call_stats {
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long alloc_bytes;
+
+    /* bucket i counts calls taking [2^i, 2^(i+1)) nanoseconds */
+    unsigned long long buckets[PROFILE_BUCKETS];
+};
+
+/* keyed by "Class:method", map nodes never move so closures keep pointers */
+static std::map<std::string, call_stats> stats;
+static boost::mutex stats_mutex;
+
+static unsigned long long now_ns() {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+
+    return (unsigned long long)(count.QuadPart * (1000000000.0 / freq.QuadPart));
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static long long gc_bytes(lua_State *L) {
+    return (long long)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+static void record(call_stats *cs, unsigned long long ns, long long alloc) {
+    int b = 0;
+
+    while (b < PROFILE_BUCKETS - 1 && (ns >> (b + 1)) != 0)
+	b++;
+
+    boost::mutex::scoped_lock l(stats_mutex);
+
+    cs->calls++;
+    cs->total_ns += ns;
+    cs->buckets[b]++;
+
+    if (ns > cs->max_ns)
+	cs->max_ns = ns;
+
+    /* a collection during the call can make the difference negative */
+    if (alloc > 0)
+	cs->alloc_bytes += alloc;
+}
+
+static int profile_call(lua_State *L) {
+    call_stats *cs = (call_stats *)lua_touserdata(L, lua_upvalueindex(2));
+    int nargs = lua_gettop(L);
+
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+
+    long long mem = gc_bytes(L);
+    unsigned long long start = now_ns();
+
+    lua_call(L, nargs, LUA_MULTRET);
+
+    unsigned long long elapsed = now_ns() - start;
+
+    record(cs, elapsed, gc_bytes(L) - mem);
+
+    return lua_gettop(L);
+}
+
+/* upper bound of the bucket holding the p'th fraction of calls */
+static double percentile(const call_stats &cs, double p) {
+    unsigned long long want = (unsigned long long)(cs.calls * p + 0.5);
+    unsigned long long seen = 0;
+
+    if (want == 0)
+	want = 1;
+
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+	seen += cs.buckets[b];
+
+	if (seen >= want) {
+	    double upper = (double)(1ULL << (b + 1));
+	    return upper < cs.max_ns ? upper : cs.max_ns;
+	}
+    }
+
+    return cs.max_ns;
+}
+
+/*
+ * Torrent.Profile.enable()
+ *
+ *   starts recording calls into the binding's methods, the statistics 
+ *   already gathered are kept
+ */
+static int torrent_profile_enable(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, saved_key);
+
+    if (!lua_isnil(L, -1))
+	return 0;
+
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    int saved = lua_gettop(L);
+
+    for (const char **name = profiled_classes; *name; name++) {
+	luaL_getmetatable(L, *name);
+
+	if (!lua_istable(L, -1)) {
+	    lua_pop(L, 1);
+	    continue;
+	}
+
+	int mt = lua_gettop(L);
+
+	lua_newtable(L);
+	int originals = lua_gettop(L);
+
+	lua_pushnil(L);
+	while (lua_next(L, mt) != 0) {
+	    /* only methods, leave __gc and friends alone */
+	    if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1)
+		&& strncmp(lua_tostring(L, -2), "__", 2) != 0) {
+		std::string key = std::string(*name) + ":" + lua_tostring(L, -2);
+
+		call_stats *cs;
+		{
+		    boost::mutex::scoped_lock l(stats_mutex);
+		    std::map<std::string, call_stats>::iterator i = stats.find(key);
+
+		    if (i == stats.end()) {
+			call_stats empty;
+			memset(&empty, 0, sizeof(empty));
+			i = stats.insert(std::make_pair(key, empty)).first;
+		    }
+
+		    cs = &i->second;
+		}
+
+		/* originals[method] = function */
+		lua_pushvalue(L, -2);
+		lua_pushvalue(L, -2);
+		lua_settable(L, originals);
+
+		/* mt[method] = closure(function, stats) */
+		lua_pushvalue(L, -2);
+		lua_pushvalue(L, -2);
+		lua_pushlightuserdata(L, cs);
+		lua_pushcclosure(L, profile_call, 2);
+		lua_settable(L, mt);
+	    }
+
+	    lua_pop(L, 1);
+	}
+
+	lua_setfield(L, saved, *name);
+	lua_pop(L, 1);
+    }
+
+    lua_setfield(L, LUA_REGISTRYINDEX, saved_key);
+
+    return 0;
+}
+
+/*
+ * Torrent.Profile.disable()
+ *
+ *   restores the original methods, statistics are kept until reset()
+ */
+static int torrent_profile_disable(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, saved_key);
+
+    if (lua_isnil(L, -1))
+	return 0;
+
+    int saved = lua_gettop(L);
+
+    lua_pushnil(L);
+    while (lua_next(L, saved) != 0) {
+	int originals = lua_gettop(L);
+
+	luaL_getmetatable(L, lua_tostring(L, -2));
+	int mt = lua_gettop(L);
+
+	lua_pushnil(L);
+	while (lua_next(L, originals) != 0) {
+	    lua_pushvalue(L, -2);
+	    lua_insert(L, -2);
+	    lua_settable(L, mt);
+	}
+
+	lua_pop(L, 2);
+    }
+
+    lua_pushnil(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, saved_key);
+
+    return 0;
+}
+
+/*
+ * enabled = Torrent.Profile.enabled()
+ */
+static int torrent_profile_enabled(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, saved_key);
+    lua_pushboolean(L, !lua_isnil(L, -1));
+
+    return 1;
+}
+
+/*
+ * seconds = Torrent.Profile.clock()
+ *
+ *   returns a monotonic time in seconds with nanosecond resolution, for
+ *   timing Lua code alongside the recorded calls
+ */
+static int torrent_profile_clock(lua_State *L) {
+    lua_pushnumber(L, now_ns() / 1e9);
+
+    return 1;
+}
+
+/*
+ * Torrent.Profile.reset()
+ *
+ *   clears all recorded statistics
+ */
+static int torrent_profile_reset(lua_State *L) {
+    boost::mutex::scoped_lock l(stats_mutex);
+
+    for (std::map<std::string, call_stats>::iterator i = stats.begin(); i != stats.end(); ++i)
+	memset(&i->second, 0, sizeof(call_stats));
+
+    return 0;
+}
+
+/*
+ * report = Torrent.Profile.report()
+ *
+ *   returns a table keyed by "Class:method" of every method called since
+ *   the last reset, with the fields
+ *
+ *     calls, total_ns, mean_ns, max_ns, p50_ns, p90_ns, p99_ns, alloc_bytes
+ *
+ *   percentiles are the upper bound of a power of two bucket
+ */
+static int torrent_profile_report(lua_State *L) {
+    std::map<std::string, call_stats> copy;
+
+    {
+	boost::mutex::scoped_lock l(stats_mutex);
+	copy = stats;
+    }
+
+    lua_newtable(L);
+
+    for (std::map<std::string, call_stats>::const_iterator i = copy.begin(); i != copy.end(); ++i) {
+	const call_stats &cs = i->second;
+
+	if (cs.calls == 0)
+	    continue;
+
+	lua_pushstring(L, i->first.c_str());
+	lua_newtable(L);
+
+	LUA_PUSH_ATTRIB_FLOAT("calls", cs.calls);
+	LUA_PUSH_ATTRIB_FLOAT("total_ns", cs.total_ns);
+	LUA_PUSH_ATTRIB_FLOAT("mean_ns", (double)cs.total_ns / cs.calls);
+	LUA_PUSH_ATTRIB_FLOAT("max_ns", cs.max_ns);
+	LUA_PUSH_ATTRIB_FLOAT("p50_ns", percentile(cs, 0.50));
+	LUA_PUSH_ATTRIB_FLOAT("p90_ns", percentile(cs, 0.90));
+	LUA_PUSH_ATTRIB_FLOAT("p99_ns", percentile(cs, 0.99));
+	LUA_PUSH_ATTRIB_FLOAT("alloc_bytes", cs.alloc_bytes);
+
+	lua_settable(L, -3);
+    }
+
+    return 1;
+}
+
+/*
+ * text = Torrent.Profile.folded([root])
+ *
+ *   returns the statistics as folded stacks ("root;Class;method usecs"
+ *   per line) for flamegraph.pl and compatible tools. root defaults to
+ *   "lua"
+ */
+static int torrent_profile_folded(lua_State *L) {
+    const char *root = luaL_optstring(L, 1, "lua");
+
+    std::ostringstream out;
+
+    {
+	boost::mutex::scoped_lock l(stats_mutex);
+
+	for (std::map<std::string, call_stats>::const_iterator i = stats.begin(); i != stats.end(); ++i) {
+	    unsigned long long us = i->second.total_ns / 1000;
+
+	    if (us == 0)
+		continue;
+
+	    std::string frames = i->first;
+	    frames.replace(frames.find(':'), 1, ";");
+
+	    out << root << ";" << frames << " " << us << "\n";
+	}
+    }
+
+    std::string s = out.str();
+    lua_pushlstring(L, s.data(), s.size());
+
+    return 1;
+}
+
+static const luaL_Reg torrent_profile_class_methods[] = {
+    {"enable", torrent_profile_enable},
+    {"disable", torrent_profile_disable},
+    {"enabled", torrent_profile_enabled},
+    {"reset", torrent_profile_reset},
+    {"clock", torrent_profile_clock},
+    {"report", torrent_profile_report},
+    {"folded", torrent_profile_folded},
+    {NULL, NULL}
+};
+
+int torrent_profile_register(lua_State *L) {
+    luaL_register(L, "Torrent.Profile", torrent_profile_class_methods);  
+
+    return 1;
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <iomanip>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "resume_store.h"
+#include "session_ref.h"
+
+using namespace libtorrent;
+
+/*
+ * resolves the torrent argument at index to an info hash, either
+ * a Torrent.Handle or a 40 character hex info hash string
+ */
+static sha1_hash check_info_hash(lua_State *L, int index) {
+    sha1_hash hash;
+
+    if (lua_isuserdata(L, index)) {
+	torrent_handle *h = torrent_handle_check(L, index);
+
+	return h->info_hash();
+    }
+
+    if (!info_hash_from_hex(luaL_checkstring(L, index), hash))
+	luaL_argerror(L, index, "invalid info hash");
+
+    return hash;
+}
+
+/*
+ * store = Torrent.ResumeStore.Open(path)
+ *
+ *   opens (or creates) the resume data journal at path
+ */
+static int torrent_resume_store_open(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+
+    try {
+	resume_store **rs = (resume_store **)lua_newuserdata(L, sizeof(resume_store *));
+	*rs = 0;
+
+	luaL_getmetatable(L, "Torrent.ResumeStore");
+	lua_setmetatable(L, -2);
+
+	*rs = new resume_store(path);
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * store:put(handle, [level])
+ *  OR
+ * store:put(info_hash, data)
+ *
+ *   queues the resume data of handle (zlib compressed at level if given),
+ *   or the resume data string for info_hash, to be written by the next commit
+ */
+static int torrent_resume_store_put(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    sha1_hash hash = check_info_hash(L, 2);
+
+    try {
+	if (lua_isuserdata(L, 2)) {
+	    torrent_handle *h = torrent_handle_check(L, 2);
+
+	    rs->put(hash, resume_data_encode(h->write_resume_data(), luaL_optint(L, 3, 0)));
+	} else {
+	    size_t len = 0;
+	    const char *data = luaL_checklstring(L, 3, &len);
+
+	    rs->put(hash, std::string(data, len));
+	}
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 0;
+}
+
+/*
+ * data = store:get(info_hash)
+ *
+ *   returns the latest resume data stored for info_hash, or nil
+ */
+static int torrent_resume_store_get(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    sha1_hash hash = check_info_hash(L, 2);
+
+    try {
+	std::string data;
+
+	if (rs->get(hash, data))
+	    lua_pushlstring(L, data.data(), data.size());
+	else
+	    lua_pushnil(L);
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * store:remove(info_hash)
+ *
+ *   forgets the resume data for info_hash
+ */
+static int torrent_resume_store_remove(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    rs->remove(check_info_hash(L, 2));
+
+    return 0;
+}
+
+/*
+ * store:commit()
+ *
+ *   writes all queued records in one batch and fsyncs the journal
+ */
+static int torrent_resume_store_commit(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    try {
+	rs->commit();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 0;
+}
+
+/*
+ * store:compact()
+ *
+ *   rewrites the journal keeping only the latest record of each torrent
+ */
+static int torrent_resume_store_compact(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    try {
+	rs->compact();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 0;
+}
+
+/*
+ * count = store:save(session, [level])
+ *
+ *   queues the resume data of every torrent in session and commits,
+ *   returns the number of torrents saved
+ */
+static int torrent_resume_store_save(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    session *s = torrent_session_check(L, 2);
+
+    int level = luaL_optint(L, 3, 0);
+    int count = 0;
+
+    try {
+	std::vector<torrent_handle> handles = s->get_torrents();
+
+	for (std::vector<torrent_handle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
+	    if (!i->has_metadata())
+		continue;
+
+	    rs->put(i->info_hash(), resume_data_encode(i->write_resume_data(), level));
+	    count++;
+	}
+
+	rs->commit();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    lua_pushinteger(L, count);
+
+    return 1;
+}
+
+/*
+ * stats = store:stats()
+ *
+ *   returns a table with the number of torrents stored, the bytes
+ *   of live resume data and the size of the journal
+ */
+static int torrent_resume_store_stats(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_INT("count", rs->count());
+    LUA_PUSH_ATTRIB_FLOAT("live_bytes", rs->live_bytes());
+    LUA_PUSH_ATTRIB_FLOAT("file_bytes", rs->file_bytes());
+
+    return 1;
+}
+
+/*
+ * store:close()
+ *
+ *   commits any queued records and closes the journal
+ */
+static int torrent_resume_store_close(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    try {
+	rs->close();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 0;
+}
+
+/*
+ * __gc
+ */
+static int torrent_resume_store_gc(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.ResumeStore");
+    resume_store *rs = *((resume_store **)ud);
+
+    delete rs;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_resume_store_methods[] = {
+    {"put", torrent_resume_store_put},
+    {"get", torrent_resume_store_get},
+    {"remove", torrent_resume_store_remove},
+    {"commit", torrent_resume_store_commit},
+    {"compact", torrent_resume_store_compact},
+    {"save", torrent_resume_store_save},
+    {"stats", torrent_resume_store_stats},
+    {"close", torrent_resume_store_close},
+    {NULL, NULL}
+};
+
+static const luaL_Reg torrent_resume_store_class_methods[] = {
+    {"Open", torrent_resume_store_open},
+    {NULL, NULL}
+};
+
+int torrent_resume_store_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.ResumeStore");
+    luaL_register(L, 0, torrent_resume_store_methods);  
+    lua_pushvalue(L,-1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_resume_store_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    luaL_register(L, "Torrent.ResumeStore", torrent_resume_store_class_methods);  
+
+    return 1;
+}
@@ -35,16 +35,41 @@ extern "C" {
 #include <fstream>
 #include <iterator>
 #include <iomanip>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+
+#include <boost/bind.hpp>
+#include <boost/weak_ptr.hpp>
 
 #include "libtorrent/entry.hpp"
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/torrent_info.hpp"
 #include "libtorrent/session.hpp"
+#include "libtorrent/session_settings.hpp"
+#include "libtorrent/time.hpp"
 
 #include "utils.h"
+#include "resume.h"
+#include "resume_store.h"
+#include "session_ref.h"
+#include "metrics.h"
+#include "sampler.h"
+#include "storage.h"
+#include "memory_storage.h"
+#include "uring_storage.h"
+#include "piece_cache.h"
+#include "check_job.h"
+#include "move_job.h"
+#include "queue_manager.h"
 
 using namespace libtorrent;
 
+int torrent_session_checkpoint_async(lua_State *L);
+void torrent_check_job_push(lua_State *L, check_job_ptr job, session_ptr s);
+void torrent_check_job_status_push(lua_State *L, check_job &job);
+void torrent_move_job_status_push(lua_State *L, move_job &job);
+
 /*
  * session = Torrent.Session.New([first_port, last_port])
  *
@@ -53,20 +78,20 @@ using namespace libtorrent;
  */
 static int torrent_session_new(lua_State *L) {
     int n = lua_gettop(L);
+    int first = 0, last = 0;
 
-    try {
-	session **s = (session **)lua_newuserdata(L, sizeof(session *));
-	*s = new session();
+    if (n == 2) {
+	first = luaL_checkinteger(L, 1);
+	last = luaL_checkinteger(L, 2);
+    }
 
-	if (n == 2) {
-	    int first = luaL_checkinteger(L, 1);
-	    int last = luaL_checkinteger(L, 2);
+    try {
+	session_ptr s(new session_state());
 
-	    (*s)->listen_on(std::make_pair(first, last));
-	}
+	if (n == 2)
+	    s->ses.listen_on(std::make_pair(first, last));
 
-	luaL_getmetatable(L, "Torrent.Session");
-	lua_setmetatable(L, -2);
+	torrent_session_push(L, s);
     } catch (std::exception& e) {
 	luaL_error(L, "%s", e.what());
 	lua_pushnil(L);
@@ -81,10 +106,7 @@ static int torrent_session_new(lua_State *L) {
  *   destruct the session asynchronously
  */
 static int torrent_session_abort(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     s->abort();
 
@@ -92,59 +114,342 @@ static int torrent_session_abort(lua_State *L) {
 }
 
 /*
- * torrent_handle = session:add_torrent(torrent_info, [save_path, resume_data_file])
- *
- *   adds the torrent described by torrent_info to this session, to the save_path (default cwd)
- *   with fast resume file resume_data_file  
+ * the budget memory storages of s are charged to, created on first use
  */
-static int torrent_session_add_torrent(lua_State *L) {
+static storage_budget_ptr session_memory_budget(session_state *s) {
+    boost::mutex::scoped_lock l(s->mutex);
+
+    if (!s->memory_budget)
+	s->memory_budget.reset(new storage_budget);
+
+    return s->memory_budget;
+}
+
+/*
+ * the read cache disk backed storages of s go through, created on first use
+ */
+static piece_cache_ptr session_read_cache(session_state *s) {
+    boost::mutex::scoped_lock l(s->mutex);
+
+    if (!s->read_cache)
+	s->read_cache.reset(new piece_cache);
+
+    return s->read_cache;
+}
+
+/*
+ * the write cache disk backed storages of s buffer downloads in
+ */
+static write_cache_ptr session_write_cache(session_state *s) {
+    boost::mutex::scoped_lock l(s->mutex);
+
+    if (!s->write_back)
+	s->write_back.reset(new write_cache);
+
+    return s->write_back;
+}
+
+/*
+ * why the storage kind cannot be used, NULL if it can
+ */
+const char *torrent_storage_kind_error(const char *kind) {
+    if (strcmp(kind, "uring") == 0) {
+#ifndef USE_URING
+	return "built without io_uring support";
+#endif
+    } else if (strcmp(kind, "disk") != 0 && strcmp(kind, "memory") != 0) {
+	return "storage must be \"disk\", \"memory\" or \"uring\"";
+    }
+
+    return 0;
+}
+
+/*
+ * the storage_constructor for the storage kind named, a kind of NULL
+ * takes the session's default. Disk backed storages are wrapped in the
+ * session's read and write caches, so resizing them applies to every
+ * torrent. A seed_failed callback puts the cache in seed mode. Throws
+ * for a kind torrent_storage_kind_error() rejects
+ */
+static storage_constructor_type session_storage(session_state *s, const char *kind, 
+    boost::function<void()> seed_failed = boost::function<void()>()) {
+    storage_settings ss;
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	ss = s->storage;
+    }
+
+    std::string k = kind ? kind : ss.kind;
+    const char *error = torrent_storage_kind_error(k.c_str());
+
+    if (error)
+	throw std::invalid_argument(error);
+
+    if (k == "memory")
+	return boost::bind(&memory_storage_constructor, _1, _2, _3, 
+	    (const void *)s, session_memory_budget(s), ss.memory_hugepages);
+
+    storage_constructor_type storage = default_storage_constructor;
+
+    if (k == "uring")
+	storage = boost::bind(&uring_storage_constructor, _1, _2, _3, 
+	    ss.uring_queue_depth, ss.uring_direct);
+
+    return boost::bind(&cached_storage_constructor, _1, _2, _3, (const void *)s, storage, 
+	session_read_cache(s), session_write_cache(s), seed_failed);
+}
+
+/* session_storage for the other classes that add torrents to s */
+storage_constructor_type torrent_session_storage(session_state *s, const char *kind) {
+    return session_storage(s, kind);
+}
+
+/*
+ * rechecks a seed mode torrent that failed verification with a check_job
+ * that replaces it, re-adding it with plain storage and only the pieces
+ * it has. Runs on a thread of its own, see session_seed_failed
+ */
+static void session_recheck(boost::weak_ptr<session_state> ref, boost::intrusive_ptr<torrent_info> t, 
+    std::string path, storage_constructor_type storage) {
+    session_ptr s = ref.lock();
+
+    if (!s)
+	return;
+
+    try {
+	check_job_ptr job(new check_job(s->ses, t, path, storage, 
+	    std::max((int)boost::thread::hardware_concurrency(), 1), true));
+
+	boost::mutex::scoped_lock l(s->mutex);
+	s->checks.push_back(job);
+    } catch (std::exception&) {
+    }
+}
+
+/*
+ * called from the disk thread, under the storage's lock, when a piece of
+ * a seed mode torrent fails verification. The disk thread must never
+ * hold the last reference to the session, whose destructor would join
+ * it, so the recheck is started from a detached thread instead
+ */
+static void session_seed_failed(boost::weak_ptr<session_state> ref, boost::intrusive_ptr<torrent_info> t, 
+    std::string path, storage_constructor_type storage) {
+    try {
+	boost::thread(boost::bind(&session_recheck, ref, t, path, storage));
+    } catch (std::exception&) {
+    }
+}
+
+/*
+ * reads the torrent_info at index and the optional save_path and resume
+ * data file or options table that follow it. Shared by 
+ * session:add_torrent and Torrent.SessionPool, which call this before
+ * taking a session_ptr since it raises on bad arguments
+ */
+void torrent_session_add_options(lua_State *L, int index, add_torrent_options &o) {
     int n = lua_gettop(L);
     void* ud = 0;
 
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    ud = luaL_checkudata(L, index, "Torrent.Info");
+    o.info = *((torrent_info **)ud);
 
-    ud = luaL_checkudata(L, 2, "Torrent.Info");
-    torrent_info *ti = *((torrent_info **)ud);
+    o.save_path = "./";
+    o.resume_data = 0;
+    o.resume_len = 0;
+    o.resume_file = 0;
+    o.store = 0;
+    o.storage = 0;
+    o.fast_check = 0;
+    o.seed_mode = false;
 
-    boost::intrusive_ptr<torrent_info> t(ti);
+    int path_index = index + 1;
+    int options_index = index + 2;
 
-    try {
-	torrent_handle th;
+    if (n >= path_index && !lua_isnil(L, path_index)) {
+	o.save_path = luaL_checkstring(L, path_index);
+    }
 
-	if (n >= 3 && !lua_isnil(L, 3)) {
-	    const char *path = "./";
+    /* the options table keeps the strings alive */
+    if (n >= options_index && lua_istable(L, options_index)) {
+	lua_getfield(L, options_index, "resume_data");
+	if (!lua_isnil(L, -1)) {
+	    o.resume_data = luaL_checklstring(L, -1, &o.resume_len);
+	}
+	lua_pop(L, 1);
 
-	    if (!lua_isnil(L, 3)) {
-		path = luaL_checkstring(L, 3);
-	    }
-	    
-	    if (n == 4 && !lua_isnil(L, 4)) {
-		const char *filename = luaL_checkstring(L, 4);
+	lua_getfield(L, options_index, "resume_file");
+	if (!lua_isnil(L, -1)) {
+	    o.resume_file = luaL_checkstring(L, -1);
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, options_index, "resume_store");
+	if (!lua_isnil(L, -1)) {
+	    o.store = *((resume_store **)luaL_checkudata(L, -1, "Torrent.ResumeStore"));
+	}
+	lua_pop(L, 1);
 
-		std::ifstream in(filename, std::ios_base::binary);
-		in.unsetf(std::ios_base::skipws);
+	lua_getfield(L, options_index, "storage");
+	if (!lua_isnil(L, -1)) {
+	    o.storage = luaL_checkstring(L, -1);
+
+	    const char *error = torrent_storage_kind_error(o.storage);
+
+	    if (error)
+		luaL_argerror(L, options_index, error);
+	}
+	lua_pop(L, 1);
 
-		entry e = bdecode(std::istream_iterator<char>(in), std::istream_iterator<char>());
+	lua_getfield(L, options_index, "fast_check");
+	if (lua_isboolean(L, -1)) {
+	    o.fast_check = lua_toboolean(L, -1) ? std::max((int)boost::thread::hardware_concurrency(), 1) : 0;
+	} else if (!lua_isnil(L, -1)) {
+	    o.fast_check = luaL_checkint(L, -1);
 
-		th = s->add_torrent(t, path, e);
-	    } else {
-		th = s->add_torrent(t, path);
-	    }
-	} else {
-	    th = s->add_torrent(t, "./");
+	    if (o.fast_check < 1)
+		luaL_argerror(L, options_index, "fast_check must be true or a thread count");
 	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, options_index, "seed_mode");
+	o.seed_mode = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+
+	if (o.seed_mode && o.fast_check)
+	    luaL_argerror(L, options_index, "seed_mode and fast_check are exclusive");
+    } else if (n >= options_index && !lua_isnil(L, options_index)) {
+	o.resume_file = luaL_checkstring(L, options_index);
+    }
+}
+
+/*
+ * adds the torrent described by o to s, throws on failure. With the
+ * fast_check option the torrent is handed to a check_job instead,
+ * returned in job, and the returned handle is invalid
+ */
+torrent_handle torrent_session_add(session_ptr s, const add_torrent_options &o, check_job_ptr &job) {
+    boost::intrusive_ptr<torrent_info> t(o.info);
+    std::string path = o.save_path;
+    entry resume;
+
+    if (o.resume_data)
+	resume = resume_data_decode(o.resume_data, o.resume_len);
+
+    if (o.resume_file)
+	resume = resume_data_load_file(o.resume_file);
+
+    if (o.store) {
+	std::string data;
+
+	if (o.store->get(t->info_hash(), data))
+	    resume = resume_data_decode(data.data(), data.size());
+    }
+
+    storage_constructor_type storage = session_storage(s.get(), o.storage);
+
+    std::string kind;
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	kind = o.storage ? o.storage : s->storage.kind;
+    }
+
+    /* resume data the caller has beats assuming or checking */
+    if (o.seed_mode && resume.type() == entry::undefined_t) {
+	if (kind == "memory")
+	    throw std::invalid_argument("seed_mode needs data on disk");
+
+	resume = resume_data_for_pieces(*t, path, std::vector<bool>(t->num_pieces(), true));
+	storage = session_storage(s.get(), o.storage, 
+	    boost::bind(&session_seed_failed, boost::weak_ptr<session_state>(s), t, path, storage));
+    }
+
+    if (o.fast_check && resume.type() == entry::undefined_t) {
+	if (kind == "memory")
+	    throw std::invalid_argument("fast_check needs data on disk");
+
+	job.reset(new check_job(s->ses, t, path, storage, o.fast_check));
+
+	boost::mutex::scoped_lock l(s->mutex);
+	s->checks.push_back(job);
+
+	return torrent_handle();
+    }
+
+    try {
+	torrent_handle th = s->ses.add_torrent(t, path, resume, storage_mode_sparse, false, storage);
 
-	torrent_handle **h = (torrent_handle **)lua_newuserdata(L, sizeof(torrent_handle *));
-	*h = new torrent_handle(th);
+	metric_add(metric_torrents_added, 1);
 
-	luaL_getmetatable(L, "Torrent.Handle");
-	lua_setmetatable(L, -2);
+	return th;
+    } catch (std::exception&) {
+	metric_add(metric_add_torrent_errors, 1);
+	throw;
+    }
+}
+
+/*
+ * torrent_handle = session:add_torrent(torrent_info, [save_path, resume_data_file])
+ *  OR
+ * torrent_handle = session:add_torrent(torrent_info, save_path, options)
+ *
+ *   adds the torrent described by torrent_info to this session, to the save_path (default cwd)
+ *   with fast resume file resume_data_file  
+ *
+ *   options is a table which may contain:
+ *     resume_data  - resume data string as returned by handle:resume_data()
+ *     resume_file  - path of a fast resume file
+ *     resume_store - a Torrent.ResumeStore to look the resume data up in
+ *     storage      - "disk", "memory" to keep the torrent in RAM within
+ *                    the session's memory_storage_budget (see 
+ *                    handle:memory_data()) or "uring" for disk I/O through
+ *                    io_uring (make USE_URING=1). Defaults to the session's
+ *                    storage setting
+ *     fast_check   - true (a thread per core) or a thread count: hash the
+ *                    data already under save_path in parallel before
+ *                    adding the torrent, unless resume data was given.
+ *                    add_torrent then returns a Torrent.CheckJob whose
+ *                    handle() is the torrent once it has been added, see
+ *                    also session:checks()
+ *     seed_mode    - true to add the torrent as complete without reading
+ *                    its data, unless resume data was given. Each piece
+ *                    is verified the first time it is uploaded, and if
+ *                    one fails the torrent is removed and re-added once
+ *                    a parallel check (see session:checks()) has found
+ *                    the pieces it really has, invalidating old handles
+ */
+static int torrent_session_add_torrent(lua_State *L) {
+    torrent_session_state(L, 1);
+
+    add_torrent_options o;
+    torrent_session_add_options(L, 2, o);
+
+    char error[256] = "";
+
+    try {
+	session_ptr s = torrent_session_ref(L, 1);
+	check_job_ptr job;
+	torrent_handle th = torrent_session_add(s, o, job);
+
+	if (job)
+	    torrent_check_job_push(L, job, s);
+	else
+	    torrent_handle_push(L, th, s);
+
+	boost::shared_ptr<queue_manager> queue;
+	{
+	    boost::mutex::scoped_lock l(s->mutex);
+	    queue = s->queue;
+	}
+
+	if (queue)
+	    queue->wake();
     } catch (std::exception& e) {
-	luaL_error(L, "%s", e.what());
-	lua_pushnil(L);
+	snprintf(error, sizeof(error), "%s", e.what());
     }
 
+    if (*error)
+	luaL_error(L, "%s", error);
+
     return 1;
 }
 
@@ -154,24 +459,17 @@ static int torrent_session_add_torrent(lua_State *L) {
  *   returns an tables of handles associated with this session
  */
 static int torrent_session_torrent_handles(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session_ptr s = torrent_session_ref(L, 1);
 
     int c = 1;
     lua_newtable(L);
 
-    std::vector<torrent_handle> handles = (*s).get_torrents();
+    std::vector<torrent_handle> handles = s->ses.get_torrents();
 
     for (std::vector<torrent_handle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
 	lua_pushinteger(L, c);
 
-	torrent_handle **h = (torrent_handle **)lua_newuserdata(L, sizeof(torrent_handle *));
-	*h = new torrent_handle(*i);
-
-	luaL_getmetatable(L, "Torrent.Handle");
-	lua_setmetatable(L, -2);
+	torrent_handle_push(L, *i, s);
 
         lua_settable(L, -3);
         c++;
@@ -186,10 +484,7 @@ static int torrent_session_torrent_handles(lua_State *L) {
  *   returns a table describing the current session 
  */
 static int torrent_session_status(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     session_status status = s->status();
 
@@ -216,10 +511,7 @@ static int torrent_session_status(lua_State *L) {
  *   otherwise false
  */
 static int torrent_session_is_listening(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     lua_pushboolean(L, s->is_listening());
 
@@ -232,10 +524,7 @@ static int torrent_session_is_listening(lua_State *L) {
  *   returns the current listening port
  */
 static int torrent_session_listen_port(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     lua_pushinteger(L, s->listen_port());
 
@@ -248,10 +537,7 @@ static int torrent_session_listen_port(lua_State *L) {
  *   returns the number of currently unchoked peers 
  */
 static int torrent_session_num_uploads(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     lua_pushinteger(L, s->num_uploads());
 
@@ -264,10 +550,7 @@ static int torrent_session_num_uploads(lua_State *L) {
  *   returns the number of connections, including half-open ones
  */
 static int torrent_session_num_connections(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     lua_pushinteger(L, s->num_connections());
 
@@ -280,16 +563,12 @@ static int torrent_session_num_connections(lua_State *L) {
  *   removes the torrent in by torrent_handle from the session
  */
 static int torrent_session_remove_torrent(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
-
-    ud = luaL_checkudata(L, 2, "Torrent.Handle");
-    torrent_handle *th = *((torrent_handle **)ud);
+    session *s = torrent_session_check(L, 1);
+    torrent_handle *th = torrent_handle_check(L, 2);
 
     try {
 	s->remove_torrent(*th);
+	metric_add(metric_torrents_removed, 1);
     } catch (std::exception& e) {
         luaL_error(L, "%s", e.what());
     }
@@ -304,10 +583,7 @@ static int torrent_session_remove_torrent(lua_State *L) {
  *   returns the current session upload rate limit
  */
 static int torrent_session_upload_rate_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int url = s->upload_rate_limit();
     lua_pushinteger(L, url);
@@ -321,10 +597,7 @@ static int torrent_session_upload_rate_limit(lua_State *L) {
  *   returns the current session download rate limit
  */
 static int torrent_session_download_rate_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int drl = s->download_rate_limit();
 
@@ -339,10 +612,7 @@ static int torrent_session_download_rate_limit(lua_State *L) {
  *   sets the maximum number of bytes allowed to be sent to peers per second
  */
 static int torrent_session_set_upload_rate_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int bytes_per_second = luaL_checkinteger(L, 2);
     s->set_upload_rate_limit(bytes_per_second);
@@ -356,10 +626,7 @@ static int torrent_session_set_upload_rate_limit(lua_State *L) {
  *   sets the maximum number of bytes allowed to be downloaded from peers per second
  */
 static int torrent_session_set_download_rate_limit(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int bytes_per_second = luaL_checkinteger(L, 2);
     s->set_download_rate_limit(bytes_per_second);
@@ -374,10 +641,7 @@ static int torrent_session_set_download_rate_limit(lua_State *L) {
  *   for this session
  */
 static int torrent_session_set_max_uploads(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int limit = luaL_checkinteger(L, 2);
     s->set_max_uploads(limit);
@@ -392,10 +656,7 @@ static int torrent_session_set_max_uploads(lua_State *L) {
  *   have when connecting to peers
  */
 static int torrent_session_set_max_connections(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int limit = luaL_checkinteger(L, 2);
     s->set_max_connections(limit);
@@ -410,10 +671,7 @@ static int torrent_session_set_max_connections(lua_State *L) {
  *   have when connecting to peers
  */
 static int torrent_session_set_max_half_open_connections(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int limit = luaL_checkinteger(L, 2);
     s->set_max_half_open_connections(limit);
@@ -425,10 +683,7 @@ static int torrent_session_set_max_half_open_connections(lua_State *L) {
  * session:set_key(int)
  */
 static int torrent_session_set_key(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int key = luaL_checkinteger(L, 2);
     s->set_key(key);
@@ -442,10 +697,7 @@ static int torrent_session_set_key(lua_State *L) {
  *   changes the current listening port range to first_port to last_port
  */
 static int torrent_session_listen_on(lua_State *L) {
-    void* ud = 0;
-
-    ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session *s = torrent_session_check(L, 1);
 
     int start = luaL_checkinteger(L, 2);
     int end = luaL_checkinteger(L, 2);
@@ -455,18 +707,656 @@ static int torrent_session_listen_on(lua_State *L) {
     return 1;
 }
 
+/*
+ * the session_settings fields exposed by settings() and set_settings()
+ */
+#define SESSION_SETTINGS(STRING, INT, FLOAT, BOOL) \
+    STRING(user_agent) \
+    INT(tracker_completion_timeout) \
+    INT(tracker_receive_timeout) \
+    INT(stop_tracker_timeout) \
+    INT(tracker_maximum_response_length) \
+    INT(piece_timeout) \
+    FLOAT(request_queue_time) \
+    INT(max_allowed_in_request_queue) \
+    INT(max_out_request_queue) \
+    INT(whole_pieces_threshold) \
+    INT(peer_timeout) \
+    INT(urlseed_timeout) \
+    INT(urlseed_pipeline_size) \
+    INT(file_pool_size) \
+    BOOL(allow_multiple_connections_per_ip) \
+    INT(max_failcount) \
+    INT(min_reconnect_time) \
+    INT(peer_connect_timeout) \
+    BOOL(ignore_limits_on_local_network) \
+    INT(connection_speed) \
+    BOOL(send_redundant_have) \
+    BOOL(lazy_bitfields) \
+    INT(inactivity_timeout) \
+    INT(unchoke_interval) \
+    INT(num_want) \
+    INT(handshake_timeout)
+
+#define GET_STRING(f) LUA_PUSH_ATTRIB_STRING(#f, ss.f.c_str());
+#define GET_INT(f) LUA_PUSH_ATTRIB_INT(#f, ss.f);
+#define GET_FLOAT(f) LUA_PUSH_ATTRIB_FLOAT(#f, ss.f);
+#define GET_BOOL(f) LUA_PUSH_ATTRIB_BOOL(#f, ss.f);
+
+#define SET_FIELD(f, check) \
+    lua_getfield(L, 2, #f); \
+    if (!lua_isnil(L, -1)) \
+	ss.f = check; \
+    lua_pop(L, 1);
+
+#define SET_STRING(f) SET_FIELD(f, luaL_checkstring(L, -1))
+#define SET_INT(f) SET_FIELD(f, luaL_checkint(L, -1))
+#define SET_FLOAT(f) SET_FIELD(f, (float)luaL_checknumber(L, -1))
+#define SET_BOOL(f) SET_FIELD(f, lua_toboolean(L, -1) != 0)
+
+/*
+ * settings = session:settings()
+ *
+ *   returns a table of the session's settings, with the same keys as
+ *   libtorrent's session_settings, plus the binding's own:
+ *     memory_storage_budget   - bytes memory storage may use, 0 for no limit
+ *     memory_storage_hugepages - back memory storage with huge pages
+ *     memory_storage_used     - bytes memory storage uses now (read only)
+ *     storage                 - default storage for add_torrent, "disk"
+ *     uring_queue_depth       - io_uring submissions in flight per torrent
+ *     uring_direct            - read with O_DIRECT, bypassing the page cache
+ *     read_cache_size         - bytes of whole pieces kept in RAM for
+ *                               seeding, 0 (default) disables the cache,
+ *                               see session:cache_stats()
+ *     write_cache_size        - bytes of downloaded pieces buffered before
+ *                               they are written, 0 (default) writes
+ *                               each block as it arrives
+ *     write_cache_flush       - "complete" (default) writes a piece once
+ *                               it is hashed, "pressure" keeps hashed
+ *                               pieces until the write cache is full
+ */
+static int torrent_session_settings(lua_State *L) {
+    session_state *s = torrent_session_state(L, 1);
+
+    session_settings ss = s->ses.settings();
+
+    lua_newtable(L);
+
+    SESSION_SETTINGS(GET_STRING, GET_INT, GET_FLOAT, GET_BOOL)
+
+    /* copied out under the locks, a push that raises must not leave one held */
+    long long memory_limit, memory_used;
+
+    {
+	storage_budget_ptr budget = session_memory_budget(s);
+	boost::mutex::scoped_lock l(budget->mutex);
+
+	memory_limit = budget->limit;
+	memory_used = budget->used;
+    }
+
+    bool hugepages, uring_direct, flush_complete = true;
+    int uring_depth;
+    long long read_cache_size, write_cache_size = 0;
+    char kind[32];
+
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+
+	hugepages = s->storage.memory_hugepages;
+	snprintf(kind, sizeof(kind), "%s", s->storage.kind.c_str());
+	uring_depth = s->storage.uring_queue_depth;
+	uring_direct = s->storage.uring_direct;
+	read_cache_size = s->read_cache ? s->read_cache->limit() : 0;
+
+	if (s->write_back) {
+	    boost::mutex::scoped_lock wl(s->write_back->budget.mutex);
+
+	    write_cache_size = s->write_back->budget.limit;
+	    flush_complete = s->write_back->flush_complete;
+	}
+    }
+
+    LUA_PUSH_ATTRIB_FLOAT("memory_storage_budget", memory_limit);
+    LUA_PUSH_ATTRIB_FLOAT("memory_storage_used", memory_used);
+    LUA_PUSH_ATTRIB_BOOL("memory_storage_hugepages", hugepages);
+    LUA_PUSH_ATTRIB_STRING("storage", kind);
+    LUA_PUSH_ATTRIB_INT("uring_queue_depth", uring_depth);
+    LUA_PUSH_ATTRIB_BOOL("uring_direct", uring_direct);
+    LUA_PUSH_ATTRIB_FLOAT("read_cache_size", read_cache_size);
+    LUA_PUSH_ATTRIB_FLOAT("write_cache_size", write_cache_size);
+    LUA_PUSH_ATTRIB_STRING("write_cache_flush", flush_complete ? "complete" : "pressure");
+
+    return 1;
+}
+
+/*
+ * session:set_settings(settings)
+ *
+ *   changes the settings named in the table settings (see 
+ *   session:settings()), leaving the rest as they are
+ */
+static int torrent_session_set_settings(lua_State *L) {
+    session_state *s = torrent_session_state(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    session_settings ss = s->ses.settings();
+
+    SESSION_SETTINGS(SET_STRING, SET_INT, SET_FLOAT, SET_BOOL)
+
+    s->ses.set_settings(ss);
+
+    lua_getfield(L, 2, "memory_storage_budget");
+    if (!lua_isnil(L, -1)) {
+	long long limit = (long long)luaL_checknumber(L, -1);
+	storage_budget_ptr budget = session_memory_budget(s);
+
+	boost::mutex::scoped_lock l(budget->mutex);
+	budget->limit = limit;
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "memory_storage_hugepages");
+    if (!lua_isnil(L, -1)) {
+	boost::mutex::scoped_lock l(s->mutex);
+	s->storage.memory_hugepages = lua_toboolean(L, -1) != 0;
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "storage");
+    if (!lua_isnil(L, -1)) {
+	const char *kind = luaL_checkstring(L, -1);
+	const char *error = torrent_storage_kind_error(kind);
+
+	if (error)
+	    luaL_error(L, "%s", error);
+
+	boost::mutex::scoped_lock l(s->mutex);
+	s->storage.kind = kind;
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "uring_queue_depth");
+    if (!lua_isnil(L, -1)) {
+	int depth = luaL_checkint(L, -1);
+
+	if (depth < 1 || depth > 4096)
+	    luaL_error(L, "uring_queue_depth must be between 1 and 4096");
+
+	boost::mutex::scoped_lock l(s->mutex);
+	s->storage.uring_queue_depth = depth;
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "uring_direct");
+    if (!lua_isnil(L, -1)) {
+	boost::mutex::scoped_lock l(s->mutex);
+	s->storage.uring_direct = lua_toboolean(L, -1) != 0;
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "read_cache_size");
+    if (!lua_isnil(L, -1)) {
+	long long size = (long long)luaL_checknumber(L, -1);
+
+	if (size < 0)
+	    luaL_error(L, "read_cache_size must not be negative");
+
+	session_read_cache(s)->set_limit(size);
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "write_cache_size");
+    if (!lua_isnil(L, -1)) {
+	long long size = (long long)luaL_checknumber(L, -1);
+
+	if (size < 0)
+	    luaL_error(L, "write_cache_size must not be negative");
+
+	write_cache_ptr wc = session_write_cache(s);
+
+	boost::mutex::scoped_lock l(wc->budget.mutex);
+	wc->budget.limit = size;
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "write_cache_flush");
+    if (!lua_isnil(L, -1)) {
+	const char *policy = luaL_checkstring(L, -1);
+
+	if (strcmp(policy, "complete") != 0 && strcmp(policy, "pressure") != 0)
+	    luaL_error(L, "write_cache_flush must be \"complete\" or \"pressure\"");
+
+	write_cache_ptr wc = session_write_cache(s);
+
+	boost::mutex::scoped_lock l(wc->budget.mutex);
+	wc->flush_complete = strcmp(policy, "complete") == 0;
+    }
+    lua_pop(L, 1);
+
+    return 0;
+}
+
+/*
+ * checks = session:checks()
+ *
+ *   returns an array with the job:status() table of each fast_check
+ *   started in this session that is still running or finished since
+ *   the last call; finished ones are reported once
+ */
+static int torrent_session_checks(lua_State *L) {
+    session_ptr s = torrent_session_ref(L, 1);
+
+    std::list<check_job_ptr> jobs;
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	jobs = s->checks;
+    }
+
+    lua_newtable(L);
+    int n = 1;
+
+    for (std::list<check_job_ptr>::iterator i = jobs.begin(); i != jobs.end(); ++i) {
+	check_job::state_t state = (*i)->get_status().state;
+
+	torrent_check_job_status_push(L, **i);
+	lua_rawseti(L, -2, n++);
+
+	if (state != check_job::checking && state != check_job::adding) {
+	    boost::mutex::scoped_lock l(s->mutex);
+	    s->checks.remove(*i);
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * moves = session:moves()
+ *
+ *   returns an array with the job:status() table of each asynchronous
+ *   handle:move_storage() in this session that is still running or 
+ *   finished since the last call; finished ones are reported once
+ */
+static int torrent_session_moves(lua_State *L) {
+    session_ptr s = torrent_session_ref(L, 1);
+
+    std::list<move_job_ptr> jobs;
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	jobs = s->moves;
+    }
+
+    lua_newtable(L);
+    int n = 1;
+
+    for (std::list<move_job_ptr>::iterator i = jobs.begin(); i != jobs.end(); ++i) {
+	move_job::state_t state = (*i)->get_status().state;
+
+	torrent_move_job_status_push(L, **i);
+	lua_rawseti(L, -2, n++);
+
+	if (state != move_job::copying && state != move_job::switching) {
+	    boost::mutex::scoped_lock l(s->mutex);
+	    s->moves.remove(*i);
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * stats = session:cache_stats()
+ *
+ *   returns a table describing the seeding read cache:
+ *     hits, misses - block reads served from / missing the cache
+ *     hit_ratio    - hits / (hits + misses), 0 before any read
+ *     evictions    - pieces dropped to stay within the size
+ *     bytes, pieces - what the cache holds now
+ *     size         - the read_cache_size setting
+ *   and the write cache:
+ *     write_pending - bytes of pieces buffered and not yet written
+ *     write_flushes - buffered pieces written so far
+ *     write_size    - the write_cache_size setting
+ */
+static int torrent_session_cache_stats(lua_State *L) {
+    session_state *s = torrent_session_state(L, 1);
+
+    piece_cache::stats st = session_read_cache(s)->get_stats();
+    long long reads = st.hits + st.misses;
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_FLOAT("hits", st.hits);
+    LUA_PUSH_ATTRIB_FLOAT("misses", st.misses);
+    LUA_PUSH_ATTRIB_FLOAT("hit_ratio", reads ? (double)st.hits / reads : 0);
+    LUA_PUSH_ATTRIB_FLOAT("evictions", st.evictions);
+    LUA_PUSH_ATTRIB_FLOAT("bytes", st.bytes);
+    LUA_PUSH_ATTRIB_INT("pieces", st.pieces);
+    LUA_PUSH_ATTRIB_FLOAT("size", st.limit);
+
+    long long pending, flushes, size;
+
+    {
+	write_cache_ptr wc = session_write_cache(s);
+	boost::mutex::scoped_lock l(wc->budget.mutex);
+
+	pending = wc->budget.used;
+	flushes = wc->flushes;
+	size = wc->budget.limit;
+    }
+
+    LUA_PUSH_ATTRIB_FLOAT("write_pending", pending);
+    LUA_PUSH_ATTRIB_FLOAT("write_flushes", flushes);
+    LUA_PUSH_ATTRIB_FLOAT("write_size", size);
+
+    return 1;
+}
+
+/*
+ * alerted = session:wait_for_alert(ms)
+ *
+ *   blocks for up to ms milliseconds or until the session posts an 
+ *   alert, returns true in the latter case. Also handy as a sleep that 
+ *   does not spin the CPU
+ */
+static int torrent_session_wait_for_alert(lua_State *L) {
+    session *s = torrent_session_check(L, 1);
+
+    int ms = luaL_checkint(L, 2);
+
+    lua_pushboolean(L, s->wait_for_alert(libtorrent::milliseconds(ms)) != 0);
+
+    return 1;
+}
+
+/*
+ * session:start_sampler([interval_ms, [capacity]])
+ *
+ *   starts recording rate, peer and progress history for the session
+ *   every interval_ms (default 1000) milliseconds, keeping capacity 
+ *   (default 300) values per tier. A torrent is recorded too once
+ *   handle:history() has asked for it. Restarting the sampler discards
+ *   the history recorded so far
+ */
+static int torrent_session_start_sampler(lua_State *L) {
+    session_state *s = torrent_session_state(L, 1);
+
+    int interval = luaL_optint(L, 2, 1000);
+    int capacity = luaL_optint(L, 3, 300);
+
+    luaL_argcheck(L, interval > 0, 2, "interval must be positive");
+    luaL_argcheck(L, capacity > 0, 3, "capacity must be positive");
+
+    char error[256] = "";
+
+    try {
+	boost::shared_ptr<sampler> sm(new sampler(s->ses, interval, capacity));
+
+	boost::mutex::scoped_lock l(s->mutex);
+	s->history.swap(sm);
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 0;
+}
+
+/*
+ * session:stop_sampler()
+ *
+ *   stops the history sampler and frees the recorded history
+ */
+static int torrent_session_stop_sampler(lua_State *L) {
+    session_ptr s = torrent_session_ref(L, 1);
+
+    boost::shared_ptr<sampler> sm;
+
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	s->history.swap(sm);
+    }
+
+    return 0;
+}
+
+/*
+ * session:start_queue([options])
+ *
+ *   starts managing which torrents are active: at most downloads of the
+ *   torrents still downloading and seeds of the finished ones are left
+ *   running, the rest are paused, re-ranked every interval and whenever
+ *   a torrent is added. Queues are ordered by handle:queue_priority()
+ *   (highest first), then by rank, then by when the manager first saw
+ *   the torrent. Torrents set to handle:auto_managed(false) are left 
+ *   alone. options is a table which may contain:
+ *     downloads - active downloads, negative for no limit (default 3)
+ *     seeds     - active seeds, negative for no limit (default 5)
+ *     rank      - "ratio" (seeds that uploaded least first, the 
+ *                 default), "seed_peer" (seeds where seeds are fewest 
+ *                 per peer first, downloads where they are most), 
+ *                 "age" or "priority" (ranked by priority and age only)
+ *     interval  - milliseconds between re-rankings (default 1000)
+ *
+ *   Restarting the queue forgets the priorities set so far, see also
+ *   session:queue_alerts()
+ */
+static int torrent_session_start_queue(lua_State *L) {
+    static const char *ranks[] = {"ratio", "seed_peer", "age", "priority", NULL};
+
+    session_state *s = torrent_session_state(L, 1);
+    queue_manager::settings set;
+
+    if (lua_istable(L, 2)) {
+	lua_getfield(L, 2, "downloads");
+	set.downloads = luaL_optint(L, -1, set.downloads);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "seeds");
+	set.seeds = luaL_optint(L, -1, set.seeds);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "rank");
+	set.rank = (queue_manager::rank_t)luaL_checkoption(L, -1, "ratio", ranks);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "interval");
+	set.interval = luaL_optint(L, -1, set.interval);
+	lua_pop(L, 1);
+    }
+
+    luaL_argcheck(L, set.interval > 0, 2, "interval must be positive");
+
+    char error[256] = "";
+
+    try {
+	boost::shared_ptr<queue_manager> qm(new queue_manager(s->ses, set));
+
+	boost::mutex::scoped_lock l(s->mutex);
+	s->queue.swap(qm);
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 0;
+}
+
+/*
+ * session:stop_queue()
+ *
+ *   stops managing the active torrents, leaving each paused or running
+ *   as it is
+ */
+static int torrent_session_stop_queue(lua_State *L) {
+    session_ptr s = torrent_session_ref(L, 1);
+
+    boost::shared_ptr<queue_manager> qm;
+
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	s->queue.swap(qm);
+    }
+
+    return 0;
+}
+
+/*
+ * alerts = session:queue_alerts()
+ *
+ *   returns an array of what the queue manager did since the last call,
+ *   oldest first, each a table with:
+ *     info_hash - of the torrent
+ *     action    - "resumed" or "paused"
+ *     queue     - "download" or "seed"
+ *     position  - of the torrent in its queue (1 based)
+ *     reason    - a message
+ */
+static int torrent_session_queue_alerts(lua_State *L) {
+    session_ptr s = torrent_session_ref(L, 1);
+
+    boost::shared_ptr<queue_manager> qm;
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	qm = s->queue;
+    }
+
+    std::vector<queue_alert> alerts;
+
+    if (qm)
+	qm->pop_alerts(alerts);
+
+    lua_newtable(L);
+
+    for (size_t i = 0; i < alerts.size(); i++) {
+	lua_newtable(L);
+
+	LUA_PUSH_ATTRIB_STRING("info_hash", info_hash_to_hex(alerts[i].info_hash).c_str());
+	LUA_PUSH_ATTRIB_STRING("action", alerts[i].resumed ? "resumed" : "paused");
+	LUA_PUSH_ATTRIB_STRING("queue", alerts[i].seed ? "seed" : "download");
+	LUA_PUSH_ATTRIB_INT("position", alerts[i].position + 1);
+	LUA_PUSH_ATTRIB_STRING("reason", alerts[i].reason.c_str());
+
+	lua_rawseti(L, -2, i + 1);
+    }
+
+    return 1;
+}
+
+/*
+ * pushes the history of field (at index) over window seconds (index + 1)
+ * for the torrent with the given info hash, or the session if hash is
+ * null, as a string of packed doubles followed by the step in seconds.
+ * Shared by session:history and handle:history
+ */
+int torrent_history_push(lua_State *L, session_state *s, const sha1_hash *hash, int index) {
+    int field = history_field_from_name(luaL_checkstring(L, index));
+    double window = luaL_checknumber(L, index + 1);
+    int stat = history_stat_from_name(luaL_optstring(L, index + 2, "avg"));
+
+    if (field < 0)
+	luaL_argerror(L, index, "unknown history field");
+
+    luaL_argcheck(L, window > 0, index + 1, "window must be positive");
+
+    if (stat < 0)
+	luaL_argerror(L, index + 2, "expected avg, min or max");
+
+    boost::shared_ptr<sampler> sm;
+
+    {
+	boost::mutex::scoped_lock l(s->mutex);
+	sm = s->history;
+    }
+
+    if (!sm)
+	luaL_error(L, "sampler is not running");
+
+    std::vector<double> values;
+    double step = 0;
+
+    if (!sm->history(hash, field, window, stat, values, step)) {
+	lua_pushnil(L);
+	return 1;
+    }
+
+    lua_pushlstring(L, values.empty() ? "" : (const char *)&values[0], values.size() * sizeof(double));
+    lua_pushnumber(L, step);
+
+    return 2;
+}
+
+/*
+ * data, step = session:history(field, window, [stat])
+ *
+ *   returns the session wide values of field over the last window
+ *   seconds, oldest first, as a string of packed native doubles, and the
+ *   seconds between values. Longer windows are served from coarser
+ *   tiers (10x and 100x the sampling interval), where stat selects the
+ *   "avg" (default), "min" or "max" of each aggregate.
+ *
+ *   field is one of download_rate, upload_rate, download_payload_rate,
+ *   upload_payload_rate, num_peers, num_seeds or progress (the mean
+ *   progress of all torrents). Requires session:start_sampler()
+ */
+static int torrent_session_history(lua_State *L) {
+    session_state *s = torrent_session_state(L, 1);
+
+    return torrent_history_push(L, s, 0, 2);
+}
+
+/*
+ * token = session:token()
+ *
+ *   returns a string naming this session that can be passed to another
+ *   Lua state (e.g. a lane) and turned back into a session there with
+ *   Torrent.Session.FromToken. The token is valid while any state still
+ *   holds the session
+ */
+static int torrent_session_token(lua_State *L) {
+    session_ptr s = torrent_session_ref(L, 1);
+
+    lua_pushstring(L, session_token(s).c_str());
+
+    return 1;
+}
+
+/*
+ * session = Torrent.Session.FromToken(token)
+ *
+ *   returns a new reference to the session named by token, 
+ *   or nil if that session no longer exists
+ */
+static int torrent_session_from_token(lua_State *L) {
+    session_ptr s = session_from_token(luaL_checkstring(L, 1));
+
+    if (s)
+	torrent_session_push(L, s);
+    else
+	lua_pushnil(L);
+
+    return 1;
+}
+
 /*
  * __gc
  *
- *   frees session on GC
+ *   drops this reference to the session, the session is freed
+ *   once no state or handle refers to it any more
  */
 static int torrent_session_gc(lua_State *L) {
     void* ud = 0;
 
     ud = luaL_checkudata(L, 1, "Torrent.Session");
-    session *s = *((session **)ud);
+    session_ptr **s = (session_ptr **)ud;
 
-    delete s;
+    delete *s;
+    *s = 0;
 
     return 0;
 }
@@ -490,11 +1380,26 @@ static const luaL_Reg torrent_session_methods[] = {
     {"set_max_half_open_connections", torrent_session_set_max_half_open_connections},
     {"set_key", torrent_session_set_key},
     {"listen_on", torrent_session_listen_on},
+    {"checkpoint_async", torrent_session_checkpoint_async},
+    {"token", torrent_session_token},
+    {"start_sampler", torrent_session_start_sampler},
+    {"stop_sampler", torrent_session_stop_sampler},
+    {"history", torrent_session_history},
+    {"settings", torrent_session_settings},
+    {"set_settings", torrent_session_set_settings},
+    {"cache_stats", torrent_session_cache_stats},
+    {"checks", torrent_session_checks},
+    {"moves", torrent_session_moves},
+    {"start_queue", torrent_session_start_queue},
+    {"stop_queue", torrent_session_stop_queue},
+    {"queue_alerts", torrent_session_queue_alerts},
+    {"wait_for_alert", torrent_session_wait_for_alert},
     {NULL, NULL}
 };
 
 static const luaL_Reg torrent_session_class_methods[] = {
     {"New", torrent_session_new},
+    {"FromToken", torrent_session_from_token},
     {NULL, NULL}
 };
 
@@ -0,0 +1,803 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <iomanip>
+#include <cstdio>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "libtorrent/entry.hpp"
+#include "libtorrent/bencode.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/session.hpp"
+
+#include "utils.h"
+#include "session_ref.h"
+#include "check_job.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+void torrent_check_job_push(lua_State *L, check_job_ptr job, session_ptr s);
+
+/*
+ * session_pool
+ *
+ *   a set of sessions (shards) that torrents are spread over, each
+ *   shard runs its own network and disk threads. Global rate limits are
+ *   divided between the shards by rebalance(), which runs every
+ *   interval milliseconds on a background thread, when the limits change,
+ *   torrents are added or removed, or pool:rebalance() is called
+ */
+struct session_pool {
+    enum { place_hash, place_load };
+
+    std::vector<session_ptr> shards;
+    std::vector<int> torrents;
+    std::map<sha1_hash, int> placement;
+    int policy;
+    int upload_limit;   /* guarded by mutex */
+    int download_limit; /* guarded by mutex */
+    int interval;
+
+    boost::mutex mutex;
+    boost::condition cond;
+    bool stop;
+    boost::thread *thread;
+
+    session_pool() : policy(place_hash), upload_limit(0), download_limit(0), interval(5000), 
+	stop(false), thread(0) {}
+
+    ~session_pool() {
+	if (!thread)
+	    return;
+
+	{
+	    boost::mutex::scoped_lock l(mutex);
+	    stop = true;
+	    cond.notify_all();
+	}
+
+	thread->join();
+	delete thread;
+    }
+
+    /* once the shards are made, they are never added to or removed */
+    void start() {
+	if (interval > 0)
+	    thread = new boost::thread(boost::bind(&session_pool::run, this));
+    }
+
+    void run() {
+	boost::mutex::scoped_lock l(mutex);
+
+	while (!stop) {
+	    cond.timed_wait(l, boost::get_system_time() + boost::posix_time::milliseconds(interval));
+
+	    if (stop)
+		break;
+
+	    try {
+		rebalance_locked();
+	    } catch (std::exception &) {
+	    }
+	}
+    }
+
+    int place(const sha1_hash &hash) const {
+	if (policy == place_load) {
+	    int best = 0;
+
+	    for (size_t i = 1; i < torrents.size(); ++i) {
+		if (torrents[i] < torrents[best])
+		    best = i;
+	    }
+
+	    return best;
+	}
+
+	unsigned int h = ((unsigned int)hash[0] << 24) | ((unsigned int)hash[1] << 16) | 
+	    ((unsigned int)hash[2] << 8) | (unsigned int)hash[3];
+
+	return h % shards.size();
+    }
+
+    int shard_of(const sha1_hash &hash) const {
+	std::map<sha1_hash, int>::const_iterator i = placement.find(hash);
+
+	return i == placement.end() ? -1 : i->second;
+    }
+
+    void set_limits(int upload, int download) {
+	boost::mutex::scoped_lock l(mutex);
+
+	upload_limit = upload;
+	download_limit = download;
+	rebalance_locked();
+    }
+
+    void rebalance() {
+	boost::mutex::scoped_lock l(mutex);
+
+	rebalance_locked();
+    }
+
+    void rebalance_locked();
+};
+
+/*
+ * split a global limit between the shards in proportion to the rate
+ * each one is currently achieving. Every shard is guaranteed a quarter
+ * of an even split so an idle shard can ramp up again.
+ */
+static void split_limit(const std::vector<float> &rates, int limit, std::vector<int> &out) {
+    size_t n = rates.size();
+
+    out.assign(n, 0);
+
+    if (limit <= 0) {
+	return;
+    }
+
+    double floor = limit / (4.0 * n);
+    double total = 0;
+
+    for (size_t i = 0; i < n; ++i)
+	total += rates[i];
+
+    double spare = limit - floor * n;
+
+    for (size_t i = 0; i < n; ++i) {
+	double share = total > 0 ? spare * rates[i] / total : spare / n;
+
+	out[i] = (int)(floor + share);
+
+	if (out[i] < 1)
+	    out[i] = 1;
+    }
+}
+
+void session_pool::rebalance_locked() {
+    std::vector<float> up(shards.size()), down(shards.size());
+
+    for (size_t i = 0; i < shards.size(); ++i) {
+	session_status st = shards[i]->ses.status();
+
+	up[i] = st.upload_rate;
+	down[i] = st.download_rate;
+    }
+
+    std::vector<int> limits;
+
+    split_limit(up, upload_limit, limits);
+    for (size_t i = 0; i < shards.size(); ++i)
+	shards[i]->ses.set_upload_rate_limit(limits[i]);
+
+    split_limit(down, download_limit, limits);
+    for (size_t i = 0; i < shards.size(); ++i)
+	shards[i]->ses.set_download_rate_limit(limits[i]);
+}
+
+/*
+ * pool = Torrent.SessionPool.New(options)
+ *
+ *   creates a pool of sessions. options is a table which may contain:
+ *     shards     - number of sessions (default 1)
+ *     port_range - { first_port, last_port } divided between the shards
+ *     placement  - "hash" to place torrents by info hash (default), or
+ *                  "load" to place them on the shard with the fewest torrents
+ *     rebalance_interval - milliseconds between rate limit rebalances
+ *                  (default 5000), 0 to only rebalance on changes and
+ *                  pool:rebalance()
+ */
+static int torrent_session_pool_new(lua_State *L) {
+    int shards = 1;
+    int first = 0, last = 0;
+    int policy = session_pool::place_hash;
+    int interval = 5000;
+
+    if (lua_istable(L, 1)) {
+	lua_getfield(L, 1, "shards");
+	shards = luaL_optint(L, -1, 1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 1, "port_range");
+	if (lua_istable(L, -1)) {
+	    lua_rawgeti(L, -1, 1);
+	    first = luaL_checkint(L, -1);
+	    lua_pop(L, 1);
+
+	    lua_rawgeti(L, -1, 2);
+	    last = luaL_optint(L, -1, first);
+	    lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, 1, "placement");
+	if (!lua_isnil(L, -1)) {
+	    std::string p = luaL_checkstring(L, -1);
+
+	    if (p == "load")
+		policy = session_pool::place_load;
+	    else if (p != "hash")
+		luaL_error(L, "unknown placement '%s'", p.c_str());
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, 1, "rebalance_interval");
+	interval = luaL_optint(L, -1, 5000);
+	lua_pop(L, 1);
+    }
+
+    if (shards < 1)
+	luaL_error(L, "a session pool needs at least one shard");
+
+    if (interval < 0)
+	luaL_error(L, "rebalance_interval must not be negative");
+
+    session_pool **p = (session_pool **)lua_newuserdata(L, sizeof(session_pool *));
+    *p = new session_pool();
+
+    luaL_getmetatable(L, "Torrent.SessionPool");
+    lua_setmetatable(L, -2);
+
+    session_pool *pool = *p;
+    pool->policy = policy;
+    pool->interval = interval;
+
+    try {
+	int span = last >= first ? (last - first + 1) / shards : 0;
+
+	for (int i = 0; i < shards; i++) {
+	    session_ptr s(new session_state());
+
+	    pool->shards.push_back(s);
+	    pool->torrents.push_back(0);
+
+	    if (first > 0) {
+		int a = first + i * span;
+		int b = span > 1 ? a + span - 1 : a;
+
+		if (span == 0) {
+		    a = first;
+		    b = last;
+		}
+
+		s->ses.listen_on(std::make_pair(a, b));
+	    }
+	}
+
+	pool->start();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 1;
+}
+
+/*
+ * torrent_handle = pool:add_torrent(torrent_info, [save_path, resume_data_file | options])
+ *
+ *   adds the torrent to the shard chosen by the pool's placement policy,
+ *   takes the same arguments as session:add_torrent (and likewise returns
+ *   a Torrent.CheckJob for fast_check)
+ */
+static int torrent_session_pool_add_torrent(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    add_torrent_options o;
+    torrent_session_add_options(L, 2, o);
+
+    char error[256] = "";
+
+    try {
+	sha1_hash hash = o.info->info_hash();
+
+	int shard = pool->shard_of(hash);
+	if (shard < 0)
+	    shard = pool->place(hash);
+
+	check_job_ptr job;
+	torrent_handle th = torrent_session_add(pool->shards[shard], o, job);
+
+	if (pool->shard_of(hash) < 0) {
+	    pool->placement[hash] = shard;
+	    pool->torrents[shard]++;
+	}
+
+	pool->rebalance();
+
+	if (job)
+	    torrent_check_job_push(L, job, pool->shards[shard]);
+	else
+	    torrent_handle_push(L, th, pool->shards[shard]);
+    } catch (std::exception& e) {
+	snprintf(error, sizeof(error), "%s", e.what());
+    }
+
+    if (*error)
+	luaL_error(L, "%s", error);
+
+    return 1;
+}
+
+/*
+ * pool:remove_torrent(torrent_handle)
+ *
+ *   removes the torrent from the shard it was placed on
+ */
+static int torrent_session_pool_remove_torrent(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    torrent_handle *th = torrent_handle_check(L, 2);
+
+    try {
+	sha1_hash hash = th->info_hash();
+	int shard = pool->shard_of(hash);
+
+	if (shard < 0)
+	    luaL_error(L, "torrent is not in this pool");
+
+	pool->shards[shard]->ses.remove_torrent(*th);
+	metric_add(metric_torrents_removed, 1);
+
+	pool->placement.erase(hash);
+	pool->torrents[shard]--;
+
+	pool->rebalance();
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+    }
+
+    return 0;
+}
+
+/*
+ * handles = pool:torrent_handles()
+ *
+ *   returns a table of the handles in all shards
+ */
+static int torrent_session_pool_torrent_handles(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int c = 1;
+    lua_newtable(L);
+
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	std::vector<torrent_handle> handles = (*s)->ses.get_torrents();
+
+	for (std::vector<torrent_handle>::const_iterator i = handles.begin(); i != handles.end(); ++i) {
+	    lua_pushinteger(L, c);
+
+	    torrent_handle_push(L, *i, *s);
+
+	    lua_settable(L, -3);
+	    c++;
+	}
+    }
+
+    return 1;
+}
+
+/*
+ * status = pool:status()
+ *
+ *   returns the same table as session:status() summed over all shards,
+ *   plus a shards field with the number of torrents on each shard
+ */
+static int torrent_session_pool_status(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    bool has_incoming_connections = false;
+    float upload_rate = 0, download_rate = 0;
+    float payload_upload_rate = 0, payload_download_rate = 0;
+    size_type total_download = 0, total_upload = 0;
+    size_type total_payload_download = 0, total_payload_upload = 0;
+    int num_peers = 0;
+
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	session_status status = (*s)->ses.status();
+
+	has_incoming_connections = has_incoming_connections || status.has_incoming_connections;
+	upload_rate += status.upload_rate;
+	download_rate += status.download_rate;
+	payload_upload_rate += status.payload_upload_rate;
+	payload_download_rate += status.payload_download_rate;
+	total_download += status.total_download;
+	total_upload += status.total_upload;
+	total_payload_download += status.total_payload_download;
+	total_payload_upload += status.total_payload_upload;
+	num_peers += status.num_peers;
+    }
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_BOOL("has_incoming_connections", has_incoming_connections);
+    LUA_PUSH_ATTRIB_FLOAT("upload_rate", upload_rate);
+    LUA_PUSH_ATTRIB_FLOAT("download_rate", download_rate);
+    LUA_PUSH_ATTRIB_FLOAT("payload_upload_rate", payload_upload_rate);
+    LUA_PUSH_ATTRIB_FLOAT("payload_download_rate", payload_download_rate);
+    LUA_PUSH_ATTRIB_INT("total_download", total_download);
+    LUA_PUSH_ATTRIB_INT("total_upload", total_upload);
+    LUA_PUSH_ATTRIB_INT("total_payload_download", total_payload_download);
+    LUA_PUSH_ATTRIB_INT("total_payload_upload", total_payload_upload);
+    LUA_PUSH_ATTRIB_INT("num_peers", num_peers);
+
+    lua_pushstring(L, "shards");
+    lua_newtable(L);
+    int c = 1;
+    for (std::vector<int>::const_iterator i = pool->torrents.begin(); i != pool->torrents.end(); ++i) {
+	LUA_PUSH_ARRAY_INT(c, *i);
+    }
+    lua_settable(L, -3);
+
+    return 1;
+}
+
+/*
+ * pool:rebalance()
+ *
+ *   redistributes the global rate limits between the shards according
+ *   to their current transfer rates
+ */
+static int torrent_session_pool_rebalance(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    pool->rebalance();
+
+    return 0;
+}
+
+/*
+ * ports = pool:listen_ports()
+ *
+ *   returns a table with the listening port of each shard
+ */
+static int torrent_session_pool_listen_ports(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int c = 1;
+    lua_newtable(L);
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	LUA_PUSH_ARRAY_INT(c, (*s)->ses.listen_port());
+    }
+
+    return 1;
+}
+
+/*
+ * session = pool:shard(index)
+ *
+ *   returns the session of shard index (1 based), it shares
+ *   ownership with the pool
+ */
+static int torrent_session_pool_shard(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int index = luaL_checkint(L, 2);
+
+    luaL_argcheck(L, index >= 1 && index <= (int)pool->shards.size(), 2, "no such shard");
+
+    torrent_session_push(L, pool->shards[index - 1]);
+
+    return 1;
+}
+
+/*
+ * count = pool:num_shards()
+ */
+static int torrent_session_pool_num_shards(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    lua_pushinteger(L, pool->shards.size());
+
+    return 1;
+}
+
+/*
+ * count = pool:num_uploads()
+ *
+ *   returns the number of currently unchoked peers in all shards
+ */
+static int torrent_session_pool_num_uploads(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int count = 0;
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	count += (*s)->ses.num_uploads();
+    }
+
+    lua_pushinteger(L, count);
+
+    return 1;
+}
+
+/*
+ * count = pool:num_connections()
+ *
+ *   returns the number of connections in all shards
+ */
+static int torrent_session_pool_num_connections(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int count = 0;
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	count += (*s)->ses.num_connections();
+    }
+
+    lua_pushinteger(L, count);
+
+    return 1;
+}
+
+/*
+ * bytes_per_second = pool:upload_rate_limit()
+ *
+ *   returns the global upload rate limit
+ */
+static int torrent_session_pool_upload_rate_limit(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    lua_pushinteger(L, pool->upload_limit);
+
+    return 1;
+}
+
+/*
+ * bytes_per_second = pool:download_rate_limit()
+ *
+ *   returns the global download rate limit
+ */
+static int torrent_session_pool_download_rate_limit(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    lua_pushinteger(L, pool->download_limit);
+
+    return 1;
+}
+
+/*
+ * pool:set_upload_rate_limit(bytes_per_second)
+ *
+ *   sets the global upload limit, shared between the shards
+ */
+static int torrent_session_pool_set_upload_rate_limit(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int limit = luaL_checkinteger(L, 2);
+
+    pool->set_limits(limit, pool->download_limit);
+
+    return 0;
+}
+
+/*
+ * pool:set_download_rate_limit(bytes_per_second)
+ *
+ *   sets the global download limit, shared between the shards
+ */
+static int torrent_session_pool_set_download_rate_limit(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int limit = luaL_checkinteger(L, 2);
+
+    pool->set_limits(pool->upload_limit, limit);
+
+    return 0;
+}
+
+/*
+ * pool:set_max_uploads(max)
+ *
+ *   sets a limit on the number of unchoked peers, split evenly between shards
+ */
+static int torrent_session_pool_set_max_uploads(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int limit = luaL_checkinteger(L, 2);
+    int n = pool->shards.size();
+
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	(*s)->ses.set_max_uploads(limit > 0 ? std::max(1, limit / n) : limit);
+    }
+
+    return 0;
+}
+
+/*
+ * pool:set_max_connections(max)
+ *
+ *   sets the maximum number of connections, split evenly between shards
+ */
+static int torrent_session_pool_set_max_connections(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int limit = luaL_checkinteger(L, 2);
+    int n = pool->shards.size();
+
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	(*s)->ses.set_max_connections(limit > 0 ? std::max(2, limit / n) : limit);
+    }
+
+    return 0;
+}
+
+/*
+ * pool:set_max_half_open_connections(max)
+ *
+ *   sets the maximum number of half-open connections, split evenly between shards
+ */
+static int torrent_session_pool_set_max_half_open_connections(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    int limit = luaL_checkinteger(L, 2);
+    int n = pool->shards.size();
+
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	(*s)->ses.set_max_half_open_connections(limit > 0 ? std::max(1, limit / n) : limit);
+    }
+
+    return 0;
+}
+
+/*
+ * pool:abort()
+ *
+ *   destructs all shards asynchronously
+ */
+static int torrent_session_pool_abort(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    for (std::vector<session_ptr>::const_iterator s = pool->shards.begin(); s != pool->shards.end(); ++s) {
+	(*s)->ses.abort();
+    }
+
+    return 0;
+}
+
+/*
+ * __gc
+ *
+ *   frees all shards on GC
+ */
+static int torrent_session_pool_gc(lua_State *L) {
+    void* ud = 0;
+
+    ud = luaL_checkudata(L, 1, "Torrent.SessionPool");
+    session_pool *pool = *((session_pool **)ud);
+
+    delete pool;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_session_pool_methods[] = {
+    {"abort", torrent_session_pool_abort},
+    {"add_torrent", torrent_session_pool_add_torrent},
+    {"remove_torrent", torrent_session_pool_remove_torrent},
+    {"torrent_handles", torrent_session_pool_torrent_handles},
+    {"status", torrent_session_pool_status},
+    {"rebalance", torrent_session_pool_rebalance},
+    {"listen_ports", torrent_session_pool_listen_ports},
+    {"shard", torrent_session_pool_shard},
+    {"num_shards", torrent_session_pool_num_shards},
+    {"num_uploads", torrent_session_pool_num_uploads},
+    {"num_connections", torrent_session_pool_num_connections},
+    {"upload_rate_limit", torrent_session_pool_upload_rate_limit},
+    {"download_rate_limit", torrent_session_pool_download_rate_limit},
+    {"set_upload_rate_limit", torrent_session_pool_set_upload_rate_limit},
+    {"set_download_rate_limit", torrent_session_pool_set_download_rate_limit},
+    {"set_max_uploads", torrent_session_pool_set_max_uploads},
+    {"set_max_connections", torrent_session_pool_set_max_connections},
+    {"set_max_half_open_connections", torrent_session_pool_set_max_half_open_connections},
+    {NULL, NULL}
+};
+
+static const luaL_Reg torrent_session_pool_class_methods[] = {
+    {"New", torrent_session_pool_new},
+    {NULL, NULL}
+};
+
+int torrent_session_pool_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.SessionPool");
+    luaL_register(L, 0, torrent_session_pool_methods);  
+    lua_pushvalue(L,-1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_session_pool_gc);
+    lua_setfield(L, -2, "__gc"); 
+
+    luaL_register(L, "Torrent.SessionPool", torrent_session_pool_class_methods);  
+
+    return 1;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#if !defined(LUA_VERSION_NUM) || (LUA_VERSION_NUM < 501)
+#include <compat-5.1.h>
+#endif
+};
+
+#include <sstream>
+
+#include "libtorrent/torrent_info.hpp"
+
+#include "utils.h"
+#include "resume.h"
+#include "tracker.h"
+
+using namespace libtorrent;
+
+static tracker *torrent_tracker_check(lua_State *L, int index) {
+    tracker **t = (tracker **)luaL_checkudata(L, index, "Torrent.Tracker");
+
+    if (!*t)
+	luaL_error(L, "tracker has been closed");
+
+    return *t;
+}
+
+/*
+ * tracker = Torrent.Tracker.New([port, [options]])
+ *
+ *   starts a tracker serving HTTP and UDP announces and scrapes on port
+ *   (default 0, any free port). options is a table which may contain:
+ *     bind     - address to listen on, default "0.0.0.0"
+ *     interval - announce interval handed to peers in seconds, default 60
+ *     udp      - false to serve HTTP only
+ */
+static int torrent_tracker_new(lua_State *L) {
+    int port = luaL_optint(L, 1, 0);
+
+    std::string bind = "0.0.0.0";
+    int interval = 60;
+    bool udp = true;
+
+    if (lua_istable(L, 2)) {
+	lua_getfield(L, 2, "bind");
+	if (!lua_isnil(L, -1))
+	    bind = luaL_checkstring(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "interval");
+	if (!lua_isnil(L, -1))
+	    interval = luaL_checkint(L, -1);
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "udp");
+	if (!lua_isnil(L, -1))
+	    udp = lua_toboolean(L, -1) != 0;
+	lua_pop(L, 1);
+    }
+
+    luaL_argcheck(L, interval > 0, 2, "interval must be positive");
+
+    try {
+	tracker **t = (tracker **)lua_newuserdata(L, sizeof(tracker *));
+	*t = 0;
+
+	luaL_getmetatable(L, "Torrent.Tracker");
+	lua_setmetatable(L, -2);
+
+	*t = new tracker(port, bind, interval, udp);
+    } catch (std::exception& e) {
+	luaL_error(L, "%s", e.what());
+	lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+/*
+ * port = tracker:port()
+ *
+ *   returns the port the tracker is listening on
+ */
+static int torrent_tracker_port(lua_State *L) {
+    tracker *t = torrent_tracker_check(L, 1);
+
+    lua_pushinteger(L, t->port());
+
+    return 1;
+}
+
+/*
+ * url = tracker:announce_url([host, [udp]])
+ *
+ *   returns the announce url to pass to info:add_tracker(), for host 
+ *   (default 127.0.0.1), as udp:// if udp is true
+ */
+static int torrent_tracker_announce_url(lua_State *L) {
+    tracker *t = torrent_tracker_check(L, 1);
+
+    const char *host = luaL_optstring(L, 2, "127.0.0.1");
+    bool udp = lua_toboolean(L, 3);
+
+    std::ostringstream url;
+
+    if (udp)
+	url << "udp://" << host << ":" << t->port();
+    else
+	url << "http://" << host << ":" << t->port() << "/announce";
+
+    lua_pushstring(L, url.str().c_str());
+
+    return 1;
+}
+
+/*
+ * stats = tracker:stats()
+ *
+ *   returns a table with the number of announces, scrapes, udp_packets,
+ *   http_requests and errors served so far, and the current number of
+ *   torrents, peers and (HTTP) connections
+ */
+static int torrent_tracker_stats(lua_State *L) {
+    tracker *t = torrent_tracker_check(L, 1);
+
+    tracker_stats s = t->stats();
+
+    lua_newtable(L);
+
+    LUA_PUSH_ATTRIB_FLOAT("announces", s.announces);
+    LUA_PUSH_ATTRIB_FLOAT("scrapes", s.scrapes);
+    LUA_PUSH_ATTRIB_FLOAT("udp_packets", s.udp_packets);
+    LUA_PUSH_ATTRIB_FLOAT("http_requests", s.http_requests);
+    LUA_PUSH_ATTRIB_FLOAT("errors", s.errors);
+    LUA_PUSH_ATTRIB_INT("torrents", s.torrents);
+    LUA_PUSH_ATTRIB_INT("peers", s.peers);
+    LUA_PUSH_ATTRIB_INT("connections", s.connections);
+
+    return 1;
+}
+
+/*
+ * torrents = tracker:torrents()
+ *
+ *   returns an array of { info_hash, seeds, leechers, downloaded } for 
+ *   every torrent the tracker knows about
+ */
+static int torrent_tracker_torrents(lua_State *L) {
+    tracker *t = torrent_tracker_check(L, 1);
+
+    std::vector<tracker_torrent_stats> torrents = t->torrents();
+
+    lua_newtable(L);
+    int c = 1;
+
+    for (std::vector<tracker_torrent_stats>::const_iterator i = torrents.begin(); i != torrents.end(); ++i) {
+	lua_pushinteger(L, c);
+
+	lua_newtable(L);
+	LUA_PUSH_ATTRIB_STRING("info_hash", info_hash_to_hex(i->info_hash).c_str());
+	LUA_PUSH_ATTRIB_INT("seeds", i->seeds);
+	LUA_PUSH_ATTRIB_INT("leechers", i->leechers);
+	LUA_PUSH_ATTRIB_INT("downloaded", i->downloaded);
+	lua_settable(L, -3);
+
+	c++;
+    }
+
+    return 1;
+}
+
+/*
+ * tracker:close()
+ *
+ *   stops the tracker and closes its sockets
+ */
+static int torrent_tracker_close(lua_State *L) {
+    tracker **t = (tracker **)luaL_checkudata(L, 1, "Torrent.Tracker");
+
+    delete *t;
+    *t = 0;
+
+    return 0;
+}
+
+static const luaL_Reg torrent_tracker_methods[] = {
+    {"port", torrent_tracker_port},
+    {"announce_url", torrent_tracker_announce_url},
+    {"stats", torrent_tracker_stats},
+    {"torrents", torrent_tracker_torrents},
+    {"close", torrent_tracker_close},
+    {NULL, NULL}
+};
+
+static const luaL_Reg torrent_tracker_class_methods[] = {
+    {"New", torrent_tracker_new},
+    {NULL, NULL}
+};
+
+int torrent_tracker_register(lua_State *L) {
+    luaL_newmetatable(L, "Torrent.Tracker");
+    luaL_register(L, 0, torrent_tracker_methods);  
+    lua_pushvalue(L,-1);
+    lua_setfield(L, -2, "__index");    
+
+    lua_pushcfunction(L, torrent_tracker_close);
+    lua_setfield(L, -2, "__gc"); 
+
+    luaL_register(L, "Torrent.Tracker", torrent_tracker_class_methods);  
+
+    return 1;
+}
@@ -0,0 +1,862 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include "libtorrent/hasher.hpp"
+
+#include "tracker.h"
+#include "metrics.h"
+
+using namespace libtorrent;
+
+#define HTTP_MAX_REQUEST 8192
+#define UDP_PROTOCOL_ID 0x41727101980ULL
+#define SWEEP_SECONDS 30
+#define DEFAULT_NUMWANT 50
+#define MAX_NUMWANT 200
+
+enum { udp_connect = 0, udp_announce = 1, udp_scrape = 2, udp_error = 3 };
+
+static void put_u16(char *p, unsigned int v) {
+    p[0] = (char)((v >> 8) & 0xff);
+    p[1] = (char)(v & 0xff);
+}
+
+static void put_u32(char *p, unsigned int v) {
+    p[0] = (char)((v >> 24) & 0xff);
+    p[1] = (char)((v >> 16) & 0xff);
+    p[2] = (char)((v >> 8) & 0xff);
+    p[3] = (char)(v & 0xff);
+}
+
+static void put_u64(char *p, unsigned long long v) {
+    put_u32(p, (unsigned int)(v >> 32));
+    put_u32(p + 4, (unsigned int)v);
+}
+
+static unsigned int get_u16(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+
+    return (u[0] << 8) | u[1];
+}
+
+static unsigned int get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+
+    return ((unsigned int)u[0] << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+static unsigned long long get_u64(const char *p) {
+    return ((unsigned long long)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void epoll_add(int epfd, int fd, unsigned int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void epoll_mod(int epfd, int fd, unsigned int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static std::string url_decode(const std::string &s) {
+    std::string out;
+    out.reserve(s.size());
+
+    for (size_t i = 0; i < s.size(); i++) {
+	if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) && isxdigit((unsigned char)s[i + 2])) {
+	    out += (char)strtol(s.substr(i + 1, 2).c_str(), 0, 16);
+	    i += 2;
+	} else if (s[i] == '+') {
+	    out += ' ';
+	} else {
+	    out += s[i];
+	}
+    }
+
+    return out;
+}
+
+static void bencode_int(std::string &out, long long v) {
+    std::ostringstream s;
+    s << 'i' << v << 'e';
+    out += s.str();
+}
+
+static void bencode_string(std::string &out, const std::string &v) {
+    std::ostringstream s;
+    s << v.size() << ':';
+    out += s.str();
+    out += v;
+}
+
+static std::string failure(const std::string &reason) {
+    std::string out = "d";
+    bencode_string(out, "failure reason");
+    bencode_string(out, reason);
+    out += "e";
+
+    return out;
+}
+
+static std::string ip_to_string(unsigned int ip) {
+    struct in_addr a;
+    a.s_addr = htonl(ip);
+
+    return inet_ntoa(a);
+}
+
+tracker::tracker(int port, const std::string &bind, int interval, bool udp) 
+    : m_port(port), m_interval(interval), m_epoll(-1), m_listen(-1), m_udp(-1), m_thread(0) {
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_wake[0] = m_wake[1] = -1;
+
+    int random = ::open("/dev/urandom", O_RDONLY);
+    bool seeded = random >= 0 && ::read(random, m_secret, sizeof(m_secret)) == (ssize_t)sizeof(m_secret);
+
+    if (random >= 0)
+	::close(random);
+
+    if (!seeded)
+	throw std::runtime_error(std::string("cannot seed the tracker secret: ") + strerror(errno));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (inet_aton(bind.c_str(), &addr.sin_addr) == 0)
+	throw std::runtime_error("invalid tracker bind address: " + bind);
+
+    try {
+	m_listen = socket(AF_INET, SOCK_STREAM, 0);
+
+	int one = 1;
+	setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (m_listen < 0 || ::bind(m_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(m_listen, 1024) != 0)
+	    throw std::runtime_error(std::string("cannot listen for tracker: ") + strerror(errno));
+
+	/* port 0 picks a free port, use the same one for udp */
+	socklen_t len = sizeof(addr);
+	getsockname(m_listen, (struct sockaddr *)&addr, &len);
+	m_port = ntohs(addr.sin_port);
+
+	set_nonblocking(m_listen);
+
+	if (udp) {
+	    m_udp = socket(AF_INET, SOCK_DGRAM, 0);
+
+	    if (m_udp < 0 || ::bind(m_udp, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+		throw std::runtime_error(std::string("cannot bind udp tracker: ") + strerror(errno));
+
+	    set_nonblocking(m_udp);
+	}
+
+	if (pipe(m_wake) != 0)
+	    throw std::runtime_error(std::string("cannot create tracker pipe: ") + strerror(errno));
+
+	m_epoll = epoll_create(1024);
+
+	if (m_epoll < 0)
+	    throw std::runtime_error(std::string("cannot create epoll set: ") + strerror(errno));
+
+	epoll_add(m_epoll, m_listen, EPOLLIN);
+	epoll_add(m_epoll, m_wake[0], EPOLLIN);
+
+	if (m_udp >= 0)
+	    epoll_add(m_epoll, m_udp, EPOLLIN);
+    } catch (...) {
+	close();
+	throw;
+    }
+
+    m_thread = new boost::thread(boost::bind(&tracker::run, this));
+}
+
+tracker::~tracker() {
+    close();
+}
+
+void tracker::close() {
+    if (m_thread) {
+	char c = 0;
+	write(m_wake[1], &c, 1);
+
+	m_thread->join();
+	delete m_thread;
+	m_thread = 0;
+    }
+
+    for (std::map<int, http_conn>::iterator i = m_conns.begin(); i != m_conns.end(); ++i)
+	::close(i->first);
+    m_conns.clear();
+
+    int *fds[] = { &m_epoll, &m_listen, &m_udp, &m_wake[0], &m_wake[1] };
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+	if (*fds[i] >= 0) {
+	    ::close(*fds[i]);
+	    *fds[i] = -1;
+	}
+    }
+}
+
+void tracker::run() {
+    struct epoll_event events[256];
+    time_t last_sweep = time(0);
+
+    for (;;) {
+	int n = epoll_wait(m_epoll, events, 256, 1000);
+
+	if (n < 0 && errno != EINTR)
+	    break;
+
+	for (int i = 0; i < n; i++) {
+	    int fd = events[i].data.fd;
+
+	    if (fd == m_wake[0]) {
+		return;
+	    } else if (fd == m_listen) {
+		accept_http();
+	    } else if (fd == m_udp) {
+		handle_udp();
+	    } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+		close_http(fd);
+	    } else {
+		if (events[i].events & EPOLLIN)
+		    read_http(fd);
+		if ((events[i].events & EPOLLOUT) && m_conns.count(fd))
+		    write_http(fd);
+	    }
+	}
+
+	time_t now = time(0);
+
+	if (now - last_sweep >= SWEEP_SECONDS) {
+	    sweep(now);
+	    last_sweep = now;
+	}
+    }
+}
+
+/* drop peers that have missed two announces */
+void tracker::sweep(time_t now) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    time_t cutoff = now - 2 * m_interval;
+
+    for (std::map<sha1_hash, tracker_swarm>::iterator s = m_swarms.begin(); s != m_swarms.end();) {
+	tracker_swarm &sw = s->second;
+
+	for (size_t i = 0; i < sw.peers.size();) {
+	    if (sw.peers[i].last_seen >= cutoff) {
+		i++;
+		continue;
+	    }
+
+	    tracker_peer &p = sw.peers[i];
+
+	    if (p.seed)
+		sw.seeds--;
+
+	    sw.index.erase(((unsigned long long)p.ip << 16) | p.port);
+
+	    if (i != sw.peers.size() - 1) {
+		p = sw.peers.back();
+		sw.index[((unsigned long long)p.ip << 16) | p.port] = i;
+	    }
+
+	    sw.peers.pop_back();
+	}
+
+	if (sw.peers.empty() && sw.downloaded == 0)
+	    m_swarms.erase(s++);
+	else
+	    ++s;
+    }
+}
+
+void tracker::announce(const sha1_hash &hash, unsigned int ip, unsigned short port, 
+    const std::string &peer_id, long long left, int event, int numwant, 
+    tracker_swarm *&swarm, std::vector<const tracker_peer *> &out) {
+    tracker_swarm &sw = m_swarms[hash];
+    swarm = &sw;
+
+    unsigned long long key = ((unsigned long long)ip << 16) | port;
+    std::map<unsigned long long, size_t>::iterator i = sw.index.find(key);
+
+    bool seed = left == 0;
+
+    if (event == event_stopped) {
+	if (i != sw.index.end()) {
+	    size_t pos = i->second;
+
+	    if (sw.peers[pos].seed)
+		sw.seeds--;
+
+	    sw.index.erase(i);
+
+	    if (pos != sw.peers.size() - 1) {
+		tracker_peer &p = sw.peers[pos];
+		p = sw.peers.back();
+		sw.index[((unsigned long long)p.ip << 16) | p.port] = pos;
+	    }
+
+	    sw.peers.pop_back();
+	}
+
+	return;
+    }
+
+    if (event == event_completed)
+	sw.downloaded++;
+
+    if (i == sw.index.end()) {
+	tracker_peer p;
+	p.ip = ip;
+	p.port = port;
+	p.seed = seed;
+	p.last_seen = time(0);
+	p.peer_id = peer_id;
+
+	sw.index[key] = sw.peers.size();
+	sw.peers.push_back(p);
+
+	if (seed)
+	    sw.seeds++;
+    } else {
+	tracker_peer &p = sw.peers[i->second];
+
+	if (p.seed != seed)
+	    sw.seeds += seed ? 1 : -1;
+
+	p.seed = seed;
+	p.last_seen = time(0);
+	p.peer_id = peer_id;
+    }
+
+    if (numwant < 0)
+	numwant = DEFAULT_NUMWANT;
+    if (numwant > MAX_NUMWANT)
+	numwant = MAX_NUMWANT;
+
+    /* a run of peers from a random offset, seeds don't need other seeds */
+    size_t count = sw.peers.size();
+
+    if (count == 0)
+	return;
+
+    size_t start = rand() % count;
+
+    for (size_t n = 0; n < count && (int)out.size() < numwant; n++) {
+	const tracker_peer &p = sw.peers[(start + n) % count];
+
+	if (p.ip == ip && p.port == port)
+	    continue;
+	if (seed && p.seed)
+	    continue;
+
+	out.push_back(&p);
+    }
+}
+
+void tracker::accept_http() {
+    for (;;) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	int fd = accept(m_listen, (struct sockaddr *)&addr, &len);
+
+	if (fd < 0)
+	    return;
+
+	set_nonblocking(fd);
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	http_conn &c = m_conns[fd];
+	c.ip = ntohl(addr.sin_addr.s_addr);
+	c.close_after = false;
+
+	epoll_add(m_epoll, fd, EPOLLIN);
+
+	boost::mutex::scoped_lock l(m_mutex);
+	m_stats.connections++;
+    }
+}
+
+void tracker::read_http(int fd) {
+    std::map<int, http_conn>::iterator ci = m_conns.find(fd);
+
+    if (ci == m_conns.end())
+	return;
+
+    http_conn &c = ci->second;
+    char buf[4096];
+    bool eof = false;
+
+    for (;;) {
+	ssize_t r = recv(fd, buf, sizeof(buf), 0);
+
+	if (r < 0 && errno != EAGAIN && errno != EINTR) {
+	    close_http(fd);
+	    return;
+	}
+
+	/* a client may send its requests and shut down its side at once */
+	if (r == 0) {
+	    eof = true;
+	    break;
+	}
+
+	if (r < 0)
+	    break;
+
+	c.in.append(buf, r);
+
+	if (c.in.size() > HTTP_MAX_REQUEST) {
+	    close_http(fd);
+	    return;
+	}
+    }
+
+    std::string::size_type end;
+
+    /* keep-alive clients may pipeline several requests */
+    while ((end = c.in.find("\r\n\r\n")) != std::string::npos) {
+	std::string request = c.in.substr(0, end);
+	c.in.erase(0, end + 4);
+
+	c.out += handle_http(c, request);
+    }
+
+    if (eof) {
+	if (c.out.empty()) {
+	    close_http(fd);
+	    return;
+	}
+
+	c.close_after = true;
+    }
+
+    if (!c.out.empty())
+	write_http(fd);
+}
+
+void tracker::write_http(int fd) {
+    http_conn &c = m_conns[fd];
+
+    while (!c.out.empty()) {
+	ssize_t w = send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+
+	if (w < 0) {
+	    if (errno == EAGAIN) {
+		/* nothing more is read from a closing client, whose EOF would keep waking us */
+		epoll_mod(m_epoll, fd, c.close_after ? EPOLLOUT : EPOLLIN | EPOLLOUT);
+		return;
+	    }
+
+	    if (errno == EINTR)
+		continue;
+
+	    close_http(fd);
+	    return;
+	}
+
+	c.out.erase(0, w);
+    }
+
+    if (c.close_after) {
+	close_http(fd);
+	return;
+    }
+
+    epoll_mod(m_epoll, fd, EPOLLIN);
+}
+
+void tracker::close_http(int fd) {
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, 0);
+    ::close(fd);
+
+    if (m_conns.erase(fd)) {
+	boost::mutex::scoped_lock l(m_mutex);
+	m_stats.connections--;
+    }
+}
+
+std::string tracker::handle_http(http_conn &c, const std::string &request) {
+    std::string line = request.substr(0, request.find("\r\n"));
+    std::string body;
+
+    std::string::size_type sp1 = line.find(' ');
+    std::string::size_type sp2 = line.rfind(' ');
+
+    std::string target = sp1 != std::string::npos && sp2 > sp1 ? line.substr(sp1 + 1, sp2 - sp1 - 1) : "";
+    std::string version = sp2 != std::string::npos ? line.substr(sp2 + 1) : "";
+
+    std::string lower = request;
+    for (std::string::iterator i = lower.begin(); i != lower.end(); ++i)
+	*i = tolower(*i);
+
+    c.close_after = version != "HTTP/1.1" 
+	? lower.find("connection: keep-alive") == std::string::npos 
+	: lower.find("connection: close") != std::string::npos;
+
+    std::string::size_type q = target.find('?');
+    std::string path = target.substr(0, q);
+    std::string query = q == std::string::npos ? "" : target.substr(q + 1);
+
+    std::multimap<std::string, std::string> params;
+
+    for (std::string::size_type pos = 0; pos < query.size();) {
+	std::string::size_type amp = query.find('&', pos);
+	if (amp == std::string::npos)
+	    amp = query.size();
+
+	std::string kv = query.substr(pos, amp - pos);
+	std::string::size_type eq = kv.find('=');
+
+	if (eq != std::string::npos)
+	    params.insert(std::make_pair(kv.substr(0, eq), url_decode(kv.substr(eq + 1))));
+
+	pos = amp + 1;
+    }
+
+    boost::mutex::scoped_lock l(m_mutex);
+
+    m_stats.http_requests++;
+
+    if (line.compare(0, 4, "GET ") != 0) {
+	m_stats.errors++;
+	body = failure("unsupported request");
+    } else if (path == "/announce") {
+	std::multimap<std::string, std::string>::const_iterator ih = params.find("info_hash");
+	std::multimap<std::string, std::string>::const_iterator pt = params.find("port");
+
+	if (ih == params.end() || ih->second.size() != 20 || pt == params.end()) {
+	    m_stats.errors++;
+	    metric_add(metric_tracker_errors, 1);
+	    body = failure("invalid announce");
+	} else {
+	    std::multimap<std::string, std::string>::const_iterator p;
+
+	    long long left = (p = params.find("left")) != params.end() ? atoll(p->second.c_str()) : -1;
+	    int numwant = (p = params.find("numwant")) != params.end() ? atoi(p->second.c_str()) : -1;
+	    bool compact = (p = params.find("compact")) == params.end() || p->second != "0";
+	    std::string peer_id = (p = params.find("peer_id")) != params.end() ? p->second : "";
+
+	    int event = event_none;
+	    if ((p = params.find("event")) != params.end()) {
+		if (p->second == "started")
+		    event = event_started;
+		else if (p->second == "completed")
+		    event = event_completed;
+		else if (p->second == "stopped")
+		    event = event_stopped;
+	    }
+
+	    tracker_swarm *sw = 0;
+	    std::vector<const tracker_peer *> peers;
+
+	    announce(sha1_hash(ih->second), c.ip, atoi(pt->second.c_str()), peer_id, left, event, numwant, sw, peers);
+
+	    m_stats.announces++;
+	    metric_add(metric_tracker_announces, 1);
+
+	    body = "d";
+	    bencode_string(body, "complete");
+	    bencode_int(body, sw->seeds);
+	    bencode_string(body, "incomplete");
+	    bencode_int(body, sw->peers.size() - sw->seeds);
+	    bencode_string(body, "interval");
+	    bencode_int(body, m_interval);
+	    bencode_string(body, "peers");
+
+	    if (compact) {
+		std::string list(peers.size() * 6, '\0');
+
+		for (size_t i = 0; i < peers.size(); i++) {
+		    put_u32(&list[i * 6], peers[i]->ip);
+		    put_u16(&list[i * 6 + 4], peers[i]->port);
+		}
+
+		bencode_string(body, list);
+	    } else {
+		body += "l";
+
+		for (size_t i = 0; i < peers.size(); i++) {
+		    body += "d";
+		    bencode_string(body, "ip");
+		    bencode_string(body, ip_to_string(peers[i]->ip));
+		    bencode_string(body, "peer id");
+		    bencode_string(body, peers[i]->peer_id);
+		    bencode_string(body, "port");
+		    bencode_int(body, peers[i]->port);
+		    body += "e";
+		}
+
+		body += "e";
+	    }
+
+	    body += "e";
+	}
+    } else if (path == "/scrape") {
+	m_stats.scrapes++;
+	metric_add(metric_tracker_scrapes, 1);
+
+	body = "d";
+	bencode_string(body, "files");
+	body += "d";
+
+	/* bencoded dictionaries are sorted, info hashes are binary strings */
+	std::map<std::string, const tracker_swarm *> files;
+
+	for (std::multimap<std::string, std::string>::const_iterator i = params.lower_bound("info_hash"); 
+	    i != params.upper_bound("info_hash"); ++i) {
+	    if (i->second.size() != 20)
+		continue;
+
+	    std::map<sha1_hash, tracker_swarm>::const_iterator s = m_swarms.find(sha1_hash(i->second));
+
+	    if (s != m_swarms.end())
+		files[i->second] = &s->second;
+	}
+
+	for (std::map<std::string, const tracker_swarm *>::const_iterator i = files.begin(); i != files.end(); ++i) {
+	    bencode_string(body, i->first);
+	    body += "d";
+	    bencode_string(body, "complete");
+	    bencode_int(body, i->second->seeds);
+	    bencode_string(body, "downloaded");
+	    bencode_int(body, i->second->downloaded);
+	    bencode_string(body, "incomplete");
+	    bencode_int(body, i->second->peers.size() - i->second->seeds);
+	    body += "e";
+	}
+
+	body += "ee";
+    } else {
+	m_stats.errors++;
+	body = failure("unknown path");
+    }
+
+    std::ostringstream out;
+    out << "HTTP/1.1 200 OK\r\n"
+	<< "Content-Type: text/plain\r\n"
+	<< "Content-Length: " << body.size() << "\r\n"
+	<< (c.close_after ? "Connection: close\r\n" : "")
+	<< "\r\n" << body;
+
+    return out.str();
+}
+
+/* a keyed hash of the endpoint and minute, so ids can be neither forged nor recovered */
+unsigned long long tracker::connection_id(unsigned int ip, unsigned short port, unsigned long long minute) const {
+    char buf[4 + 2 + 8];
+
+    put_u32(buf, ip);
+    put_u16(buf + 4, port);
+    put_u64(buf + 6, minute);
+
+    hasher h(m_secret, sizeof(m_secret));
+    h.update(buf, sizeof(buf));
+
+    sha1_hash digest = h.final();
+
+    return get_u64((const char *)digest.begin());
+}
+
+void tracker::handle_udp() {
+    char buf[2048];
+    char reply[8 + 12 + MAX_NUMWANT * 6];
+
+    /* drain the socket, one datagram per request */
+    for (;;) {
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+
+	ssize_t r = recvfrom(m_udp, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+
+	if (r < 0)
+	    return;
+
+	if (r < 16)
+	    continue;
+
+	unsigned int ip = ntohl(from.sin_addr.s_addr);
+	unsigned long long conn = get_u64(buf);
+	unsigned int action = get_u32(buf + 8);
+	unsigned int txn = get_u32(buf + 12);
+
+	/* connection ids are valid for two minutes, and need no state */
+	unsigned long long minute = time(0) / 60;
+	unsigned long long id = connection_id(ip, ntohs(from.sin_port), minute);
+
+	size_t len = 0;
+
+	boost::mutex::scoped_lock l(m_mutex);
+
+	m_stats.udp_packets++;
+
+	if (action == udp_connect) {
+	    if (conn != UDP_PROTOCOL_ID)
+		continue;
+
+	    put_u32(reply, udp_connect);
+	    put_u32(reply + 4, txn);
+	    put_u64(reply + 8, id);
+	    len = 16;
+	} else if (conn != id && conn != connection_id(ip, ntohs(from.sin_port), minute - 1)) {
+	    m_stats.errors++;
+	    metric_add(metric_tracker_errors, 1);
+
+	    static const char msg[] = "invalid connection id";
+	    put_u32(reply, udp_error);
+	    put_u32(reply + 4, txn);
+	    memcpy(reply + 8, msg, sizeof(msg) - 1);
+	    len = 8 + sizeof(msg) - 1;
+	} else if (action == udp_announce && r >= 98) {
+	    static const int events[] = { event_none, event_completed, event_started, event_stopped };
+
+	    unsigned int event = get_u32(buf + 80);
+	    int numwant = (int)get_u32(buf + 92);
+
+	    tracker_swarm *sw = 0;
+	    std::vector<const tracker_peer *> peers;
+
+	    announce(sha1_hash(std::string(buf + 16, 20)), ip, get_u16(buf + 96), 
+		std::string(buf + 36, 20), (long long)get_u64(buf + 64), event < 4 ? events[event] : event_none, 
+		numwant, sw, peers);
+
+	    m_stats.announces++;
+	    metric_add(metric_tracker_announces, 1);
+
+	    put_u32(reply, udp_announce);
+	    put_u32(reply + 4, txn);
+	    put_u32(reply + 8, m_interval);
+	    put_u32(reply + 12, sw->peers.size() - sw->seeds);
+	    put_u32(reply + 16, sw->seeds);
+	    len = 20;
+
+	    for (size_t i = 0; i < peers.size(); i++) {
+		put_u32(reply + len, peers[i]->ip);
+		put_u16(reply + len + 4, peers[i]->port);
+		len += 6;
+	    }
+	} else if (action == udp_scrape) {
+	    m_stats.scrapes++;
+	    metric_add(metric_tracker_scrapes, 1);
+
+	    put_u32(reply, udp_scrape);
+	    put_u32(reply + 4, txn);
+	    len = 8;
+
+	    for (const char *h = buf + 16; h + 20 <= buf + r && len + 12 <= sizeof(reply); h += 20) {
+		std::map<sha1_hash, tracker_swarm>::const_iterator s = m_swarms.find(sha1_hash(std::string(h, 20)));
+
+		int seeds = 0, downloaded = 0, leechers = 0;
+
+		if (s != m_swarms.end()) {
+		    seeds = s->second.seeds;
+		    downloaded = s->second.downloaded;
+		    leechers = s->second.peers.size() - seeds;
+		}
+
+		put_u32(reply + len, seeds);
+		put_u32(reply + len + 4, downloaded);
+		put_u32(reply + len + 8, leechers);
+		len += 12;
+	    }
+	} else {
+	    m_stats.errors++;
+	    continue;
+	}
+
+	sendto(m_udp, reply, len, 0, (struct sockaddr *)&from, fromlen);
+    }
+}
+
+tracker_stats tracker::stats() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    tracker_stats s = m_stats;
+
+    s.torrents = m_swarms.size();
+    s.peers = 0;
+
+    for (std::map<sha1_hash, tracker_swarm>::const_iterator i = m_swarms.begin(); i != m_swarms.end(); ++i)
+	s.peers += i->second.peers.size();
+
+    return s;
+}
+
+std::vector<tracker_torrent_stats> tracker::torrents() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    std::vector<tracker_torrent_stats> out;
+    out.reserve(m_swarms.size());
+
+    for (std::map<sha1_hash, tracker_swarm>::const_iterator i = m_swarms.begin(); i != m_swarms.end(); ++i) {
+	tracker_torrent_stats t;
+	t.info_hash = i->first;
+	t.seeds = i->second.seeds;
+	t.leechers = i->second.peers.size() - i->second.seeds;
+	t.downloaded = i->second.downloaded;
+
+	out.push_back(t);
+    }
+
+    return out;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_TRACKER_H
+#define LUATORRENT_TRACKER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "libtorrent/torrent_info.hpp"
+
+/*
+ * tracker
+ *
+ *   A small BitTorrent tracker for LAN and loopback swarms. One thread
+ *   serves HTTP (BEP 3, compact and plain peer lists) and UDP (BEP 15)
+ *   announces and scrapes on the same port from a single epoll set. 
+ *   Peers are kept per info hash in memory only, and expire when they 
+ *   have not announced for two intervals. Only IPv4 peers are tracked.
+ */
+
+struct tracker_peer {
+    unsigned int ip;
+    unsigned short port;
+    bool seed;
+    time_t last_seen;
+    std::string peer_id;
+};
+
+struct tracker_swarm {
+    std::vector<tracker_peer> peers;
+
+    /* (ip << 16 | port) -> position in peers */
+    std::map<unsigned long long, size_t> index;
+
+    int seeds;
+    int downloaded;
+
+    tracker_swarm() : seeds(0), downloaded(0) {}
+};
+
+struct tracker_torrent_stats {
+    libtorrent::sha1_hash info_hash;
+    int seeds;
+    int leechers;
+    int downloaded;
+};
+
+struct tracker_stats {
+    long long announces;
+    long long scrapes;
+    long long udp_packets;
+    long long http_requests;
+    long long errors;
+    int torrents;
+    int peers;
+    int connections;
+};
+
+class tracker {
+public:
+    tracker(int port, const std::string &bind, int interval, bool udp);
+    ~tracker();
+
+    int port() const { return m_port; }
+    int interval() const { return m_interval; }
+
+    tracker_stats stats();
+    std::vector<tracker_torrent_stats> torrents();
+
+    void close();
+
+private:
+    struct http_conn {
+	unsigned int ip;
+	std::string in;
+	std::string out;
+	bool close_after;
+    };
+
+    enum event_t { event_none, event_completed, event_started, event_stopped };
+
+    void run();
+    void sweep(time_t now);
+
+    void accept_http();
+    void read_http(int fd);
+    void write_http(int fd);
+    void close_http(int fd);
+    std::string handle_http(http_conn &c, const std::string &request);
+
+    void handle_udp();
+    unsigned long long connection_id(unsigned int ip, unsigned short port, unsigned long long minute) const;
+
+    void announce(const libtorrent::sha1_hash &hash, unsigned int ip, unsigned short port, 
+	const std::string &peer_id, long long left, int event, int numwant, 
+	tracker_swarm *&swarm, std::vector<const tracker_peer *> &out);
+
+    int m_port;
+    int m_interval;
+
+    int m_epoll;
+    int m_listen;
+    int m_udp;
+    int m_wake[2];
+
+    /* keys the UDP connection ids, from /dev/urandom */
+    char m_secret[20];
+
+    std::map<int, http_conn> m_conns;
+
+    /* guards m_swarms and m_stats against stats() and torrents() */
+    boost::mutex m_mutex;
+    std::map<libtorrent::sha1_hash, tracker_swarm> m_swarms;
+    tracker_stats m_stats;
+
+    boost::thread *m_thread;
+};
+
+#endif
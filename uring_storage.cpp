@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/file_pool.hpp"
+
+#include "uring_storage.h"
+
+using namespace libtorrent;
+
+#ifdef USE_URING
+
+#include <stdexcept>
+#include <deque>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#define URING_CHUNK (128 * 1024)
+#define DIRECT_ALIGN 4096
+
+uring_storage::uring_storage(boost::intrusive_ptr<torrent_info const> info, 
+    const fs::path &save_path, int queue_depth, bool direct) 
+    : m_info(info), m_save_path(save_path), m_depth(queue_depth), m_direct(direct),
+      m_fds(info->num_files(), -1), m_direct_fds(info->num_files(), -1) {
+    int ret = io_uring_queue_init(m_depth, &m_ring, 0);
+
+    if (ret < 0)
+	throw file_error(std::string("cannot create io_uring: ") + strerror(-ret));
+}
+
+uring_storage::~uring_storage() {
+    close_files();
+    io_uring_queue_exit(&m_ring);
+}
+
+fs::path uring_storage::file_path(int file) const {
+    return m_save_path / m_info->file_at(file).path;
+}
+
+int uring_storage::file_fd(int file, bool direct) {
+    std::vector<int> &fds = direct ? m_direct_fds : m_fds;
+
+    if (fds[file] >= 0)
+	return fds[file];
+
+    fs::path p = file_path(file);
+
+    if (!direct)
+	fs::create_directories(p.branch_path());
+
+    int fd = ::open(p.string().c_str(), direct ? O_RDONLY | O_DIRECT : O_RDWR | O_CREAT, 0644);
+
+    /* not every filesystem does O_DIRECT, fall back to buffered reads */
+    if (fd < 0 && direct && errno == EINVAL)
+	return file_fd(file, false);
+
+    if (fd < 0)
+	throw file_error("cannot open " + p.string() + ": " + strerror(errno));
+
+    fds[file] = fd;
+
+    return fd;
+}
+
+void uring_storage::close_files() {
+    for (size_t i = 0; i < m_fds.size(); i++) {
+	if (m_fds[i] >= 0)
+	    ::close(m_fds[i]);
+	if (m_direct_fds[i] >= 0)
+	    ::close(m_direct_fds[i]);
+
+	m_fds[i] = m_direct_fds[i] = -1;
+    }
+}
+
+/* submits ops with up to m_depth in flight and waits for all of them */
+void uring_storage::run(std::vector<io_op> &ops) {
+    std::deque<io_op *> pending;
+
+    for (size_t i = 0; i < ops.size(); i++)
+	pending.push_back(&ops[i]);
+
+    int inflight = 0;
+    std::string error;
+
+    /* once something failed nothing new is submitted, only what is in flight reaped */
+    while ((error.empty() && !pending.empty()) || inflight > 0) {
+	while (error.empty() && !pending.empty() && inflight < m_depth) {
+	    struct io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+
+	    if (!sqe)
+		break;
+
+	    io_op *op = pending.front();
+	    pending.pop_front();
+
+	    if (op->write)
+		io_uring_prep_write(sqe, op->fd, op->buf, op->len, op->offset);
+	    else
+		io_uring_prep_read(sqe, op->fd, op->buf, op->len, op->offset);
+
+	    io_uring_sqe_set_data(sqe, op);
+	    inflight++;
+	}
+
+	io_uring_submit(&m_ring);
+
+	struct io_uring_cqe *cqe;
+	int ret = io_uring_wait_cqe(&m_ring, &cqe);
+
+	if (ret == -EINTR)
+	    continue;
+
+	/* the kernel still owns the buffers of whatever is in flight, io() must not free them yet */
+	if (ret < 0) {
+	    if (error.empty())
+		error = std::string("wait failed: ") + strerror(-ret);
+
+	    continue;
+	}
+
+	io_op *op = (io_op *)io_uring_cqe_get_data(cqe);
+	int res = cqe->res;
+
+	io_uring_cqe_seen(&m_ring, cqe);
+	inflight--;
+
+	if (res == -EAGAIN || res == -EINTR) {
+	    pending.push_back(op);
+	} else if (res < 0) {
+	    /* drain what is in flight before reporting */
+	    error = strerror(-res);
+	} else if ((size_t)res < op->len && res > 0 && !op->out) {
+	    op->buf += res;
+	    op->offset += res;
+	    op->len -= res;
+	    pending.push_back(op);
+	} else if ((size_t)res < op->len && !op->write) {
+	    /* past the end of a file not yet fully written, reads as zeros */
+	    memset(op->buf + res, 0, op->len - res);
+	} else if ((size_t)res < op->len) {
+	    error = "short write";
+	}
+    }
+
+    if (!error.empty())
+	throw file_error("io_uring storage: " + error);
+
+    for (size_t i = 0; i < ops.size(); i++) {
+	if (ops[i].out)
+	    memcpy(ops[i].out, ops[i].buf + ops[i].skip, ops[i].want);
+    }
+}
+
+void uring_storage::io(char *buf, int slot, int offset, int size, bool write) {
+    std::vector<file_slice> slices = m_info->map_block(slot, offset, size);
+
+    std::vector<io_op> ops;
+    std::vector<void *> bounce;
+
+    boost::mutex::scoped_lock l(m_mutex);
+
+    try {
+	for (std::vector<file_slice>::const_iterator i = slices.begin(); i != slices.end(); ++i) {
+	    size_type file_offset = i->offset;
+	    size_type left = i->size;
+
+	    if (m_direct && !write) {
+		int fd = file_fd(i->file_index, true);
+
+		/* widen to aligned boundaries, the bounce buffer takes the slack */
+		off_t start = file_offset & ~(off_t)(DIRECT_ALIGN - 1);
+		size_t len = ((file_offset + left - start) + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+
+		void *p = 0;
+		if (posix_memalign(&p, DIRECT_ALIGN, len) != 0)
+		    throw file_error("cannot allocate O_DIRECT buffer");
+		bounce.push_back(p);
+
+		io_op op = { fd, (char *)p, len, start, false, buf, (size_t)(file_offset - start), (size_t)left };
+		ops.push_back(op);
+
+		buf += left;
+		continue;
+	    }
+
+	    int fd = file_fd(i->file_index, false);
+
+	    while (left > 0) {
+		size_t len = (size_t)std::min(left, (size_type)URING_CHUNK);
+
+		io_op op = { fd, buf, len, (off_t)file_offset, write, 0, 0, 0 };
+		ops.push_back(op);
+
+		buf += len;
+		file_offset += len;
+		left -= len;
+	    }
+	}
+
+	run(ops);
+    } catch (...) {
+	for (size_t i = 0; i < bounce.size(); i++)
+	    ::free(bounce[i]);
+	throw;
+    }
+
+    for (size_t i = 0; i < bounce.size(); i++)
+	::free(bounce[i]);
+}
+
+bool uring_storage::initialize(bool allocate_files) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    for (int i = 0; i < m_info->num_files(); i++) {
+	int fd = file_fd(i, false);
+
+	if (allocate_files) {
+	    struct stat st;
+
+	    if (fstat(fd, &st) == 0 && st.st_size < m_info->file_at(i).size)
+		ftruncate(fd, m_info->file_at(i).size);
+	}
+    }
+
+    return false;
+}
+
+size_type uring_storage::read(char *buf, int slot, int offset, int size) {
+    io(buf, slot, offset, size, false);
+
+    return size;
+}
+
+void uring_storage::write(const char *buf, int slot, int offset, int size) {
+    io(const_cast<char *>(buf), slot, offset, size, true);
+}
+
+bool uring_storage::move_storage(fs::path save_path) {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    close_files();
+
+    fs::path from = m_save_path / m_info->name();
+    fs::path to = save_path / m_info->name();
+
+    if (fs::exists(from)) {
+	fs::create_directories(save_path);
+
+	if (::rename(from.string().c_str(), to.string().c_str()) != 0)
+	    return false;
+    }
+
+    m_save_path = save_path;
+
+    return true;
+}
+
+/* resume data records each file's size, a mismatch forces a recheck */
+bool uring_storage::verify_resume_data(entry &rd, std::string &error) {
+    entry *sizes = rd.find_key("file sizes");
+
+    if (!sizes || sizes->type() != entry::list_t) {
+	error = "missing file sizes";
+	return false;
+    }
+
+    const entry::list_type &l = sizes->list();
+
+    if ((int)l.size() != m_info->num_files()) {
+	error = "file count mismatch";
+	return false;
+    }
+
+    int file = 0;
+
+    for (entry::list_type::const_iterator i = l.begin(); i != l.end(); ++i, ++file) {
+	struct stat st;
+	size_type size = 0;
+
+	if (::stat(file_path(file).string().c_str(), &st) == 0)
+	    size = st.st_size;
+
+	if (i->type() != entry::list_t || i->list().empty() || i->list().front().integer() != size) {
+	    error = "file size mismatch: " + file_path(file).string();
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+void uring_storage::write_resume_data(entry &rd) const {
+    entry::list_type sizes;
+
+    for (int file = 0; file < m_info->num_files(); file++) {
+	struct stat st;
+	entry::list_type e;
+
+	if (::stat(file_path(file).string().c_str(), &st) == 0) {
+	    e.push_back(entry((entry::integer_type)st.st_size));
+	    e.push_back(entry((entry::integer_type)st.st_mtime));
+	} else {
+	    e.push_back(entry((entry::integer_type)0));
+	    e.push_back(entry((entry::integer_type)0));
+	}
+
+	sizes.push_back(entry(e));
+    }
+
+    rd["file sizes"] = entry(sizes);
+}
+
+void uring_storage::move_slot(int src_slot, int dst_slot) {
+    int len = m_info->piece_size(src_slot);
+    std::vector<char> buf(len);
+
+    read(&buf[0], src_slot, 0, len);
+    write(&buf[0], dst_slot, 0, len);
+}
+
+void uring_storage::swap_slots(int slot1, int slot2) {
+    int len1 = m_info->piece_size(slot1);
+    int len2 = m_info->piece_size(slot2);
+    std::vector<char> buf1(len1), buf2(len2);
+
+    read(&buf1[0], slot1, 0, len1);
+    read(&buf2[0], slot2, 0, len2);
+    write(&buf1[0], slot2, 0, len1);
+    write(&buf2[0], slot1, 0, len2);
+}
+
+/* slot1 -> slot2, slot2 -> slot3, slot3 -> slot1 */
+void uring_storage::swap_slots3(int slot1, int slot2, int slot3) {
+    int len1 = m_info->piece_size(slot1);
+    int len2 = m_info->piece_size(slot2);
+    int len3 = m_info->piece_size(slot3);
+    std::vector<char> buf1(len1), buf2(len2), buf3(len3);
+
+    read(&buf1[0], slot1, 0, len1);
+    read(&buf2[0], slot2, 0, len2);
+    read(&buf3[0], slot3, 0, len3);
+    write(&buf1[0], slot2, 0, len1);
+    write(&buf2[0], slot3, 0, len2);
+    write(&buf3[0], slot1, 0, len3);
+}
+
+/* the rest of the piece is read in one batch, not block by block */
+sha1_hash uring_storage::hash_for_slot(int slot, partial_hash &ph, int piece_size) {
+    int len = piece_size - ph.offset;
+
+    if (len > 0) {
+	std::vector<char> buf(len);
+
+	read(&buf[0], slot, ph.offset, len);
+	ph.h.update(&buf[0], len);
+    }
+
+    return ph.h.final();
+}
+
+void uring_storage::release_files() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    close_files();
+}
+
+void uring_storage::delete_files() {
+    boost::mutex::scoped_lock l(m_mutex);
+
+    close_files();
+
+    for (int file = 0; file < m_info->num_files(); file++)
+	::unlink(file_path(file).string().c_str());
+}
+
+storage_interface *uring_storage_constructor(boost::intrusive_ptr<torrent_info const> info, 
+    fs::path const &path, file_pool &fp, int queue_depth, bool direct) {
+    return new uring_storage(info, path, queue_depth, direct);
+}
+
+#else
+
+storage_interface *uring_storage_constructor(boost::intrusive_ptr<torrent_info const> info, 
+    fs::path const &path, file_pool &fp, int queue_depth, bool direct) {
+    throw file_error("luatorrent was built without io_uring support (make USE_URING=1)");
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2007,2008 Neil Richardson (nrich@iinet.net.au)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy 
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights 
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+ * copies of the Software, and to permit persons to whom the Software is 
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS 
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LUATORRENT_URING_STORAGE_H
+#define LUATORRENT_URING_STORAGE_H
+
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/storage.hpp"
+
+#ifdef USE_URING
+
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include <liburing.h>
+
+/*
+ * uring_storage
+ *
+ *   file storage laid out like libtorrent's default storage, doing its
+ *   I/O through an io_uring. The blocks a call touches (a block spanning
+ *   files, a whole piece being hashed or moved) are split into chunks and
+ *   submitted together, up to queue_depth in flight. With direct set,
+ *   reads use O_DIRECT through an aligned bounce buffer so seeding does
+ *   not churn the page cache; writes always go through the page cache.
+ *   The session wraps it in a cached_storage, which is what gets
+ *   registered.
+ */
+class uring_storage : public libtorrent::storage_interface {
+public:
+    uring_storage(boost::intrusive_ptr<libtorrent::torrent_info const> info, 
+	const libtorrent::fs::path &save_path, int queue_depth, bool direct);
+    ~uring_storage();
+
+    bool initialize(bool allocate_files);
+    libtorrent::size_type read(char *buf, int slot, int offset, int size);
+    void write(const char *buf, int slot, int offset, int size);
+    bool move_storage(libtorrent::fs::path save_path);
+    bool verify_resume_data(libtorrent::entry &rd, std::string &error);
+    void write_resume_data(libtorrent::entry &rd) const;
+    void move_slot(int src_slot, int dst_slot);
+    void swap_slots(int slot1, int slot2);
+    void swap_slots3(int slot1, int slot2, int slot3);
+    libtorrent::sha1_hash hash_for_slot(int slot, libtorrent::partial_hash &h, int piece_size);
+    void release_files();
+    void delete_files();
+
+private:
+    struct io_op {
+	int fd;
+	char *buf;
+	size_t len;
+	off_t offset;
+	bool write;
+
+	/* O_DIRECT reads land in the bounce buffer and are copied to out */
+	char *out;
+	size_t skip;
+	size_t want;
+    };
+
+    int file_fd(int file, bool direct);
+    void close_files();
+    void run(std::vector<io_op> &ops);
+    void io(char *buf, int slot, int offset, int size, bool write);
+    libtorrent::fs::path file_path(int file) const;
+
+    boost::intrusive_ptr<libtorrent::torrent_info const> m_info;
+    libtorrent::fs::path m_save_path;
+    int m_depth;
+    bool m_direct;
+
+    /* one ring, libtorrent's disk thread and Lua readers take turns */
+    boost::mutex m_mutex;
+    struct io_uring m_ring;
+
+    std::vector<int> m_fds;
+    std::vector<int> m_direct_fds;
+};
+
+#endif
+
+libtorrent::storage_interface *uring_storage_constructor(
+    boost::intrusive_ptr<libtorrent::torrent_info const> info, libtorrent::fs::path const &path, 
+    libtorrent::file_pool &fp, int queue_depth, bool direct);
+
+#endif